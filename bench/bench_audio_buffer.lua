@@ -0,0 +1,60 @@
+local AudioBuffer = require ('kv.AudioBuffer')
+
+local function measure (name, iterations, fn)
+    fn()
+    local start = os.clock()
+    for _ = 1, iterations do fn() end
+    local elapsed = os.clock() - start
+    print (string.format ("  %-28s %10.3f us/block", name, elapsed * 1e6 / iterations))
+    return elapsed
+end
+
+local nchans, nframes = 8, 480
+local iterations      = 200
+local buf    = AudioBuffer.new (nchans, nframes)
+local block  = {}
+for c = 1, nchans do
+    block[c] = {}
+    for f = 1, nframes do block[c][f] = math.random() end
+end
+
+local persample = measure ("get/set per sample", iterations, function()
+    for c = 1, nchans do
+        local ch = block[c]
+        for f = 1, nframes do buf:set (c, f, ch[f]) end
+        for f = 1, nframes do ch[f] = buf:get (c, f) end
+    end
+end)
+
+local bulk = measure ("read/write per channel", iterations, function()
+    for c = 1, nchans do
+        buf:write (c, 1, block[c])
+        buf:read (c, 1, nframes, block[c])
+    end
+end)
+
+local blockwise = measure ("readblock/writeblock", iterations, function()
+    buf:writeblock (1, block)
+    buf:readblock (1, nframes, block)
+end)
+
+local packed = string.rep (string.pack ('f', 0.5), nframes * nchans)
+measure ("writeblock packed string", iterations, function()
+    buf:writeblock (1, packed)
+end)
+
+print (string.format ("  speedup: %.1fx (read/write) %.1fx (block)",
+    persample / bulk, persample / blockwise))
+
+local buf64 = AudioBuffer.new64 (nchans, nframes)
+local perconvert = measure ("convert per sample", iterations, function()
+    for c = 1, nchans do
+        for f = 1, nframes do buf64:set (c, f, buf:get (c, f)) end
+    end
+end)
+
+local convert = measure ("convertfrom", iterations, function()
+    buf64:convertfrom (buf)
+end)
+
+print (string.format ("  speedup: %.1fx (convert)", perconvert / convert))
@@ -0,0 +1,50 @@
+local AudioBuffer = require ('kv.AudioBuffer')
+local Graph       = require ('kv.Graph')
+
+local nchans, nframes = 2, 512
+local nbranches       = 32
+local iterations      = 200
+
+-- independent filter chains summed by one mixer
+local function build (threads)
+    local graph = Graph.new (nchans, nframes, 48000)
+    graph:threads (threads)
+    local mix = graph:add ('mixer', nchans, nbranches)
+    for i = 1, nbranches do
+        local prev = graph:input()
+        for s = 1, 4 do
+            local eq = graph:add ('biquad', nchans, 'peak', 100 * i + 500 * s, 1.0, 3.0)
+            graph:connect (prev, eq)
+            prev = eq
+        end
+        local delay = graph:add ('delay', nchans, 1024, i * 7, 0.3)
+        graph:connect (prev, delay)
+        graph:connect (delay, mix, i)
+    end
+    graph:connect (mix, graph:output())
+    graph:prepare()
+    return graph
+end
+
+local function measure (threads)
+    local graph = build (threads)
+    local audio = AudioBuffer.new32 (nchans, nframes)
+    graph:process (audio)
+    local total = 0.0
+    for _ = 1, iterations do
+        graph:process (audio)
+        total = total + graph:rendertime()
+    end
+    graph:threads (0)
+    return total * 1e3 / iterations
+end
+
+local serial = measure (0)
+print (string.format ("  %-28s %10.3f us/block", "serial", serial))
+local threads = 1
+while threads <= 16 do
+    local elapsed = measure (threads)
+    print (string.format ("  %-28s %10.3f us/block  %.2fx",
+        string.format ("%d workers + caller", threads), elapsed, serial / elapsed))
+    threads = threads * 2
+end
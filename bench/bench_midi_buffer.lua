@@ -0,0 +1,100 @@
+local MidiBuffer = require ('kv.MidiBuffer')
+local midi       = require ('kv.midi')
+
+local function measure (name, iterations, fn)
+    fn()
+    local start = os.clock()
+    for _ = 1, iterations do fn() end
+    local elapsed = os.clock() - start
+    print (string.format ("  %-28s %10.3f us/block", name, elapsed * 1e6 / iterations))
+    return elapsed
+end
+
+local nevents, nframes = 1000, 1024
+local iterations       = 500
+local buf = MidiBuffer.new()
+buf:reserve (nevents * 8)
+for i = 1, nevents do
+    local frame = 1 + (i * nframes) // nevents
+    if i % 3 == 0 then
+        buf:insert (midi.controller (1 + i % 16, i % 128, 64), frame)
+    else
+        buf:insert (midi.noteon (1 + i % 16, i % 128, 1 + i % 127), frame)
+    end
+end
+
+local notes, ccs = 0, 0
+
+local messages = measure ("messages()", iterations, function()
+    notes, ccs = 0, 0
+    for msg in buf:messages() do
+        if msg:isnoteon() then
+            notes = notes + msg:velocity()
+        elseif msg:iscontroller() then
+            ccs = ccs + msg:controllervalue()
+        end
+    end
+end)
+
+local frames, status, data1, data2 = {}, {}, {}, {}
+local decode = measure ("decode()", iterations, function()
+    notes, ccs = 0, 0
+    local n = buf:decode (frames, status, data1, data2)
+    for i = 1, n do
+        local s = status[i] & 0xf0
+        if s == 0x90 and data2[i] > 0 then
+            notes = notes + data2[i]
+        elseif s == 0xb0 then
+            ccs = ccs + data2[i]
+        end
+    end
+end)
+
+print (string.format ("  speedup: %.1fx", messages / decode))
+
+local packs, times = {}, {}
+for i = 1, nevents do
+    packs[i] = midi.noteon (1 + i % 16, i % 128, 100)
+    times[i] = 1 + (i * nframes) // nevents
+end
+
+local reversed = measure ("insert, reverse order", iterations, function()
+    buf:clear()
+    for i = nevents, 1, -1 do buf:insert (packs[i], times[i]) end
+end)
+
+local inorder = measure ("insert, in order", iterations, function()
+    buf:clear()
+    for i = 1, nevents do buf:insert (packs[i], times[i]) end
+end)
+
+local many = measure ("insertmany", iterations, function()
+    buf:clear()
+    buf:insertmany (packs, times)
+end)
+
+print (string.format ("  speedup: %.1fx (in order) %.1fx (insertmany)",
+    reversed / inorder, reversed / many))
+
+local nports, perport = 32, 32
+local ports = {}
+for p = 1, nports do
+    ports[p] = MidiBuffer.new()
+    for i = 1, perport do
+        ports[p]:insert (midi.noteon (1 + p % 16, i, 100), 1 + (i * p * 7) % nframes)
+    end
+end
+
+local out = MidiBuffer.new()
+out:reserve (nports * perport * 16)
+local onebyone = measure ("addbuffer per port", iterations, function()
+    out:clear()
+    for p = 1, nports do out:addbuffer (ports[p], 1, nframes, 0) end
+end)
+
+local merged = measure ("MidiBuffer.merge", iterations, function()
+    out:clear()
+    MidiBuffer.merge (out, ports)
+end)
+
+print (string.format ("  speedup: %.1fx (merge %d ports)", onebyone / merged, nports))
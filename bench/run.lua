@@ -0,0 +1,17 @@
+#!/usr/bin/env lua
+package.cpath = "build/lib/lua/?.so;"..package.cpath
+package.path  = "src/?.lua;bench/?.lua;"..package.path
+
+local benches = {
+    'bench_audio_buffer',
+    'bench_graph',
+    'bench_midi_buffer'
+}
+
+local filter = ...
+for _,b in ipairs (benches) do
+    if filter == nil or string.find (b, filter, 1, true) then
+        print (string.format ("%s:", b))
+        require (b)
+    end
+end
@@ -4,16 +4,267 @@
 #include "lua-kv.hpp"
 #include LKV_JUCE_HEADER
 
+#if JUCE_USE_SSE_INTRINSICS
+ #include <emmintrin.h>
+#elif JUCE_USE_ARM_NEON && defined (__aarch64__)
+ #include <arm_neon.h>
+#endif
+
+LKV_EXPORT int luaopen_kv_AudioBuffer32 (lua_State* L);
+LKV_EXPORT int luaopen_kv_AudioBuffer64 (lua_State* L);
+
 namespace kv {
 namespace lua {
 
+template<typename T> struct AudioBufferTraits;
+
+template<> struct AudioBufferTraits<float> {
+    static constexpr const char* metatable  = LKV_MT_AUDIO_BUFFER_32;
+    static constexpr lua_CFunction open     = luaopen_kv_AudioBuffer32;
+};
+
+template<> struct AudioBufferTraits<double> {
+    static constexpr const char* metatable  = LKV_MT_AUDIO_BUFFER_64;
+    static constexpr lua_CFunction open     = luaopen_kv_AudioBuffer64;
+};
+
+/** Userdata layout of kv.AudioBuffer32 and kv.AudioBuffer64.
+    The juce buffer lives inline in the userdata block and, when small enough
+    to refer to, its samples are stored right after it. Sample memory is then
+    part of the single Lua allocation and visible to the garbage collector.
+*/
+template<typename T>
+struct AudioBufferImpl final {
+    using Buffer = juce::AudioBuffer<T>;
+
+    /** Alignment of inline sample storage */
+    static constexpr size_t alignment   = 32;
+    /** Channel counts below this refer to inline storage without allocating.
+        Matches juce::AudioBuffer's preallocated channel space */
+    static constexpr int maxChannels    = 32;
+
+    /** The buffer binding */
+    Buffer      buffer;
+    /** Inline sample memory, nullptr if none */
+    T*          storage     { nullptr };
+    /** Number of samples in the inline storage */
+    size_t      capacity    { 0 };
+    /** False while the binding refers to memory owned elsewhere */
+    bool        owned       { true };
+    /** Buffer this one is a slice of, nullptr if it owns its binding */
+    AudioBufferImpl* parent { nullptr };
+    /** First live slice of this buffer, linked through `sibling` */
+    AudioBufferImpl* slices { nullptr };
+    /** Next slice of the same parent */
+    AudioBufferImpl* sibling { nullptr };
+
+    /** Userdata size needed for a buffer with inline sample storage */
+    static size_t userdata_size (int nchans, int nframes) {
+        if (! fits_inline (nchans, nframes))
+            return sizeof (AudioBufferImpl);
+        return sizeof (AudioBufferImpl) + alignment
+            + sizeof (T) * static_cast<size_t> (nchans) * static_cast<size_t> (nframes);
+    }
+
+    static bool fits_inline (int nchans, int nframes) {
+        return nchans > 0 && nframes > 0 && nchans < maxChannels;
+    }
+
+    /** Construct in a userdata block allocated with userdata_size */
+    AudioBufferImpl (int nchans, int nframes) {
+        if (fits_inline (nchans, nframes)) {
+            auto addr = reinterpret_cast<uintptr_t> (this + 1);
+            addr = (addr + alignment - 1) & ~(uintptr_t) (alignment - 1);
+            storage  = reinterpret_cast<T*> (addr);
+            capacity = static_cast<size_t> (nchans) * static_cast<size_t> (nframes);
+            refer_to (storage, nchans, nframes, true);
+        } else {
+            buffer.setSize (juce::jmax (0, nchans), juce::jmax (0, nframes));
+        }
+    }
+
+    ~AudioBufferImpl() {
+        release();
+    }
+
+    AudioBufferImpl (const AudioBufferImpl&) = delete;
+    AudioBufferImpl& operator= (const AudioBufferImpl&) = delete;
+
+    /** Make this buffer a slice of another. Slices alias the parent's sample
+        memory and are emptied whenever the parent's binding changes */
+    void slice_of (AudioBufferImpl& owner, int channel, int nchans, int start, int nframes) {
+        release();
+        buffer  = Buffer (owner.buffer.getArrayOfWritePointers() + channel, nchans, start, nframes);
+        owned   = false;
+        parent  = &owner;
+        sibling = owner.slices;
+        owner.slices = this;
+    }
+
+    /** Empty every slice of this buffer and detach this buffer from its own
+        parent. Called before the binding changes so no slice can outlive
+        the memory it refers to */
+    void release() {
+        for (auto* s = slices; s != nullptr;) {
+            auto* next = s->sibling;
+            s->parent  = nullptr;
+            s->sibling = nullptr;
+            s->release();
+            s->buffer  = Buffer();
+            s = next;
+        }
+        slices = nullptr;
+
+        if (parent != nullptr) {
+            for (auto** s = &parent->slices; *s != nullptr; s = &(*s)->sibling) {
+                if (*s == this) {
+                    *s = sibling;
+                    break;
+                }
+            }
+            parent  = nullptr;
+            sibling = nullptr;
+        }
+    }
+
+    /** Resize the buffer, preferring the inline storage when contents don't
+        need preserving and the new size fits. Otherwise same as juce::AudioBuffer::setSize */
+    void resize (int nchans, int nframes, bool preserve, bool clear, bool norealloc) {
+        release();
+        if (! preserve && fits_inline (nchans, nframes) &&
+            static_cast<size_t> (nchans) * static_cast<size_t> (nframes) <= capacity)
+        {
+            refer_to (storage, nchans, nframes, clear);
+            return;
+        }
+
+        // juce keeps the binding when the size doesn't change, external
+        // memory included
+        if (nchans != buffer.getNumChannels() || nframes != buffer.getNumSamples())
+            owned = true;
+        buffer.setSize (nchans, nframes, preserve, clear, norealloc);
+    }
+
+    /** Release memory, leaving an empty buffer */
+    void free() {
+        release();
+        buffer = Buffer();
+        owned  = true;
+    }
+
+    /** Refer to contiguous, non-interleaved sample memory owned elsewhere.
+        Never allocates, nchans must be less than maxChannels */
+    void refer_to (T* data, int nchans, int nframes, bool clear) {
+        release();
+        T* channels [maxChannels];
+        for (int c = 0; c < nchans; ++c)
+            channels[c] = data + static_cast<size_t> (c) * static_cast<size_t> (nframes);
+        if (clear)
+            memset (data, 0, sizeof (T) * static_cast<size_t> (nchans) * static_cast<size_t> (nframes));
+        buffer.setDataToReferTo (channels, nchans, nframes);
+        owned = data == storage;
+    }
+
+    /** Refer to channels owned elsewhere. Never allocates */
+    void refer_to (T** channels, int nchans, int nframes) {
+        release();
+        buffer.setDataToReferTo (channels, nchans, nframes);
+        owned = false;
+    }
+};
+
+//==============================================================================
+/** Convert samples from one type to another */
+template<typename D, typename S>
+inline void convert_samples (D* dst, const S* src, int count) noexcept {
+    for (int i = 0; i < count; ++i)
+        dst[i] = static_cast<D> (src[i]);
+}
+
+inline void convert_samples (float* dst, const float* src, int count) noexcept {
+    juce::FloatVectorOperations::copy (dst, src, count);
+}
+
+inline void convert_samples (double* dst, const double* src, int count) noexcept {
+    juce::FloatVectorOperations::copy (dst, src, count);
+}
+
+/** Widen 32bit samples to 64bit */
+inline void convert_samples (double* dst, const float* src, int count) noexcept {
+    int i = 0;
+   #if JUCE_USE_SSE_INTRINSICS
+    for (; i + 4 <= count; i += 4) {
+        const __m128 f = _mm_loadu_ps (src + i);
+        _mm_storeu_pd (dst + i,     _mm_cvtps_pd (f));
+        _mm_storeu_pd (dst + i + 2, _mm_cvtps_pd (_mm_movehl_ps (f, f)));
+    }
+   #elif JUCE_USE_ARM_NEON && defined (__aarch64__)
+    for (; i + 4 <= count; i += 4) {
+        const float32x4_t f = vld1q_f32 (src + i);
+        vst1q_f64 (dst + i,     vcvt_f64_f32 (vget_low_f32 (f)));
+        vst1q_f64 (dst + i + 2, vcvt_high_f64_f32 (f));
+    }
+   #endif
+    for (; i < count; ++i)
+        dst[i] = static_cast<double> (src[i]);
+}
+
+/** Narrow 64bit samples to 32bit */
+inline void convert_samples (float* dst, const double* src, int count) noexcept {
+    int i = 0;
+   #if JUCE_USE_SSE_INTRINSICS
+    for (; i + 4 <= count; i += 4) {
+        const __m128 lo = _mm_cvtpd_ps (_mm_loadu_pd (src + i));
+        const __m128 hi = _mm_cvtpd_ps (_mm_loadu_pd (src + i + 2));
+        _mm_storeu_ps (dst + i, _mm_movelh_ps (lo, hi));
+    }
+   #elif JUCE_USE_ARM_NEON && defined (__aarch64__)
+    for (; i + 4 <= count; i += 4) {
+        const float32x2_t lo = vcvt_f32_f64 (vld1q_f64 (src + i));
+        vst1q_f32 (dst + i, vcvt_high_f32_f64 (lo, vld1q_f64 (src + i + 2)));
+    }
+   #endif
+    for (; i < count; ++i)
+        dst[i] = static_cast<float> (src[i]);
+}
+
+//==============================================================================
+/** Allocate a new kv.AudioBuffer32 or kv.AudioBuffer64 on the stack.
+    The sample memory is zeroed */
 template<typename T>
-inline juce::AudioBuffer<T>* 
-create_audio_buffer (lua_State* L, int nchans, int nframes) {
-    auto** userdata = lua_newuserdata (L, sizeof (juce::AudioBuffer<T>**));
-    *userdata = new juce::AudioBuffer<T> (juce::jmax (0, nchans), juce::jmax (0, nframes));
-    luaL_setmetatable (L, LKV_MT_AUDIO_BUFFER);
-    return *userdata;
+inline AudioBufferImpl<T>* new_audio_buffer (lua_State* L, int nchans, int nframes) {
+    using Traits = AudioBufferTraits<T>;
+    if (luaL_getmetatable (L, Traits::metatable) == LUA_TNIL) {
+        luaL_requiref (L, Traits::metatable, Traits::open, 0);
+        lua_pop (L, 1);
+    }
+    lua_pop (L, 1);
+
+    nchans  = juce::jmax (0, nchans);
+    nframes = juce::jmax (0, nframes);
+    auto* block = lua_newuserdata (L, AudioBufferImpl<T>::userdata_size (nchans, nframes));
+    auto* impl  = new (block) AudioBufferImpl<T> (nchans, nframes);
+    luaL_setmetatable (L, Traits::metatable);
+    return impl;
+}
+
+/** Returns the audio buffer at index or nullptr if not a buffer of type T */
+template<typename T>
+inline AudioBufferImpl<T>* to_audio_buffer (lua_State* L, int index) {
+    return (AudioBufferImpl<T>*) luaL_testudata (L, index, AudioBufferTraits<T>::metatable);
+}
+
+/** Calls fn with the juce::AudioBuffer of the 32 or 64 bit kv.AudioBuffer at
+    index. Raises an argument error if the value isn't an audio buffer */
+template<typename Fn>
+inline void with_audio_buffer (lua_State* L, int index, Fn&& fn) {
+    if (auto* b32 = to_audio_buffer<float> (L, index)) {
+        fn (b32->buffer);
+    } else if (auto* b64 = to_audio_buffer<double> (L, index)) {
+        fn (b64->buffer);
+    } else {
+        luaL_argerror (L, index, "kv.AudioBuffer expected");
+    }
 }
 
 }}
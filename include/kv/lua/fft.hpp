@@ -0,0 +1,218 @@
+
+#pragma once
+
+#include "kv/lua/audio_buffer.hpp"
+#include <complex>
+#include <vector>
+
+namespace kv {
+namespace lua {
+
+using Complex = std::complex<float>;
+
+/** acc += a * b over n complex values */
+inline void complex_multiply_add (Complex* acc, const Complex* a, const Complex* b, int n) noexcept {
+    int i = 0;
+   #if JUCE_USE_SSE_INTRINSICS
+    const __m128 negate = _mm_set_ps (0.f, -0.f, 0.f, -0.f);
+    for (; i + 2 <= n; i += 2) {
+        const __m128 x  = _mm_loadu_ps (reinterpret_cast<const float*> (a + i));
+        const __m128 y  = _mm_loadu_ps (reinterpret_cast<const float*> (b + i));
+        const __m128 yr = _mm_shuffle_ps (y, y, _MM_SHUFFLE (2, 2, 0, 0));
+        const __m128 yi = _mm_shuffle_ps (y, y, _MM_SHUFFLE (3, 3, 1, 1));
+        const __m128 xs = _mm_shuffle_ps (x, x, _MM_SHUFFLE (2, 3, 0, 1));
+        const __m128 p  = _mm_add_ps (_mm_mul_ps (x, yr), _mm_xor_ps (_mm_mul_ps (xs, yi), negate));
+        auto* out = reinterpret_cast<float*> (acc + i);
+        _mm_storeu_ps (out, _mm_add_ps (_mm_loadu_ps (out), p));
+    }
+   #elif JUCE_USE_ARM_NEON && defined (__aarch64__)
+    for (; i + 4 <= n; i += 4) {
+        const float32x4x2_t x = vld2q_f32 (reinterpret_cast<const float*> (a + i));
+        const float32x4x2_t y = vld2q_f32 (reinterpret_cast<const float*> (b + i));
+        auto* out = reinterpret_cast<float*> (acc + i);
+        float32x4x2_t z = vld2q_f32 (out);
+        z.val[0] = vmlsq_f32 (vmlaq_f32 (z.val[0], x.val[0], y.val[0]), x.val[1], y.val[1]);
+        z.val[1] = vmlaq_f32 (vmlaq_f32 (z.val[1], x.val[0], y.val[1]), x.val[1], y.val[0]);
+        vst2q_f32 (out, z);
+    }
+   #endif
+    for (; i < n; ++i)
+        acc[i] += Complex (a[i].real() * b[i].real() - a[i].imag() * b[i].imag(),
+                           a[i].real() * b[i].imag() + a[i].imag() * b[i].real());
+}
+
+/** A preplanned power of two FFT.
+    Iterative radix-2 with twiddle and bit reverse tables built in the
+    constructor. A real transform of size N runs as a complex transform of
+    size N / 2 sharing the same tables. Transforms never allocate.
+*/
+class FFTPlan final {
+public:
+    explicit FFTPlan (int n)
+        : nfft (n),
+          twiddles (static_cast<size_t> (n)),
+          fullorder (static_cast<size_t> (n)),
+          halforder (static_cast<size_t> (n / 2))
+    {
+        // stage with half length h uses twiddles[h .. 2h)
+        for (int h = 1; h < n; h *= 2)
+            for (int j = 0; j < h; ++j)
+                twiddles[h + j] = std::polar (1.0, -juce::MathConstants<double>::pi * j / h);
+
+        reorder (fullorder, n);
+        reorder (halforder, n / 2);
+    }
+
+    /** Transform size */
+    int size() const noexcept { return nfft; }
+
+    /** Number of bins in a real spectrum */
+    int bins() const noexcept { return nfft / 2 + 1; }
+
+    /** Complex transform of size points in place. The inverse is scaled
+        by 1 / size */
+    void complex (Complex* data, bool inverse) noexcept {
+        if (! inverse) {
+            transform (data, nfft, fullorder);
+            return;
+        }
+
+        conjugate (data, nfft);
+        transform (data, nfft, fullorder);
+        const float scale = 1.f / nfft;
+        for (int i = 0; i < nfft; ++i)
+            data[i] = { data[i].real() * scale, -data[i].imag() * scale };
+    }
+
+    /** Real transform of size samples to bins() values. Even and odd
+        samples are packed into size / 2 complex points, transformed, then
+        split into the bins */
+    void forward (const float* in, Complex* out) noexcept {
+        const int half = nfft / 2;
+        for (int i = 0; i < half; ++i)
+            out[i] = { in[2 * i], in[2 * i + 1] };
+        transform (out, half, halforder);
+
+        const Complex z0 = out[0];
+        for (int k = 1; k <= half / 2; ++k) {
+            const Complex zk = out[k], zm = std::conj (out[half - k]);
+            const Complex even = 0.5f * (zk + zm);
+            const Complex odd  = Complex (0.f, -0.5f) * (zk - zm);
+            const Complex wk   = twiddles[half + k];
+            out[k] = even + wk * odd;
+            // the mirrored bin shares both halves, conjugated
+            if (k != half - k)
+                out[half - k] = std::conj (even - wk * odd);
+        }
+        out[0]    = { z0.real() + z0.imag(), 0.f };
+        out[half] = { z0.real() - z0.imag(), 0.f };
+    }
+
+    /** Inverse of forward, scaled by 1 / size. The bins are overwritten */
+    void inverse (Complex* in, float* out) noexcept {
+        const int half = nfft / 2;
+        const Complex x0 = in[0], xn = in[half];
+        for (int k = 1; k <= half / 2; ++k) {
+            const Complex xk = in[k], xm = std::conj (in[half - k]);
+            const Complex even = 0.5f * (xk + xm);
+            const Complex odd  = 0.5f * (xk - xm) * std::conj (twiddles[half + k]);
+            in[k] = even + Complex (0.f, 1.f) * odd;
+            if (k != half - k)
+                in[half - k] = std::conj (even) + Complex (0.f, 1.f) * std::conj (odd);
+        }
+        in[0] = { 0.5f * (x0.real() + xn.real()), 0.5f * (x0.real() - xn.real()) };
+
+        conjugate (in, half);
+        transform (in, half, halforder);
+        const float scale = 1.f / half;
+        for (int i = 0; i < half; ++i) {
+            out[2 * i]     =  in[i].real() * scale;
+            out[2 * i + 1] = -in[i].imag() * scale;
+        }
+    }
+
+private:
+    int nfft;
+    /** Twiddle factors for every stage, see the constructor */
+    std::vector<Complex> twiddles;
+    /** Bit reversed indexes for sizes N and N / 2 */
+    std::vector<int> fullorder, halforder;
+
+    static void reorder (std::vector<int>& order, int n) {
+        int bits = 0;
+        while ((1 << bits) < n)
+            ++bits;
+        for (int i = 0; i < n; ++i) {
+            int r = 0;
+            for (int b = 0; b < bits; ++b)
+                r |= ((i >> b) & 1) << (bits - 1 - b);
+            order[i] = r;
+        }
+    }
+
+    static void conjugate (Complex* data, int n) noexcept {
+        for (int i = 0; i < n; ++i)
+            data[i] = std::conj (data[i]);
+    }
+
+    /** In place forward complex transform of n points, n <= size */
+    void transform (Complex* data, int n, const std::vector<int>& order) noexcept {
+        for (int i = 0; i < n; ++i) {
+            const int j = order[i];
+            if (i < j)
+                std::swap (data[i], data[j]);
+        }
+
+        for (int h = 1; h < n; h *= 2) {
+            const Complex* w = twiddles.data() + h;
+            for (int s = 0; s < n; s += 2 * h)
+                butterflies (data + s, data + s + h, w, h);
+        }
+    }
+
+    /** a' = a + w b, b' = a - w b over h points */
+    static void butterflies (Complex* a, Complex* b, const Complex* w, int h) noexcept {
+        int j = 0;
+       #if JUCE_USE_SSE_INTRINSICS
+        const __m128 negate = _mm_set_ps (0.f, -0.f, 0.f, -0.f);
+        for (; j + 2 <= h; j += 2) {
+            auto* pa = reinterpret_cast<float*> (a + j);
+            auto* pb = reinterpret_cast<float*> (b + j);
+            const __m128 tw = _mm_loadu_ps (reinterpret_cast<const float*> (w + j));
+            const __m128 x  = _mm_loadu_ps (pb);
+            const __m128 wr = _mm_shuffle_ps (tw, tw, _MM_SHUFFLE (2, 2, 0, 0));
+            const __m128 wi = _mm_shuffle_ps (tw, tw, _MM_SHUFFLE (3, 3, 1, 1));
+            const __m128 xs = _mm_shuffle_ps (x, x, _MM_SHUFFLE (2, 3, 0, 1));
+            const __m128 t  = _mm_add_ps (_mm_mul_ps (x, wr), _mm_xor_ps (_mm_mul_ps (xs, wi), negate));
+            const __m128 y  = _mm_loadu_ps (pa);
+            _mm_storeu_ps (pa, _mm_add_ps (y, t));
+            _mm_storeu_ps (pb, _mm_sub_ps (y, t));
+        }
+       #elif JUCE_USE_ARM_NEON && defined (__aarch64__)
+        for (; j + 4 <= h; j += 4) {
+            auto* pa = reinterpret_cast<float*> (a + j);
+            auto* pb = reinterpret_cast<float*> (b + j);
+            const float32x4x2_t tw = vld2q_f32 (reinterpret_cast<const float*> (w + j));
+            const float32x4x2_t x  = vld2q_f32 (pb);
+            const float32x4x2_t y  = vld2q_f32 (pa);
+            const float32x4_t tr = vsubq_f32 (vmulq_f32 (x.val[0], tw.val[0]), vmulq_f32 (x.val[1], tw.val[1]));
+            const float32x4_t ti = vaddq_f32 (vmulq_f32 (x.val[0], tw.val[1]), vmulq_f32 (x.val[1], tw.val[0]));
+            float32x4x2_t out;
+            out.val[0] = vaddq_f32 (y.val[0], tr);
+            out.val[1] = vaddq_f32 (y.val[1], ti);
+            vst2q_f32 (pa, out);
+            out.val[0] = vsubq_f32 (y.val[0], tr);
+            out.val[1] = vsubq_f32 (y.val[1], ti);
+            vst2q_f32 (pb, out);
+        }
+       #endif
+        for (; j < h; ++j) {
+            const Complex bw (b[j].real() * w[j].real() - b[j].imag() * w[j].imag(),
+                              b[j].real() * w[j].imag() + b[j].imag() * w[j].real());
+            b[j] = a[j] - bw;
+            a[j] += bw;
+        }
+    }
+};
+
+}}
@@ -0,0 +1,255 @@
+
+#pragma once
+
+#include "kv/lua/audio_buffer.hpp"
+#include <cmath>
+#include <complex>
+#include <vector>
+
+namespace kv {
+namespace lua {
+
+/** Normalized biquad coefficients, a0 is 1 */
+struct Coeffs {
+    double b0 { 1.0 }, b1 { 0.0 }, b2 { 0.0 }, a1 { 0.0 }, a2 { 0.0 };
+
+    Coeffs at (const Coeffs& delta, double k) const noexcept {
+        return { b0 + delta.b0 * k, b1 + delta.b1 * k, b2 + delta.b2 * k,
+                 a1 + delta.a1 * k, a2 + delta.a2 * k };
+    }
+};
+
+/** Coefficients of one section, shared by all channels */
+struct Section {
+    Coeffs  current, target, delta;
+    /** Samples left in the current ramp */
+    int     ramp    { 0 };
+    /** True until first set, which then applies without ramping */
+    bool    fresh   { true };
+};
+
+/** Transposed direct form II cascade. Channels are processed in pairs so
+    both lanes of a 128 bit register do work */
+class FilterBankImpl final {
+public:
+    FilterBankImpl (int channels, int numSections, double rate)
+        : nchannels (channels),
+          npairs ((channels + 1) / 2),
+          sections (static_cast<size_t> (numSections)),
+          state (static_cast<size_t> (numSections * npairs * 4), 0.0),
+          samplerate (rate)
+    {}
+
+    int channels() const noexcept { return nchannels; }
+    int size() const noexcept { return static_cast<int> (sections.size()); }
+
+    double rate() const noexcept { return samplerate; }
+    void setrate (double r) noexcept { samplerate = r; }
+
+    /** Set frames over which coefficient changes ramp */
+    void setsmoothing (int frames) noexcept { smoothing = frames; }
+    int getsmoothing() const noexcept { return smoothing; }
+
+    const Coeffs& coeffs (int index) const noexcept { return sections[index].target; }
+
+    /** Set a section's target coefficients */
+    void set (int index, const Coeffs& c) noexcept {
+        auto& s = sections[index];
+        s.target = c;
+        if (s.fresh || smoothing <= 0) {
+            s.current = c;
+            s.ramp    = 0;
+            s.fresh   = false;
+            return;
+        }
+
+        const double k = 1.0 / smoothing;
+        s.delta = { (c.b0 - s.current.b0) * k, (c.b1 - s.current.b1) * k, (c.b2 - s.current.b2) * k,
+                    (c.a1 - s.current.a1) * k, (c.a2 - s.current.a2) * k };
+        s.ramp = smoothing;
+    }
+
+    /** Clear filter state and finish ramps */
+    void reset() noexcept {
+        std::fill (state.begin(), state.end(), 0.0);
+        for (auto& s : sections) {
+            s.current = s.target;
+            s.ramp = 0;
+        }
+    }
+
+    /** Magnitude response of the cascade at a frequency, using targets */
+    double magnitude (double freq) const noexcept {
+        const double w = 2.0 * juce::MathConstants<double>::pi * freq / samplerate;
+        const std::complex<double> z1 = std::polar (1.0, -w), z2 = z1 * z1;
+        double mag = 1.0;
+        for (const auto& s : sections) {
+            const auto& c = s.target;
+            mag *= std::abs ((c.b0 + c.b1 * z1 + c.b2 * z2) / (1.0 + c.a1 * z1 + c.a2 * z2));
+        }
+        return mag;
+    }
+
+    template<typename T>
+    void process (juce::AudioBuffer<T>& buffer, int start, int count) noexcept {
+        juce::ScopedNoDenormals noDenormals;
+
+        for (int done = 0; done < count; done += blockSize) {
+            const int n = juce::jmin (blockSize, count - done);
+
+            for (int p = 0; p < npairs; ++p) {
+                const int left  = p * 2;
+                const bool both = left + 1 < nchannels;
+                double tmp [2][blockSize];
+                kv::lua::convert_samples (tmp[0], buffer.getReadPointer (left, start + done), n);
+                if (both)
+                    kv::lua::convert_samples (tmp[1], buffer.getReadPointer (left + 1, start + done), n);
+                else
+                    std::fill (tmp[1], tmp[1] + n, 0.0);
+
+                for (size_t s = 0; s < sections.size(); ++s)
+                    run (sections[s], state.data() + (s * (size_t) npairs + (size_t) p) * 4, tmp[0], tmp[1], n);
+
+                kv::lua::convert_samples (buffer.getWritePointer (left, start + done), tmp[0], n);
+                if (both)
+                    kv::lua::convert_samples (buffer.getWritePointer (left + 1, start + done), tmp[1], n);
+            }
+
+            // ramps advance once per block, after every pair used them
+            for (auto& s : sections) {
+                if (s.ramp <= 0)
+                    continue;
+                const int step = juce::jmin (n, s.ramp);
+                s.ramp -= step;
+                s.current = s.ramp > 0 ? s.current.at (s.delta, step) : s.target;
+            }
+        }
+    }
+
+private:
+    static constexpr int blockSize = 64;
+
+    int nchannels;
+    int npairs;
+    std::vector<Section> sections;
+    /** Per section and pair: z1 left, z1 right, z2 left, z2 right */
+    std::vector<double> state;
+    double samplerate;
+    int smoothing { 0 };
+
+    /** Run one section over a pair of channels */
+    static void run (const Section& s, double* z, double* left, double* right, int n) noexcept {
+       #if JUCE_USE_SSE_INTRINSICS
+        __m128d z1 = _mm_loadu_pd (z), z2 = _mm_loadu_pd (z + 2);
+        Coeffs c = s.current;
+        for (int i = 0; i < n; ++i) {
+            if (i < s.ramp)
+                c = s.current.at (s.delta, i + 1);
+            const __m128d x = _mm_set_pd (right[i], left[i]);
+            const __m128d y = _mm_add_pd (_mm_mul_pd (x, _mm_set1_pd (c.b0)), z1);
+            z1 = _mm_add_pd (_mm_sub_pd (_mm_mul_pd (x, _mm_set1_pd (c.b1)), _mm_mul_pd (y, _mm_set1_pd (c.a1))), z2);
+            z2 = _mm_sub_pd (_mm_mul_pd (x, _mm_set1_pd (c.b2)), _mm_mul_pd (y, _mm_set1_pd (c.a2)));
+            _mm_storel_pd (left + i, y);
+            _mm_storeh_pd (right + i, y);
+        }
+        _mm_storeu_pd (z, z1);
+        _mm_storeu_pd (z + 2, z2);
+       #elif JUCE_USE_ARM_NEON && defined (__aarch64__)
+        float64x2_t z1 = vld1q_f64 (z), z2 = vld1q_f64 (z + 2);
+        Coeffs c = s.current;
+        for (int i = 0; i < n; ++i) {
+            if (i < s.ramp)
+                c = s.current.at (s.delta, i + 1);
+            const float64x2_t x = { left[i], right[i] };
+            const float64x2_t y = vaddq_f64 (vmulq_n_f64 (x, c.b0), z1);
+            z1 = vaddq_f64 (vsubq_f64 (vmulq_n_f64 (x, c.b1), vmulq_n_f64 (y, c.a1)), z2);
+            z2 = vsubq_f64 (vmulq_n_f64 (x, c.b2), vmulq_n_f64 (y, c.a2));
+            left[i]  = vgetq_lane_f64 (y, 0);
+            right[i] = vgetq_lane_f64 (y, 1);
+        }
+        vst1q_f64 (z, z1);
+        vst1q_f64 (z + 2, z2);
+       #else
+        double* io[2] = { left, right };
+        for (int ch = 0; ch < 2; ++ch) {
+            double z1 = z[ch], z2 = z[ch + 2];
+            auto* x = io[ch];
+            Coeffs c = s.current;
+            for (int i = 0; i < n; ++i) {
+                if (i < s.ramp)
+                    c = s.current.at (s.delta, i + 1);
+                const double y = c.b0 * x[i] + z1;
+                z1 = c.b1 * x[i] - c.a1 * y + z2;
+                z2 = c.b2 * x[i] - c.a2 * y;
+                x[i] = y;
+            }
+            z[ch] = z1;
+            z[ch + 2] = z2;
+        }
+       #endif
+    }
+};
+
+//==============================================================================
+enum FilterType { Lowpass = 0, Highpass, Bandpass, Notch, Allpass, Peak, Lowshelf, Highshelf };
+
+static const char* const filter_types[] = {
+    "lowpass", "highpass", "bandpass", "notch", "allpass", "peak", "lowshelf", "highshelf", nullptr
+};
+
+/** RBJ audio EQ cookbook designs */
+inline Coeffs design (FilterType type, double rate, double freq, double q, double gaindb) {
+    const double w0    = 2.0 * juce::MathConstants<double>::pi * freq / rate;
+    const double cosw  = std::cos (w0);
+    const double alpha = std::sin (w0) / (2.0 * q);
+    const double A     = std::pow (10.0, gaindb / 40.0);
+    const double sqA2a = 2.0 * std::sqrt (A) * alpha;
+    double b0 = 1, b1 = 0, b2 = 0, a0 = 1, a1 = 0, a2 = 0;
+
+    switch (type) {
+        case Lowpass:
+            b0 = (1.0 - cosw) / 2.0; b1 = 1.0 - cosw; b2 = b0;
+            a0 = 1.0 + alpha; a1 = -2.0 * cosw; a2 = 1.0 - alpha;
+            break;
+        case Highpass:
+            b0 = (1.0 + cosw) / 2.0; b1 = -(1.0 + cosw); b2 = b0;
+            a0 = 1.0 + alpha; a1 = -2.0 * cosw; a2 = 1.0 - alpha;
+            break;
+        case Bandpass:
+            b0 = alpha; b1 = 0.0; b2 = -alpha;
+            a0 = 1.0 + alpha; a1 = -2.0 * cosw; a2 = 1.0 - alpha;
+            break;
+        case Notch:
+            b0 = 1.0; b1 = -2.0 * cosw; b2 = 1.0;
+            a0 = 1.0 + alpha; a1 = -2.0 * cosw; a2 = 1.0 - alpha;
+            break;
+        case Allpass:
+            b0 = 1.0 - alpha; b1 = -2.0 * cosw; b2 = 1.0 + alpha;
+            a0 = 1.0 + alpha; a1 = -2.0 * cosw; a2 = 1.0 - alpha;
+            break;
+        case Peak:
+            b0 = 1.0 + alpha * A; b1 = -2.0 * cosw; b2 = 1.0 - alpha * A;
+            a0 = 1.0 + alpha / A; a1 = -2.0 * cosw; a2 = 1.0 - alpha / A;
+            break;
+        case Lowshelf:
+            b0 = A * ((A + 1.0) - (A - 1.0) * cosw + sqA2a);
+            b1 = 2.0 * A * ((A - 1.0) - (A + 1.0) * cosw);
+            b2 = A * ((A + 1.0) - (A - 1.0) * cosw - sqA2a);
+            a0 = (A + 1.0) + (A - 1.0) * cosw + sqA2a;
+            a1 = -2.0 * ((A - 1.0) + (A + 1.0) * cosw);
+            a2 = (A + 1.0) + (A - 1.0) * cosw - sqA2a;
+            break;
+        case Highshelf:
+            b0 = A * ((A + 1.0) + (A - 1.0) * cosw + sqA2a);
+            b1 = -2.0 * A * ((A - 1.0) + (A + 1.0) * cosw);
+            b2 = A * ((A + 1.0) + (A - 1.0) * cosw - sqA2a);
+            a0 = (A + 1.0) - (A - 1.0) * cosw + sqA2a;
+            a1 = 2.0 * ((A - 1.0) - (A + 1.0) * cosw);
+            a2 = (A + 1.0) - (A - 1.0) * cosw - sqA2a;
+            break;
+    }
+
+    return { b0 / a0, b1 / a0, b2 / a0, a1 / a0, a2 / a0 };
+}
+
+}}
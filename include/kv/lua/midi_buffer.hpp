@@ -2,10 +2,38 @@
 #pragma once
 #include "lua-kv.hpp"
 #include LKV_JUCE_HEADER
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+LKV_EXPORT int luaopen_kv_MidiBuffer (lua_State* L);
 
 namespace kv {
 namespace lua {
 
+struct MidiBufferImpl;
+
+/** A kv.MidiView, pointing at one event in a buffer. The event is kept as a
+    byte offset and checked against the buffer's contents on every use */
+struct MidiView final {
+    /** Buffer iterated, nullptr outside of a loop */
+    const MidiBufferImpl*       owner       { nullptr };
+    /** Offset of the event bytes in the buffer's data */
+    int                         offset      { 0 };
+    int                         size        { 0 };
+    int                         frame       { 0 };
+};
+
+/** What a fixed capacity buffer does with an event that doesn't fit */
+enum MidiOverflow : int {
+    /** Drop the incoming event */
+    DropNewest = 0,
+    /** Drop events from the start until it fits */
+    DropOldest,
+    /** Add it anyway, growing the buffer */
+    Grow
+};
+
 struct MidiBufferImpl final {
     /** The buffer binding */
     juce::MidiBuffer            buffer;
@@ -14,6 +42,21 @@ struct MidiBufferImpl final {
     /** Cached message used by iterator */
     juce::MidiMessage**         message     { nullptr };
     int                         msgref      { LUA_REFNIL };
+    /** Cached view handed out while iterating */
+    MidiView*                   view        { nullptr };
+    int                         viewref     { LUA_REFNIL };
+    /** Cached iterator closures, reused by every loop */
+    int                         eventsref   { LUA_REFNIL };
+    int                         messagesref { LUA_REFNIL };
+    int                         viewsref    { LUA_REFNIL };
+    /** Bytes a fixed buffer holds, 0 if it grows as needed */
+    int                         capacity    { 0 };
+    int                         overflow    { DropNewest };
+    /** Events dropped or added past capacity */
+    lua_Integer                 overflows   { 0 };
+    /** Spare storage a fixed buffer compacts into, so removing events
+        never shrinks, and so reallocates, the buffer */
+    juce::MidiBuffer            scratch;
 
     MidiBufferImpl (lua_State* L) {
         message = (juce::MidiMessage**) lua_newuserdata (L, sizeof (juce::MidiMessage**));
@@ -25,15 +68,18 @@ struct MidiBufferImpl final {
 
     void free (lua_State* L) {
         // garbage collector will free the data
-        if (msgref != LUA_REFNIL) {
-            msgref = LUA_REFNIL;
-            luaL_unref (L, LUA_REGISTRYINDEX, msgref);
+        for (auto* ref : { &msgref, &viewref, &eventsref, &messagesref, &viewsref }) {
+            luaL_unref (L, LUA_REGISTRYINDEX, *ref);
+            *ref = LUA_REFNIL;
         }
-        
+
         if (message != nullptr) {
            *message = nullptr;
             message = nullptr;
         }
+        if (view != nullptr)
+            *view = {};
+        view = nullptr;
     }
 
     void reset_iter()
@@ -41,12 +87,291 @@ struct MidiBufferImpl final {
         iter = buffer.begin();
         **message = juce::MidiMessage();
     }
+
+    /** Reserve bytes for events, and as much scratch storage so merging and
+        compacting within that size never allocate. Allocates */
+    void reserve (size_t bytes) {
+        buffer.ensureSize (bytes);
+        scratch.ensureSize (bytes);
+    }
+
+    /** Make this a fixed capacity buffer. Allocates */
+    void setfixed (int bytes, int policy) {
+        capacity = bytes;
+        overflow = policy;
+        reserve (static_cast<size_t> (bytes));
+    }
+
+    /** Bytes `addEvent` will store for an event, matching how
+        juce::MidiBuffer trims it. SysEx and meta events are taken whole,
+        which can only overestimate */
+    static int eventbytes (const juce::uint8* data, int size) noexcept {
+        if (size <= 0 || data[0] < 0x80)
+            return 0;
+        const auto first = data[0];
+        if (first != 0xf0 && first != 0xf7 && first != 0xff)
+            size = juce::jmin (size, juce::MidiMessage::getMessageLengthFromFirstByte (first));
+        return size + static_cast<int> (sizeof (juce::int32) + sizeof (juce::uint16));
+    }
+
+    /** Add an event, following the overflow policy when fixed.
+        Returns false if the event was dropped */
+    bool add (const juce::uint8* data, int size, int frame) {
+        if (capacity > 0) {
+            const int needed = eventbytes (data, size);
+            const int free = capacity - buffer.data.size();
+            if (needed > free) {
+                if (overflow == DropNewest || needed > capacity) {
+                    ++overflows;
+                    return false;
+                }
+                if (overflow == DropOldest)
+                    dropfront (needed - free);
+                else
+                    ++overflows;
+            }
+        }
+
+        if (! append (data, size, frame))
+            buffer.addEvent (data, size, frame);
+        return true;
+    }
+
+    /** Add events from another buffer in a range of frames, see add */
+    void add (const juce::MidiBuffer& other, int start, int nframes, int offset) {
+        if (capacity <= 0) {
+            buffer.addEvents (other, start, nframes, offset);
+            return;
+        }
+
+        for (auto iter = other.findNextSamplePosition (start); iter != other.end(); ++iter) {
+            const auto event = *iter;
+            if (nframes >= 0 && event.samplePosition >= start + nframes)
+                break;
+            add (event.data, event.numBytes, event.samplePosition + offset);
+        }
+    }
+
+    /** Remove events in a range of frames */
+    void clear (int start, int nframes) {
+        if (capacity <= 0) {
+            buffer.clear (start, nframes);
+            return;
+        }
+
+        const auto* from = findframe (buffer.data.begin(), start);
+        compact (from, findframe (from, start + nframes));
+    }
+
+    /** Merge other buffers into this one in a single pass, keeping the
+        events already here. `source (i)` returns the i'th buffer and the
+        frame offset for its events. Ties keep the order of the inputs,
+        with this buffer's events first. Returns the number of events in
+        the buffer after merging */
+    template<typename Source>
+    int merge (int count, Source&& source) {
+        // the current events become an input, so the output can be written
+        // in place
+        buffer.swapWith (scratch);
+        buffer.clear();
+        merging.clear();
+        int total = 0;
+        addinput (scratch, 0, total);
+        for (int i = 0; i < count; ++i) {
+            const auto input = source (i);
+            if (input.first != nullptr)
+                addinput (*input.first, input.second, total);
+        }
+
+        if (capacity <= 0)
+            buffer.ensureSize (static_cast<size_t> (total));
+        // dropping the oldest while merging means skipping the first events
+        int skip = capacity > 0 && overflow == DropOldest ? total - capacity : 0;
+
+        const auto later = [] (const MergeInput& a, const MergeInput& b) noexcept {
+            return a.frame > b.frame || (a.frame == b.frame && a.order > b.order);
+        };
+
+        int events = 0;
+        std::make_heap (merging.begin(), merging.end(), later);
+        while (! merging.empty()) {
+            std::pop_heap (merging.begin(), merging.end(), later);
+            auto& input = merging.back();
+            juce::uint16 size;
+            std::memcpy (&size, input.iter + sizeof (juce::int32), sizeof (size));
+            const auto* data = input.iter + sizeof (juce::int32) + sizeof (juce::uint16);
+
+            if (skip > 0) {
+                skip -= static_cast<int> (sizeof (juce::int32) + sizeof (juce::uint16)) + size;
+                ++overflows;
+            } else if (add (data, size, input.frame)) {
+                ++events;
+            }
+
+            input.iter = data + size;
+            if (input.iter < input.end) {
+                input.frame = frameat (input.iter) + input.offset;
+                std::push_heap (merging.begin(), merging.end(), later);
+            } else {
+                merging.pop_back();
+            }
+        }
+
+        // scratch holds the inputs until here. Grow it with the buffer so
+        // the next merge fits as well
+        scratch.clear();
+        if (capacity <= 0)
+            scratch.ensureSize (static_cast<size_t> (buffer.data.getNumAllocated()));
+        return events;
+    }
+
+    /** Drop every byte from `size` on. Goes through the scratch storage,
+        juce::Array would shrink its allocation if removed from directly */
+    void truncate (int size) {
+        compact (buffer.data.begin() + size, buffer.data.end());
+    }
+
+    /** True if swapping storage with `other` keeps both within capacity */
+    bool canswap (const MidiBufferImpl& other) const noexcept {
+        return other.buffer.data.getNumAllocated() >= capacity
+            && buffer.data.getNumAllocated() >= other.capacity;
+    }
+
+private:
+    /** Read position in one input of merge */
+    struct MergeInput {
+        const juce::uint8* iter;
+        const juce::uint8* end;
+        int frame;
+        int offset;
+        int order;
+    };
+
+    /** Inputs of merge, kept so merging allocates only the first time */
+    std::vector<MergeInput> merging;
+
+    static int frameat (const juce::uint8* iter) noexcept {
+        juce::int32 frame;
+        std::memcpy (&frame, iter, sizeof (frame));
+        return frame;
+    }
+
+    void addinput (const juce::MidiBuffer& input, int offset, int& total) {
+        const auto* first = input.data.begin();
+        const auto* end   = input.data.end();
+        total += input.data.size();
+        if (first < end)
+            merging.push_back ({ first, end, frameat (first) + offset, offset, static_cast<int> (merging.size()) });
+    }
+
+    /** Where the last event was, keyed on the storage it was in */
+    const juce::uint8* tailstorage { nullptr };
+    int tailsize { -1 };
+    int tailoffset { 0 };
+
+    /** Offset of the last event, or -1 if empty. Only searches after the
+        storage was changed by something other than append */
+    int findtail() noexcept {
+        const auto* first = buffer.data.begin();
+        const int size = buffer.data.size();
+        if (size <= 0)
+            return -1;
+        if (first == tailstorage && size == tailsize
+            && nextevent (first + tailoffset) == first + size)
+            return tailoffset;
+
+        const auto* last = first;
+        for (const auto* iter = first; iter < first + size; iter = nextevent (iter))
+            last = iter;
+        tailstorage = first;
+        tailsize    = size;
+        tailoffset  = static_cast<int> (last - first);
+        return tailoffset;
+    }
+
+    /** Write an event at the end without searching, if it belongs there.
+        SysEx and meta events are left to juce::MidiBuffer, which trims
+        them */
+    bool append (const juce::uint8* data, int size, int frame) {
+        if (size <= 0 || data[0] < 0x80 || data[0] == 0xf0 || data[0] == 0xf7 || data[0] == 0xff)
+            return false;
+
+        const int tail = findtail();
+        if (tail >= 0) {
+            juce::int32 last;
+            std::memcpy (&last, buffer.data.begin() + tail, sizeof (last));
+            if (frame < last)
+                return false;
+        }
+
+        const auto nbytes = static_cast<juce::uint16> (eventbytes (data, size)
+                          - static_cast<int> (sizeof (juce::int32) + sizeof (juce::uint16)));
+        const auto position = static_cast<juce::int32> (frame);
+        const int offset = buffer.data.size();
+        buffer.data.resize (offset + static_cast<int> (sizeof (juce::int32) + sizeof (juce::uint16)) + nbytes);
+
+        auto* dst = buffer.data.getRawDataPointer() + offset;
+        std::memcpy (dst, &position, sizeof (position));
+        std::memcpy (dst + sizeof (position), &nbytes, sizeof (nbytes));
+        std::memcpy (dst + sizeof (position) + sizeof (nbytes), data, nbytes);
+
+        tailstorage = buffer.data.begin();
+        tailsize    = buffer.data.size();
+        tailoffset  = offset;
+        return true;
+    }
+
+    static const juce::uint8* nextevent (const juce::uint8* iter) noexcept {
+        juce::uint16 size;
+        std::memcpy (&size, iter + sizeof (juce::int32), sizeof (size));
+        return iter + sizeof (juce::int32) + sizeof (juce::uint16) + size;
+    }
+
+    /** First event at or after `frame`, searching from `iter` */
+    const juce::uint8* findframe (const juce::uint8* iter, int frame) const noexcept {
+        const auto* end = buffer.data.end();
+        for (; iter < end; iter = nextevent (iter)) {
+            juce::int32 position;
+            std::memcpy (&position, iter, sizeof (position));
+            if (position >= frame)
+                break;
+        }
+        return iter;
+    }
+
+    /** Drop whole events from the start totalling at least `bytes` */
+    void dropfront (int bytes) {
+        const auto* first = buffer.data.begin();
+        const auto* end   = buffer.data.end();
+        const auto* iter  = first;
+        for (; iter < end && iter - first < bytes; iter = nextevent (iter))
+            ++overflows;
+        compact (first, iter);
+    }
+
+    /** Remove the bytes in [from, to) by copying the rest to the scratch
+        storage and swapping */
+    void compact (const juce::uint8* from, const juce::uint8* to) {
+        if (from == to)
+            return;
+        const auto* first = buffer.data.begin();
+        scratch.data.clearQuick();
+        scratch.data.addArray (first, static_cast<int> (from - first));
+        scratch.data.addArray (to, static_cast<int> (buffer.data.end() - to));
+        buffer.swapWith (scratch);
+    }
 };
 
 /** Allocate a new kv.MidiBuffer to the stack and set the metatable */
 inline static 
 MidiBufferImpl**
 new_midibuffer (lua_State* L) {
+    if (luaL_getmetatable (L, LKV_MT_MIDI_BUFFER) == LUA_TNIL) {
+        luaL_requiref (L, LKV_MT_MIDI_BUFFER, luaopen_kv_MidiBuffer, 0);
+        lua_pop (L, 1);
+    }
+    lua_pop (L, 1);
+
     auto** impl = (MidiBufferImpl**) lua_newuserdata (L, sizeof (MidiBufferImpl**));
     *impl = new MidiBufferImpl (L);
     luaL_setmetatable (L, LKV_MT_MIDI_BUFFER);
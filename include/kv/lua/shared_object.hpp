@@ -0,0 +1,91 @@
+
+#pragma once
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+
+namespace kv {
+namespace lua {
+
+/** Base of objects shared between Lua states in one process.
+    Reference counted, and listed by name while named so another state can
+    open it. Only create, open and the final release take a lock.
+*/
+template<typename T>
+class SharedObject {
+public:
+    /** Create an object, listing it if named. Returns nullptr if the name is
+        taken. Allocates */
+    template<typename... Args>
+    static T* create (const char* name, Args&&... args) {
+        if (name == nullptr)
+            return new T (std::forward<Args> (args)...);
+
+        std::lock_guard<std::mutex> sl (lock());
+        auto& objects = named();
+        const auto it = objects.find (name);
+        if (it != objects.end() && it->second->refs.load() > 0)
+            return nullptr;
+        auto* object = new T (std::forward<Args> (args)...);
+        object->name = name;
+        objects[name] = object;
+        return object;
+    }
+
+    /** Find a named object and take a reference, or nullptr */
+    static T* open (const char* name) {
+        std::lock_guard<std::mutex> sl (lock());
+        auto& objects = named();
+        const auto it = objects.find (name);
+        if (it == objects.end())
+            return nullptr;
+
+        // an object whose last reference just went is on its way out
+        auto* object = it->second;
+        int count = object->refs.load();
+        while (count > 0)
+            if (object->refs.compare_exchange_weak (count, count + 1))
+                return object;
+        return nullptr;
+    }
+
+    /** Drop a reference, deleting the object with the last one */
+    void release() {
+        if (refs.fetch_sub (1) != 1)
+            return;
+        if (! name.empty()) {
+            std::lock_guard<std::mutex> sl (lock());
+            auto& objects = named();
+            const auto it = objects.find (name);
+            if (it != objects.end() && it->second == this)
+                objects.erase (it);
+        }
+        delete static_cast<T*> (this);
+    }
+
+    /** Name given to create, empty if none */
+    const std::string& getname() const noexcept { return name; }
+
+protected:
+    SharedObject() = default;
+    ~SharedObject() = default;
+
+private:
+    std::atomic<int> refs { 1 };
+    std::string name;
+
+    static std::mutex& lock() {
+        static std::mutex mutex;
+        return mutex;
+    }
+
+    static std::map<std::string, T*>& named() {
+        static std::map<std::string, T*> objects;
+        return objects;
+    }
+};
+
+}}
@@ -3,8 +3,9 @@
 
 #if LKV_AUDIO_BUFFER_COMPILE
 
-#include "lua-kv.hpp"
-#include LKV_JUCE_HEADER
+#include "kv/lua/audio_buffer.hpp"
+#include "bytes.h"
+#include "pcm.hpp"
 
 #ifndef LKV_AUDIO_BUFFER_32
  #define LKV_AUDIO_BUFFER_32 0
@@ -13,19 +14,22 @@
 #if LKV_AUDIO_BUFFER_32
  #define LKV_MT_AUDIO_BUFFER_TYPE   "kv.AudioBuffer32Class"
  #define LKV_MT_AUDIO_BUFFER_IMPL   LKV_MT_AUDIO_BUFFER_32
+ #define LKV_MT_CHANNEL_VIEW_IMPL   LKV_MT_CHANNEL_VIEW_32
  #define LKV_AUDIO_BUFFER_OPEN      luaopen_kv_AudioBuffer32
  using SampleType    = float;
 
 #else
  #define LKV_MT_AUDIO_BUFFER_TYPE   "kv.AudioBuffer64Class"
  #define LKV_MT_AUDIO_BUFFER_IMPL   LKV_MT_AUDIO_BUFFER_64
+ #define LKV_MT_CHANNEL_VIEW_IMPL   LKV_MT_CHANNEL_VIEW_64
  #define LKV_AUDIO_BUFFER_OPEN      luaopen_kv_AudioBuffer
  using SampleType    = lua_Number;
 #endif
 
+using Impl          = kv::lua::AudioBufferImpl<SampleType>;
 using Buffer        = juce::AudioBuffer<SampleType>;
 
-#define toclassref(L, n) *(Buffer**) lua_touserdata (L, n);
+#define toclassref(L, n) (&((Impl*) lua_touserdata (L, n))->buffer)
 
 static int audio_isfloat (lua_State* L) {
    #if LKV_AUDIO_BUFFER_32
@@ -160,6 +164,213 @@ static int audio_set (lua_State* L) {
     return 0;
 }
 
+//==============================================================================
+/** Returns the samples contained in a byte array or string at index, or
+    nullptr if the value is neither */
+static const SampleType* audio_tosamples (lua_State* L, int index, int& count) {
+    if (auto* bytes = (kv_bytes_t*) luaL_testudata (L, index, LKV_MT_BYTE_ARRAY)) {
+        count = static_cast<int> (bytes->size / sizeof (SampleType));
+        return (const SampleType*) bytes->data;
+    }
+
+    if (lua_type (L, index) == LUA_TSTRING) {
+        size_t len = 0;
+        const char* str = lua_tolstring (L, index, &len);
+        count = static_cast<int> (len / sizeof (SampleType));
+        return (const SampleType*) str;
+    }
+
+    count = 0;
+    return nullptr;
+}
+
+/** Copy samples from one channel into a table, byte array or new table which
+    is left on the top of the stack */
+static void audio_readrange (lua_State* L, Buffer* buf, int channel, int start, int count, int dest) {
+    const auto* src = buf->getReadPointer (channel, start);
+
+    if (auto* bytes = (kv_bytes_t*) luaL_testudata (L, dest, LKV_MT_BYTE_ARRAY)) {
+        luaL_argcheck (L, bytes->size >= count * sizeof (SampleType), dest,
+                       "byte array too small");
+        memcpy (bytes->data, src, count * sizeof (SampleType));
+        lua_pushvalue (L, dest);
+        return;
+    }
+
+    if (lua_istable (L, dest))
+        lua_pushvalue (L, dest);
+    else
+        lua_createtable (L, count, 0);
+
+    for (int i = 0; i < count; ++i) {
+        lua_pushnumber (L, static_cast<lua_Number> (src[i]));
+        lua_rawseti (L, -2, i + 1);
+    }
+}
+
+/** Copy samples from a table, byte array or string in to one channel.
+    Returns the number of samples written */
+static int audio_writerange (lua_State* L, Buffer* buf, int channel, int start, int count, int src) {
+    count = juce::jmin (count, buf->getNumSamples() - start);
+    if (count <= 0)
+        return 0;
+
+    auto* dst = buf->getWritePointer (channel, start);
+
+    if (lua_istable (L, src)) {
+        count = juce::jmin (count, static_cast<int> (lua_rawlen (L, src)));
+        for (int i = 0; i < count; ++i) {
+            lua_rawgeti (L, src, i + 1);
+            dst[i] = static_cast<SampleType> (lua_tonumber (L, -1));
+            lua_pop (L, 1);
+        }
+        return count;
+    }
+
+    int available = 0;
+    if (const auto* samples = audio_tosamples (L, src, available)) {
+        count = juce::jmin (count, available);
+        memcpy (dst, samples, count * sizeof (SampleType));
+        return count;
+    }
+
+    return luaL_argerror (L, src, "table, kv.ByteArray or string expected");
+}
+
+static void audio_checkrange (lua_State* L, Buffer* buf, int channel, int start, int count) {
+    luaL_argcheck (L, juce::isPositiveAndBelow (channel, buf->getNumChannels()), 2,
+                   "channel out of range");
+    luaL_argcheck (L, start >= 0 && count >= 0 && start + count <= buf->getNumSamples(), 3,
+                   "sample range out of bounds");
+}
+
+/// Read a range of samples from one channel.
+// Copies samples in one call instead of calling `get` for every sample.
+// @int channel The channel to read from
+// @int start Sample index to start at
+// @int count Number of samples to read
+// @tparam[opt] table|kv.ByteArray dest Table or byte array to fill. Byte arrays
+// receive raw native samples in `string.pack` layout, 'f' for 32bit and 'd'
+// for 64bit buffers.
+// @return The filled destination or a new table if none was given
+// @function AudioBuffer:read
+static int audio_read (lua_State* L) {
+    auto* buf = toclassref (L, 1);
+    const auto channel = static_cast<int> (luaL_checkinteger (L, 2)) - 1;
+    const auto start   = static_cast<int> (luaL_checkinteger (L, 3)) - 1;
+    const auto count   = static_cast<int> (luaL_checkinteger (L, 4));
+    audio_checkrange (L, buf, channel, start, count);
+    audio_readrange (L, buf, channel, start, count, 5);
+    return 1;
+}
+
+/// Write a range of samples to one channel.
+// Copies samples in one call instead of calling `set` for every sample.
+// @int channel The channel to write to
+// @int start Sample index to start at
+// @tparam table|kv.ByteArray|string src Samples to write. Byte arrays and
+// strings must contain raw native samples in `string.pack` layout, 'f' for
+// 32bit and 'd' for 64bit buffers.
+// @int[opt] count Max number of samples to write
+// @treturn int Number of samples written
+// @function AudioBuffer:write
+static int audio_write (lua_State* L) {
+    auto* buf = toclassref (L, 1);
+    const auto channel = static_cast<int> (luaL_checkinteger (L, 2)) - 1;
+    const auto start   = static_cast<int> (luaL_checkinteger (L, 3)) - 1;
+    const auto count   = static_cast<int> (luaL_optinteger (L, 5, buf->getNumSamples()));
+    audio_checkrange (L, buf, channel, start, 0);
+    lua_pushinteger (L, audio_writerange (L, buf, channel, start, count, 4));
+    return 1;
+}
+
+/// Read a range of samples from all channels.
+// @int start Sample index to start at
+// @int count Number of samples to read from each channel
+// @tparam[opt] table|kv.ByteArray dest A table of per channel tables, or a
+// byte array which receives each channel one after the other.
+// @return The filled destination or a new table of tables
+// @function AudioBuffer:readblock
+static int audio_readblock (lua_State* L) {
+    auto* buf = toclassref (L, 1);
+    const auto start  = static_cast<int> (luaL_checkinteger (L, 2)) - 1;
+    const auto count  = static_cast<int> (luaL_checkinteger (L, 3));
+    const auto nchans = buf->getNumChannels();
+    luaL_argcheck (L, start >= 0 && count >= 0 && start + count <= buf->getNumSamples(), 2,
+                   "sample range out of bounds");
+
+    if (auto* bytes = (kv_bytes_t*) luaL_testudata (L, 4, LKV_MT_BYTE_ARRAY)) {
+        luaL_argcheck (L, bytes->size >= nchans * count * sizeof (SampleType), 4,
+                       "byte array too small");
+        auto* dst = (SampleType*) bytes->data;
+        for (int c = 0; c < nchans; ++c)
+            memcpy (dst + c * count, buf->getReadPointer (c, start), count * sizeof (SampleType));
+        lua_pushvalue (L, 4);
+        return 1;
+    }
+
+    if (lua_istable (L, 4))
+        lua_pushvalue (L, 4);
+    else
+        lua_createtable (L, nchans, 0);
+
+    const int block = lua_gettop (L);
+    for (int c = 0; c < nchans; ++c) {
+        lua_rawgeti (L, block, c + 1);
+        audio_readrange (L, buf, c, start, count, lua_gettop (L));
+        lua_rawseti (L, block, c + 1);
+        lua_pop (L, 1);
+    }
+
+    return 1;
+}
+
+/// Write a range of samples to all channels.
+// @int start Sample index to start at
+// @tparam table|kv.ByteArray|string src A table of per channel tables, or
+// raw samples with each channel one after the other.
+// @int[opt] count Max number of samples to write to each channel
+// @treturn int Number of samples written to each channel
+// @function AudioBuffer:writeblock
+static int audio_writeblock (lua_State* L) {
+    auto* buf = toclassref (L, 1);
+    const auto start  = static_cast<int> (luaL_checkinteger (L, 2)) - 1;
+    const auto nchans = buf->getNumChannels();
+    auto count = static_cast<int> (luaL_optinteger (L, 4, buf->getNumSamples()));
+    luaL_argcheck (L, start >= 0 && start <= buf->getNumSamples(), 2,
+                   "sample range out of bounds");
+    count = juce::jmin (count, buf->getNumSamples() - start);
+
+    if (lua_istable (L, 3)) {
+        int written = 0;
+        for (int c = 0; c < nchans; ++c) {
+            if (lua_rawgeti (L, 3, c + 1) == LUA_TNIL) {
+                lua_pop (L, 1);
+                break;
+            }
+            written = juce::jmax (written, audio_writerange (L, buf, c, start, count, lua_gettop (L)));
+            lua_pop (L, 1);
+        }
+        lua_pushinteger (L, written);
+        return 1;
+    }
+
+    int available = 0;
+    const auto* src = audio_tosamples (L, 3, available);
+    luaL_argcheck (L, src != nullptr, 3, "table, kv.ByteArray or string expected");
+    if (nchans <= 0 || count <= 0) {
+        lua_pushinteger (L, 0);
+        return 1;
+    }
+
+    count = juce::jmin (count, available / nchans);
+    for (int c = 0; c < nchans; ++c)
+        memcpy (buf->getWritePointer (c, start), src + c * count, count * sizeof (SampleType));
+
+    lua_pushinteger (L, count);
+    return 1;
+}
+
 /// Apply gain to all channels and samples
 // @number gain Gain to apply to all channels
 // @function AudioBuffer:applygain
@@ -255,17 +466,676 @@ static int audio_fade (lua_State* L) {
     return 0;
 }
 
+//==============================================================================
+/** Number of samples converted at once when mixing different sample types */
+static constexpr int mixBlockSize = 256;
+
+template<typename SourceType>
+static void audio_convert (SampleType* dst, const SourceType* src, int count) {
+    kv::lua::convert_samples (dst, src, count);
+}
+
+/** Add or copy samples with a constant gain or linear gain ramp. The ramp
+    matches AudioBuffer::applyGainRamp: sample i gets gain1 + i * (gain2 - gain1) / count */
+static void audio_mixsamples (SampleType* dst, const SampleType* src, int count,
+                              SampleType gain1, SampleType gain2, bool replace)
+{
+    using FVO = juce::FloatVectorOperations;
+    if (gain1 == gain2) {
+        if (replace) {
+            if (gain1 == SampleType (1))
+                FVO::copy (dst, src, count);
+            else
+                FVO::copyWithMultiply (dst, src, gain1, count);
+        } else {
+            if (gain1 == SampleType (1))
+                FVO::add (dst, src, count);
+            else
+                FVO::addWithMultiply (dst, src, gain1, count);
+        }
+        return;
+    }
+
+    const auto increment = (gain2 - gain1) / static_cast<SampleType> (count);
+    if (replace) {
+        for (int i = 0; i < count; ++i)
+            dst[i] = src[i] * (gain1 + increment * static_cast<SampleType> (i));
+    } else {
+        for (int i = 0; i < count; ++i)
+            dst[i] += src[i] * (gain1 + increment * static_cast<SampleType> (i));
+    }
+}
+
+/** Mix count samples into dst in blocks of mixBlockSize, `stage (block, start, n)`
+    filling a block with source samples first. Walks backwards when asked, so
+    a source overlapping dst is read before it is written */
+template<typename Stage>
+static void audio_mixblocks (SampleType* dst, int count, SampleType gain1, SampleType gain2,
+                             bool replace, bool backward, Stage&& stage)
+{
+    SampleType block [mixBlockSize];
+    const auto increment = (gain2 - gain1) / static_cast<SampleType> (count);
+    for (int done = 0; done < count; done += mixBlockSize) {
+        const int n     = juce::jmin (mixBlockSize, count - done);
+        const int start = backward ? count - done - n : done;
+        stage (block, start, n);
+        audio_mixsamples (dst + start, block, n,
+                          gain1 + increment * static_cast<SampleType> (start),
+                          gain1 + increment * static_cast<SampleType> (start + n),
+                          replace);
+    }
+}
+
+template<typename SourceType>
+static void audio_mix (Buffer& dst, int dstch, int dststart,
+                       const juce::AudioBuffer<SourceType>& src, int srcch, int srcstart,
+                       int count, SampleType gain1, SampleType gain2, bool replace)
+{
+    if (count <= 0)
+        return;
+
+    auto* d = dst.getWritePointer (dstch, dststart);
+    const auto* s = src.getReadPointer (srcch, srcstart);
+
+    if constexpr (std::is_same<SourceType, SampleType>::value) {
+        const auto daddr = reinterpret_cast<uintptr_t> (d);
+        const auto saddr = reinterpret_cast<uintptr_t> (s);
+        const auto bytes = sizeof (SampleType) * static_cast<size_t> (count);
+        if (daddr >= saddr + bytes || saddr >= daddr + bytes) {
+            audio_mixsamples (d, s, count, gain1, gain2, replace);
+            return;
+        }
+
+        // same memory, e.g. a buffer and its own slice
+        audio_mixblocks (d, count, gain1, gain2, replace, daddr > saddr,
+            [s] (SampleType* block, int start, int n) {
+                memcpy (block, s + start, sizeof (SampleType) * static_cast<size_t> (n));
+            });
+    } else {
+        audio_mixblocks (d, count, gain1, gain2, replace, false,
+            [s] (SampleType* block, int start, int n) {
+                audio_convert (block, s + start, n);
+            });
+    }
+}
+
+/** Parses mixing arguments and mixes. Argument layout is either
+    (src [, gain1 [, gain2]]) or (dstch, dststart, src, srcch, srcstart, count [, gain1 [, gain2]]) */
+static int audio_mixfrom (lua_State* L, bool replace, bool ramp) {
+    auto* dst = toclassref (L, 1);
+
+    if (lua_type (L, 2) == LUA_TUSERDATA) {
+        const auto gain1 = static_cast<SampleType> (ramp ? luaL_checknumber (L, 3) : luaL_optnumber (L, 3, 1.0));
+        const auto gain2 = static_cast<SampleType> (ramp ? luaL_checknumber (L, 4) : gain1);
+        kv::lua::with_audio_buffer (L, 2, [&](auto& src) {
+            const auto nchans = juce::jmin (dst->getNumChannels(), src.getNumChannels());
+            const auto count  = juce::jmin (dst->getNumSamples(), src.getNumSamples());
+            for (int c = 0; c < nchans; ++c)
+                audio_mix (*dst, c, 0, src, c, 0, count, gain1, gain2, replace);
+        });
+        return 0;
+    }
+
+    const auto dstch    = static_cast<int> (luaL_checkinteger (L, 2)) - 1;
+    const auto dststart = static_cast<int> (luaL_checkinteger (L, 3)) - 1;
+    const auto srcch    = static_cast<int> (luaL_checkinteger (L, 5)) - 1;
+    const auto srcstart = static_cast<int> (luaL_checkinteger (L, 6)) - 1;
+    const auto count    = static_cast<int> (luaL_checkinteger (L, 7));
+    const auto gain1    = static_cast<SampleType> (ramp ? luaL_checknumber (L, 8) : luaL_optnumber (L, 8, 1.0));
+    const auto gain2    = static_cast<SampleType> (ramp ? luaL_checknumber (L, 9) : gain1);
+    audio_checkrange (L, dst, dstch, dststart, count);
+
+    kv::lua::with_audio_buffer (L, 4, [&](auto& src) {
+        luaL_argcheck (L, juce::isPositiveAndBelow (srcch, src.getNumChannels()), 5,
+                       "source channel out of range");
+        luaL_argcheck (L, srcstart >= 0 && srcstart + count <= src.getNumSamples(), 6,
+                       "source range out of bounds");
+        audio_mix (*dst, dstch, dststart, src, srcch, srcstart, count, gain1, gain2, replace);
+    });
+
+    return 0;
+}
+
+/// Add samples from another buffer.
+// Adds every channel both buffers have in common.
+// The source may be a 32 or 64 bit buffer.
+// @tparam kv.AudioBuffer src Buffer to add from
+// @number[opt] gain Gain to apply to the source
+// @function AudioBuffer:addfrom
+
+/// Add a range of samples from another buffer.
+// @int dstch Channel to add to
+// @int dststart Sample index to start at in this buffer
+// @tparam kv.AudioBuffer src Buffer to add from
+// @int srcch Channel to read from in the source
+// @int srcstart Sample index to start at in the source
+// @int count Number of samples to add
+// @number[opt] gain Gain to apply to the source
+// @function AudioBuffer:addfrom
+static int audio_addfrom (lua_State* L) {
+    return audio_mixfrom (L, false, false);
+}
+
+/// Copy samples from another buffer.
+// Copies every channel both buffers have in common.
+// The source may be a 32 or 64 bit buffer.
+// @tparam kv.AudioBuffer src Buffer to copy from
+// @number[opt] gain Gain to apply to the source
+// @function AudioBuffer:copyfrom
+
+/// Copy a range of samples from another buffer.
+// @int dstch Channel to copy to
+// @int dststart Sample index to start at in this buffer
+// @tparam kv.AudioBuffer src Buffer to copy from
+// @int srcch Channel to read from in the source
+// @int srcstart Sample index to start at in the source
+// @int count Number of samples to copy
+// @number[opt] gain Gain to apply to the source
+// @function AudioBuffer:copyfrom
+static int audio_copyfrom (lua_State* L) {
+    return audio_mixfrom (L, true, false);
+}
+
+/// Add samples from another buffer with a gain ramp.
+// @tparam kv.AudioBuffer src Buffer to add from
+// @number startgain Gain of the first sample
+// @number endgain Gain at the end of the ramp
+// @function AudioBuffer:addfromwithramp
+
+/// Add a range of samples from another buffer with a gain ramp.
+// @int dstch Channel to add to
+// @int dststart Sample index to start at in this buffer
+// @tparam kv.AudioBuffer src Buffer to add from
+// @int srcch Channel to read from in the source
+// @int srcstart Sample index to start at in the source
+// @int count Number of samples to add
+// @number startgain Gain of the first sample
+// @number endgain Gain at the end of the ramp
+// @function AudioBuffer:addfromwithramp
+static int audio_addfromwithramp (lua_State* L) {
+    return audio_mixfrom (L, false, true);
+}
+
+/// Copy samples from another buffer with a gain ramp.
+// @tparam kv.AudioBuffer src Buffer to copy from
+// @number startgain Gain of the first sample
+// @number endgain Gain at the end of the ramp
+// @function AudioBuffer:copyfromwithramp
+
+/// Copy a range of samples from another buffer with a gain ramp.
+// @int dstch Channel to copy to
+// @int dststart Sample index to start at in this buffer
+// @tparam kv.AudioBuffer src Buffer to copy from
+// @int srcch Channel to read from in the source
+// @int srcstart Sample index to start at in the source
+// @int count Number of samples to copy
+// @number startgain Gain of the first sample
+// @number endgain Gain at the end of the ramp
+// @function AudioBuffer:copyfromwithramp
+static int audio_copyfromwithramp (lua_State* L) {
+    return audio_mixfrom (L, true, true);
+}
+
+//==============================================================================
+static bool audio_isslice (const Impl* impl, const void* buffer) {
+    for (auto* s = impl->slices; s != nullptr; s = s->sibling)
+        if ((const void*) &s->buffer == buffer || audio_isslice (s, buffer))
+            return true;
+    return false;
+}
+
+/// Copy another buffer, converting sample types.
+// This buffer is resized to match `src`, without re-allocating if possible.
+// Resizing empties this buffer's slices, so `src` can't be one of them.
+// @tparam kv.AudioBuffer src Buffer to copy, 32 or 64 bit
+// @function AudioBuffer:convertfrom
+static int audio_convertfrom (lua_State* L) {
+    auto* impl = (Impl*) lua_touserdata (L, 1);
+    kv::lua::with_audio_buffer (L, 2, [&](auto& src) {
+        if ((void*) &src == (void*) &impl->buffer)
+            return;
+        luaL_argcheck (L, ! audio_isslice (impl, &src), 2, "source is a slice of this buffer");
+        impl->resize (src.getNumChannels(), src.getNumSamples(), false, false, true);
+        for (int c = 0; c < src.getNumChannels(); ++c)
+            audio_convert (impl->buffer.getWritePointer (c), src.getReadPointer (c), src.getNumSamples());
+    });
+    return 0;
+}
+
+template<typename T>
+static int audio_convertto (lua_State* L) {
+    auto* buf = toclassref (L, 1);
+    auto* dst = kv::lua::new_audio_buffer<T> (L, buf->getNumChannels(), buf->getNumSamples());
+    for (int c = 0; c < buf->getNumChannels(); ++c)
+        kv::lua::convert_samples (dst->buffer.getWritePointer (c), buf->getReadPointer (c), buf->getNumSamples());
+    return 1;
+}
+
+/// Returns a 32bit copy of this buffer.
+// @treturn kv.AudioBuffer A new 32bit buffer
+// @function AudioBuffer:tofloat
+static int audio_tofloat (lua_State* L) {
+    return audio_convertto<float> (L);
+}
+
+/// Returns a 64bit copy of this buffer.
+// @treturn kv.AudioBuffer A new 64bit buffer
+// @function AudioBuffer:todouble
+static int audio_todouble (lua_State* L) {
+    return audio_convertto<double> (L);
+}
+
+//==============================================================================
+static const char* const pcm_formats[] = {
+    "s16", "s16le", "s16be",
+    "s24", "s24le", "s24be",
+    "s32", "s32le", "s32be",
+    "f32", "f32le", "f32be",
+    nullptr
+};
+
+static kv::lua::PCMLayout audio_checkpcm (lua_State* L, int arg) {
+    const int option = luaL_checkoption (L, arg, nullptr, pcm_formats);
+    kv::lua::PCMLayout layout;
+    layout.format    = static_cast<kv::lua::PCMFormat> (option / 3);
+    layout.bigendian = option % 3 == 2;
+    return layout;
+}
+
+/// Encode the buffer as interleaved PCM.
+// Formats are "s16", "s24", "s32" and "f32". Each is little endian unless
+// suffixed with "be", e.g. "s24be". A "le" suffix is also accepted.
+// @tparam kv.ByteArray bytes Destination, must hold channels * length samples
+// @string format Sample format
+// @bool[opt] dither Add TPDF dither to integer formats (default false)
+// @treturn int Number of bytes written
+// @function AudioBuffer:topcm
+// @usage
+// local bytes = ByteArray.new (buf:channels() * buf:length() * 2)
+// buf:topcm (bytes, 's16', true)
+static int audio_topcm (lua_State* L) {
+    auto* buf   = toclassref (L, 1);
+    auto* bytes = (kv_bytes_t*) luaL_checkudata (L, 2, LKV_MT_BYTE_ARRAY);
+    const auto layout = audio_checkpcm (L, 3);
+    const int nchans  = buf->getNumChannels();
+    const int nframes = buf->getNumSamples();
+    const int stride  = layout.bytes() * nchans;
+    const size_t size = static_cast<size_t> (stride) * static_cast<size_t> (nframes);
+    luaL_argcheck (L, bytes->size >= size, 2, "byte array too small");
+
+    // carries on from the previous call, so consecutive blocks don't repeat
+    // the same noise
+    static thread_local kv::lua::PCMDither noise;
+    kv::lua::PCMDither* dither = nullptr;
+    if (lua_toboolean (L, 4) && layout.format != kv::lua::PCMFormat::f32)
+        dither = &noise;
+
+    const bool stereo16 = nchans == 2 && layout.format == kv::lua::PCMFormat::s16 && ! layout.bigendian;
+    int32_t encoded [2][kv::lua::pcmBlockSize];
+
+    for (int start = 0; start < nframes; start += kv::lua::pcmBlockSize) {
+        const int n = juce::jmin (kv::lua::pcmBlockSize, nframes - start);
+        auto* dst = bytes->data + static_cast<size_t> (start) * static_cast<size_t> (stride);
+
+        if (stereo16) {
+            kv::lua::pcm_encode (encoded[0], buf->getReadPointer (0, start), n, layout, dither);
+            kv::lua::pcm_encode (encoded[1], buf->getReadPointer (1, start), n, layout, dither);
+            kv::lua::pcm_interleave_s16 (dst, encoded[0], encoded[1], n);
+            continue;
+        }
+
+        for (int c = 0; c < nchans; ++c) {
+            kv::lua::pcm_encode (encoded[0], buf->getReadPointer (c, start), n, layout, dither);
+            kv::lua::pcm_interleave (dst + c * layout.bytes(), encoded[0], n, stride, layout);
+        }
+    }
+
+    lua_pushinteger (L, static_cast<lua_Integer> (size));
+    return 1;
+}
+
+/// Decode interleaved PCM into the buffer.
+// Decodes as many whole frames as fit in both the buffer and `bytes`.
+// Channel count is taken from the buffer.
+// @tparam kv.ByteArray|string bytes Interleaved PCM data
+// @string format Sample format, see @{AudioBuffer:topcm}
+// @treturn int Number of frames decoded
+// @function AudioBuffer:frompcm
+static int audio_frompcm (lua_State* L) {
+    auto* buf = toclassref (L, 1);
+    const uint8_t* src = nullptr;
+    size_t available = 0;
+    if (auto* bytes = (kv_bytes_t*) luaL_testudata (L, 2, LKV_MT_BYTE_ARRAY)) {
+        src = bytes->data;
+        available = bytes->size;
+    } else {
+        src = (const uint8_t*) luaL_checklstring (L, 2, &available);
+    }
+
+    const auto layout = audio_checkpcm (L, 3);
+    const int nchans  = buf->getNumChannels();
+    const int stride  = layout.bytes() * nchans;
+    const int nframes = stride > 0 ? static_cast<int> (juce::jmin (static_cast<size_t> (buf->getNumSamples()),
+                                                                    available / static_cast<size_t> (stride)))
+                                   : 0;
+    const bool stereo16 = nchans == 2 && layout.format == kv::lua::PCMFormat::s16 && ! layout.bigendian;
+    int32_t decoded [2][kv::lua::pcmBlockSize];
+
+    for (int start = 0; start < nframes; start += kv::lua::pcmBlockSize) {
+        const int n = juce::jmin (kv::lua::pcmBlockSize, nframes - start);
+        const auto* block = src + static_cast<size_t> (start) * static_cast<size_t> (stride);
+
+        if (stereo16) {
+            kv::lua::pcm_deinterleave_s16 (decoded[0], decoded[1], block, n);
+            kv::lua::pcm_decode (buf->getWritePointer (0, start), decoded[0], n, layout);
+            kv::lua::pcm_decode (buf->getWritePointer (1, start), decoded[1], n, layout);
+            continue;
+        }
+
+        for (int c = 0; c < nchans; ++c) {
+            kv::lua::pcm_deinterleave (decoded[0], block + c * layout.bytes(), n, stride, layout);
+            kv::lua::pcm_decode (buf->getWritePointer (c, start), decoded[0], n, layout);
+        }
+    }
+
+    lua_pushinteger (L, static_cast<lua_Integer> (nframes));
+    return 1;
+}
+
+//==============================================================================
+struct AudioStats {
+    lua_Number peak { 0 }, rms { 0 }, min { 0 }, max { 0 }, mean { 0 };
+};
+
+/** Computes all statistics in one pass over the samples. Uses four
+    independent accumulators so the loop can be vectorized */
+static AudioStats audio_analyzesamples (const SampleType* src, int count) {
+    AudioStats stats;
+    if (count <= 0)
+        return stats;
+
+    SampleType mins[4], maxs[4];
+    lua_Number sums[4] = { 0, 0, 0, 0 }, squares[4] = { 0, 0, 0, 0 };
+    for (int k = 0; k < 4; ++k)
+        mins[k] = maxs[k] = src[0];
+
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        for (int k = 0; k < 4; ++k) {
+            const auto v = src[i + k];
+            mins[k] = v < mins[k] ? v : mins[k];
+            maxs[k] = v > maxs[k] ? v : maxs[k];
+            sums[k] += v;
+            squares[k] += static_cast<lua_Number> (v) * v;
+        }
+    }
+
+    for (; i < count; ++i) {
+        const auto v = src[i];
+        mins[0] = v < mins[0] ? v : mins[0];
+        maxs[0] = v > maxs[0] ? v : maxs[0];
+        sums[0] += v;
+        squares[0] += static_cast<lua_Number> (v) * v;
+    }
+
+    stats.min  = juce::jmin (mins[0], mins[1], mins[2], mins[3]);
+    stats.max  = juce::jmax (maxs[0], maxs[1], maxs[2], maxs[3]);
+    stats.peak = juce::jmax (std::abs (stats.min), std::abs (stats.max));
+    stats.mean = (sums[0] + sums[1] + sums[2] + sums[3]) / count;
+    stats.rms  = std::sqrt ((squares[0] + squares[1] + squares[2] + squares[3]) / count);
+    return stats;
+}
+
+static void audio_setstat (lua_State* L, const char* field, lua_Number value) {
+    lua_pushnumber (L, value);
+    lua_setfield (L, -2, field);
+}
+
+/// Analyze a range of samples in one channel.
+// Computes every statistic in a single pass over the samples.
+// @int channel The channel to analyze
+// @int[opt] start Sample index to start at
+// @int[opt] count Number of samples to analyze
+// @treturn number Peak absolute value
+// @treturn number RMS level
+// @treturn number Minimum value
+// @treturn number Maximum value
+// @treturn number Mean (DC offset)
+// @function AudioBuffer:analyze
+// @usage
+// local peak, rms = buf:analyze (1)
+
+/// Analyze all channels.
+// Fills `results[channel]` with a table containing the fields `peak`, `rms`,
+// `min`, `max` and `mean`.  Existing channel tables are reused, so passing
+// the same results table every block does not allocate.
+// @tparam table results Table to fill
+// @int[opt] start Sample index to start at
+// @int[opt] count Number of samples to analyze
+// @treturn table The results table
+// @function AudioBuffer:analyze
+static int audio_analyze (lua_State* L) {
+    auto* buf = toclassref (L, 1);
+
+    if (lua_istable (L, 2)) {
+        const auto start = static_cast<int> (luaL_optinteger (L, 3, 1)) - 1;
+        const auto count = static_cast<int> (luaL_optinteger (L, 4, buf->getNumSamples() - start));
+        luaL_argcheck (L, start >= 0 && count >= 0 && start + count <= buf->getNumSamples(), 3,
+                       "sample range out of bounds");
+
+        for (int c = 0; c < buf->getNumChannels(); ++c) {
+            const auto stats = audio_analyzesamples (buf->getReadPointer (c, start), count);
+            if (lua_rawgeti (L, 2, c + 1) != LUA_TTABLE) {
+                lua_pop (L, 1);
+                lua_createtable (L, 0, 5);
+                lua_pushvalue (L, -1);
+                lua_rawseti (L, 2, c + 1);
+            }
+
+            audio_setstat (L, "peak", stats.peak);
+            audio_setstat (L, "rms",  stats.rms);
+            audio_setstat (L, "min",  stats.min);
+            audio_setstat (L, "max",  stats.max);
+            audio_setstat (L, "mean", stats.mean);
+            lua_pop (L, 1);
+        }
+
+        lua_pushvalue (L, 2);
+        return 1;
+    }
+
+    const auto channel = static_cast<int> (luaL_checkinteger (L, 2)) - 1;
+    const auto start   = static_cast<int> (luaL_optinteger (L, 3, 1)) - 1;
+    const auto count   = static_cast<int> (luaL_optinteger (L, 4, buf->getNumSamples() - start));
+    audio_checkrange (L, buf, channel, start, count);
+
+    const auto stats = audio_analyzesamples (buf->getReadPointer (channel, start), count);
+    lua_pushnumber (L, stats.peak);
+    lua_pushnumber (L, stats.rms);
+    lua_pushnumber (L, stats.min);
+    lua_pushnumber (L, stats.max);
+    lua_pushnumber (L, stats.mean);
+    return 5;
+}
+
+//==============================================================================
+/** A view of one channel in an audio buffer.
+    Indexes samples directly in the owning buffer's memory without copying
+    or method calls. Views keep their buffer alive and become invalid if the
+    buffer is freed or resized so that the viewed range no longer exists.
+*/
+struct ChannelView {
+    Impl*       owner;
+    int         channel;
+    int         start;
+    int         count;
+};
+
+/** Returns the owning buffer if the view still fits inside it */
+static inline Buffer* view_buffer (const ChannelView* view) {
+    auto* buf = &view->owner->buffer;
+    if (view->channel >= buf->getNumChannels() ||
+        view->start + view->count > buf->getNumSamples())
+        return nullptr;
+    return buf;
+}
+
+static int view_index (lua_State* L) {
+    auto* view = (ChannelView*) lua_touserdata (L, 1);
+    if (lua_type (L, 2) != LUA_TNUMBER) {
+        lua_pushvalue (L, 2);
+        lua_rawget (L, lua_upvalueindex (1));
+        return 1;
+    }
+
+    auto* buf = view_buffer (view);
+    if (buf == nullptr)
+        return luaL_error (L, "invalid channel view");
+
+    const auto i = lua_tointeger (L, 2) - 1;
+    if (i >= 0 && i < view->count)
+        lua_pushnumber (L, static_cast<lua_Number> (
+            buf->getReadPointer (view->channel)[view->start + i]));
+    else
+        lua_pushnil (L);
+    return 1;
+}
+
+static int view_newindex (lua_State* L) {
+    auto* view = (ChannelView*) lua_touserdata (L, 1);
+    auto* buf  = view_buffer (view);
+    if (buf == nullptr)
+        return luaL_error (L, "invalid channel view");
+
+    const auto i = lua_tointeger (L, 2) - 1;
+    if (i >= 0 && i < view->count)
+        buf->getWritePointer (view->channel)[view->start + i] =
+            static_cast<SampleType> (lua_tonumber (L, 3));
+    return 0;
+}
+
+static int view_len (lua_State* L) {
+    auto* view = (ChannelView*) lua_touserdata (L, 1);
+    lua_pushinteger (L, view_buffer (view) != nullptr ? view->count : 0);
+    return 1;
+}
+
+/// Returns true if the view still refers to valid memory.
+// @function ChannelView:valid
+// @treturn bool
+static int view_valid (lua_State* L) {
+    auto* view = (ChannelView*) lua_touserdata (L, 1);
+    lua_pushboolean (L, view_buffer (view) != nullptr);
+    return 1;
+}
+
+/// Returns the audio buffer this view refers to.
+// @function ChannelView:buffer
+// @treturn kv.AudioBuffer
+static int view_buffer_get (lua_State* L) {
+    lua_getuservalue (L, 1);
+    return 1;
+}
+
+static int view_tostring (lua_State* L) {
+    auto* view = (ChannelView*) lua_touserdata (L, 1);
+    lua_pushfstring (L, "kv.ChannelView: channel=%d start=%d count=%d",
+                     view->channel + 1, view->start + 1, view->count);
+    return 1;
+}
+
+static const luaL_Reg view_methods[] = {
+    { "valid",          view_valid },
+    { "buffer",         view_buffer_get },
+    { NULL, NULL }
+};
+
+static const luaL_Reg view_metamethods[] = {
+    { "__newindex",     view_newindex },
+    { "__len",          view_len },
+    { "__tostring",     view_tostring },
+    { NULL, NULL }
+};
+
+/// Get a view of one channel.
+// The view aliases the buffer's sample memory, so reading and writing
+// `view[i]` is the same as `buf:get (channel, start + i - 1)`, without the
+// method lookup.
+// @int channel The channel to view
+// @int[opt] start First sample in the view
+// @int[opt] count Number of samples in the view
+// @treturn kv.ChannelView
+// @function AudioBuffer:channel
+// @usage
+// local left = buf:channel (1)
+// for i = 1, #left do
+//     left[i] = left[i] * 0.5
+// end
+static int audio_channel (lua_State* L) {
+    auto* owner = (Impl*) lua_touserdata (L, 1);
+    auto* buf = &owner->buffer;
+    const auto channel = static_cast<int> (luaL_checkinteger (L, 2)) - 1;
+    const auto start   = static_cast<int> (luaL_optinteger (L, 3, 1)) - 1;
+    const auto count   = static_cast<int> (luaL_optinteger (L, 4, buf->getNumSamples() - start));
+    audio_checkrange (L, buf, channel, start, count);
+
+    auto* view = (ChannelView*) lua_newuserdata (L, sizeof (ChannelView));
+    view->owner     = owner;
+    view->channel   = channel;
+    view->start     = start;
+    view->count     = count;
+    luaL_setmetatable (L, LKV_MT_CHANNEL_VIEW_IMPL);
+    lua_pushvalue (L, 1);
+    lua_setuservalue (L, -2);
+    return 1;
+}
+
+/// Get a buffer referring to a range of this one.
+// The slice aliases this buffer's sample memory, nothing is copied. It
+// keeps this buffer alive. Freeing, resizing or converting into this
+// buffer empties the slice, so it never refers to released memory.
+// @int[opt] channel First channel in the slice (default 1)
+// @int[opt] nchannels Number of channels (default all from `channel`)
+// @int[opt] start First sample in the slice (default 1)
+// @int[opt] count Number of samples (default all from `start`)
+// @treturn kv.AudioBuffer
+// @function AudioBuffer:slice
+// @usage
+// -- process the block in segments split at MIDI events
+// local seg = buf:slice (1, buf:channels(), frame, nextframe - frame)
+// seg:applygain (0.5)
+static int audio_slice (lua_State* L) {
+    auto* owner = (Impl*) lua_touserdata (L, 1);
+    auto* buf = &owner->buffer;
+    const auto channel   = static_cast<int> (luaL_optinteger (L, 2, 1)) - 1;
+    const auto nchannels = static_cast<int> (luaL_optinteger (L, 3, buf->getNumChannels() - channel));
+    const auto start     = static_cast<int> (luaL_optinteger (L, 4, 1)) - 1;
+    const auto count     = static_cast<int> (luaL_optinteger (L, 5, buf->getNumSamples() - start));
+    luaL_argcheck (L, channel >= 0 && channel < buf->getNumChannels(), 2, "channel out of range");
+    luaL_argcheck (L, nchannels > 0 && channel + nchannels <= buf->getNumChannels(), 3,
+                   "channel count out of range");
+    luaL_argcheck (L, start >= 0 && count >= 0 && start + count <= buf->getNumSamples(), 4,
+                   "sample range out of bounds");
+
+    auto* slice = kv::lua::new_audio_buffer<SampleType> (L, 0, 0);
+    slice->slice_of (*owner, channel, nchannels, start, count);
+    lua_pushvalue (L, 1);
+    lua_setuservalue (L, -2);
+    return 1;
+}
+
 /// Free used memory.
 // Invoke this to free the buffer when it is no longer needed.  Once called,
-// the buffer is no longer valid and WILL crash the interpreter if used after
-// the fact.
+// the buffer is empty with zero channels and samples. Inline sample memory
+// is returned when the buffer is garbage collected.
 // @function AudioBuffer:free
 static int audio_free (lua_State* L) {
-    auto** buf = (Buffer**) lua_touserdata (L, 1);
-    if (nullptr != *buf) {
-        delete (*buf);
-        *buf = nullptr;
-    }
+    ((Impl*) lua_touserdata (L, 1))->free();
+    return 0;
+}
+
+static int audio_gc (lua_State* L) {
+    ((Impl*) lua_touserdata (L, 1))->~Impl();
     return 0;
 }
 
@@ -295,22 +1165,19 @@ static int audio_tostring (lua_State* L) {
 // local buf = AudioBuffer.new (2, 2048)
 // -- do someting with `buf`
 static int audio_new (lua_State* L) {
-    auto** buf = (Buffer**) lua_newuserdata (L, sizeof (Buffer**));
-    
     int nchans = 0, nframes = 0;
     if (lua_gettop(L) >= 2 && lua_isinteger (L, 1) && lua_isinteger (L, 2)) {
         nchans  = (int) juce::jmax (lua_Integer(), lua_tointeger (L, 1));
         nframes = (int) juce::jmax (lua_Integer(), lua_tointeger (L, 2));
     }
 
-    *buf = new Buffer (nchans, nframes);
-    luaL_setmetatable (L, LKV_MT_AUDIO_BUFFER_IMPL);
+    kv::lua::new_audio_buffer<SampleType> (L, nchans, nframes);
     return 1;
 }
 
 //==============================================================================
 static const luaL_Reg buffer_methods[] = {
-    { "__gc",           audio_free },
+    { "__gc",           audio_gc },
     { "__tostring",     audio_tostring },
     { "free",           audio_free },
     { "isfloat",        audio_isfloat },
@@ -321,19 +1188,29 @@ static const luaL_Reg buffer_methods[] = {
     { "cleared",        audio_cleared },
     { "get",            audio_get },
     { "set",            audio_set },
+    { "read",           audio_read },
+    { "write",          audio_write },
+    { "readblock",      audio_readblock },
+    { "writeblock",     audio_writeblock },
+    { "channel",        audio_channel },
+    { "slice",          audio_slice },
     { "applygain",      audio_applygain },
     { "fade",           audio_fade },
+    { "addfrom",        audio_addfrom },
+    { "copyfrom",       audio_copyfrom },
+    { "addfromwithramp", audio_addfromwithramp },
+    { "copyfromwithramp", audio_copyfromwithramp },
+    { "convertfrom",    audio_convertfrom },
+    { "tofloat",        audio_tofloat },
+    { "todouble",       audio_todouble },
+    { "topcm",          audio_topcm },
+    { "frompcm",        audio_frompcm },
+    { "analyze",        audio_analyze },
     { NULL, NULL }
 };
 
 //==============================================================================
-#if LKV_AUDIO_BUFFER_32
-LKV_EXPORT 
-int luaopen_kv_AudioBuffer32 (lua_State* L) {
-#else
-LKV_EXPORT 
-int luaopen_kv_AudioBuffer64 (lua_State* L) {
-#endif
+static void audio_metatables (lua_State* L) {
     if (luaL_newmetatable (L, LKV_MT_AUDIO_BUFFER_IMPL)) {
         lua_pushvalue (L, -1);               /* duplicate the metatable */
         lua_setfield (L, -2, "__index");     /* mt.__index = mt */
@@ -341,9 +1218,27 @@ int luaopen_kv_AudioBuffer64 (lua_State* L) {
         lua_pop (L, 1);
     }
 
+    if (luaL_newmetatable (L, LKV_MT_CHANNEL_VIEW_IMPL)) {
+        luaL_setfuncs (L, view_metamethods, 0);
+        luaL_newlib (L, view_methods);
+        lua_pushcclosure (L, view_index, 1);
+        lua_setfield (L, -2, "__index");
+        lua_pop (L, 1);
+    }
+
     if (luaL_newmetatable (L, LKV_MT_AUDIO_BUFFER_TYPE)) {
         lua_pop (L, 1);
     }
+}
+
+#if LKV_AUDIO_BUFFER_32
+LKV_EXPORT 
+int luaopen_kv_AudioBuffer32 (lua_State* L) {
+#else
+LKV_EXPORT 
+int luaopen_kv_AudioBuffer64 (lua_State* L) {
+#endif
+    audio_metatables (L);
 
     lua_newtable (L);
     luaL_setmetatable (L, LKV_MT_AUDIO_BUFFER_TYPE);
@@ -352,4 +1247,88 @@ int luaopen_kv_AudioBuffer64 (lua_State* L) {
     return 1;
 }
 
+//==============================================================================
+// The C API is implemented by whichever buffer type matches kv_sample_t
+#if LKV_AUDIO_BUFFER_32 == LKV_FORCE_FLOAT32
+
+static_assert (std::is_same<SampleType, kv_sample_t>::value,
+               "kv_sample_t must match the buffer sample type");
+
+/** kv_audio_buffer_t is an alias of the Lua userdata block */
+static inline Buffer* audio_cast (kv_audio_buffer_t* buffer) {
+    return &((Impl*) buffer)->buffer;
+}
+
+template<typename SourceType>
+static void audio_duplicate (kv_audio_buffer_t* buffer, const SourceType* const* source, int nchannels, int nframes) {
+    auto* impl = (Impl*) buffer;
+    // resizing to the same size would keep referring to external memory
+    if (! impl->owned)
+        impl->free();
+    impl->resize (nchannels, nframes, false, false, true);
+    for (int c = 0; c < nchannels; ++c) {
+        auto* dst = impl->buffer.getWritePointer (c);
+        if constexpr (std::is_same<SourceType, SampleType>::value)
+            juce::FloatVectorOperations::copy (dst, source[c], nframes);
+        else
+            audio_convert (dst, source[c], nframes);
+    }
+}
+
+kv_audio_buffer_t* kv_audio_buffer_new (lua_State* L, int nchannels, int nframes) {
+    audio_metatables (L);
+    return (kv_audio_buffer_t*) kv::lua::new_audio_buffer<SampleType> (L, nchannels, nframes);
+}
+
+void kv_audio_buffer_refer_to (kv_audio_buffer_t*  buffer,
+                               kv_sample_t* const* data,
+                               int                 nchannels,
+                               int                 nframes)
+{
+    ((Impl*) buffer)->refer_to (const_cast<kv_sample_t**> (data), nchannels, nframes);
+}
+
+int kv_audio_buffer_channels (kv_audio_buffer_t* buffer) {
+    return audio_cast (buffer)->getNumChannels();
+}
+
+int kv_audio_buffer_length (kv_audio_buffer_t* buffer) {
+    return audio_cast (buffer)->getNumSamples();
+}
+
+kv_sample_t** kv_audio_buffer_array (kv_audio_buffer_t* buffer) {
+    return audio_cast (buffer)->getArrayOfWritePointers();
+}
+
+kv_sample_t* kv_audio_buffer_channel (kv_audio_buffer_t* buffer, int channel) {
+    return audio_cast (buffer)->getWritePointer (channel);
+}
+
+void kv_audio_buffer_resize (kv_audio_buffer_t* buffer,
+                             int                nchannels,
+                             int                nframes,
+                             bool               preserve,
+                             bool               clear,
+                             bool               norealloc)
+{
+    ((Impl*) buffer)->resize (nchannels, nframes, preserve, clear, norealloc);
+}
+
+void kv_audio_buffer_duplicate (kv_audio_buffer_t*        buffer,
+                                const kv_sample_t* const* source,
+                                int                       nchannels,
+                                int                       nframes)
+{
+    audio_duplicate (buffer, source, nchannels, nframes);
+}
+
+void kv_audio_buffer_duplicate_32 (kv_audio_buffer_t* buffer,
+                                   const float* const* source,
+                                   int                 nchannels,
+                                   int                 nframes)
+{
+    audio_duplicate (buffer, source, nchannels, nframes);
+}
+
+#endif
 #endif
@@ -0,0 +1,330 @@
+/// A pool of preallocated audio buffers.
+// Buffers are created up front and handed out with `acquire` and `release`,
+// so neither allocates. An optional scratch arena hands out temporary
+// buffers for the duration of a single process call; call `reset` at the
+// end of each block to reclaim them.
+// @classmod kv.AudioBufferPool
+// @pragma nostrip
+// @usage
+// local pool = AudioBufferPool.new (8, 2, 512, 4096)
+// function process (audio, midi)
+//     local tmp = pool:acquire (true)
+//     local env = pool:scratch (1, audio:length())
+//     -- do something with `tmp` and `env`
+//     pool:release (tmp)
+//     pool:reset()
+// end
+
+#include "kv/lua/audio_buffer.hpp"
+#include <vector>
+
+#define LKV_MT_AUDIO_BUFFER_POOL_TYPE "kv.AudioBufferPoolClass"
+
+/** Userdata of kv.AudioBufferPool. The buffers, scratch handles and the
+    arena are kept alive in the pool's user value table */
+struct Pool final {
+    bool                isdouble    { false };
+    int                 nchannels   { 0 };
+    int                 nframes     { 0 };
+
+    /** Pooled buffers: AudioBufferImpl<float> or AudioBufferImpl<double> */
+    std::vector<void*>  buffers;
+    /** Stack of available buffer indexes */
+    std::vector<int>    available;
+    int                 navailable  { 0 };
+    /** Non-zero for buffers currently acquired */
+    std::vector<char>   acquired;
+
+    /** Scratch buffer handles, referring into the arena */
+    std::vector<void*>  scratch;
+    int                 nscratch    { 0 };
+    char*               arena       { nullptr };
+    size_t              arenasize   { 0 };
+    size_t              arenaused   { 0 };
+
+    /** User value table index of the first scratch handle */
+    int scratch_offset() const noexcept { return static_cast<int> (buffers.size()) + 1; }
+};
+
+template<typename T>
+static void pool_prepare (void* ptr, int nchannels, int nframes, bool clear) {
+    // refers back to inline storage, undoing a free() done by the user
+    ((kv::lua::AudioBufferImpl<T>*) ptr)->resize (nchannels, nframes, false, clear, true);
+}
+
+template<typename T>
+static void pool_refer (void* ptr, char* data, int nchannels, int nframes, bool clear) {
+    ((kv::lua::AudioBufferImpl<T>*) ptr)->refer_to ((T*) data, nchannels, nframes, clear);
+}
+
+template<typename T>
+static void pool_create (lua_State* L, Pool* pool, int count, int nscratch, size_t scratchsize) {
+    lua_createtable (L, count + nscratch, 1);
+
+    for (int i = 0; i < count; ++i) {
+        pool->buffers[i] = kv::lua::new_audio_buffer<T> (L, pool->nchannels, pool->nframes);
+        lua_rawseti (L, -2, i + 1);
+    }
+
+    for (int i = 0; i < nscratch; ++i) {
+        pool->scratch[i] = kv::lua::new_audio_buffer<T> (L, 0, 0);
+        lua_rawseti (L, -2, pool->scratch_offset() + i);
+    }
+
+    if (scratchsize > 0) {
+        pool->arenasize = sizeof (T) * scratchsize;
+        pool->arena = (char*) lua_newuserdata (L, pool->arenasize + kv::lua::AudioBufferImpl<T>::alignment);
+        lua_setfield (L, -2, "arena");
+    }
+
+    lua_setuservalue (L, -2);
+}
+
+static Pool* pool_new (lua_State* L, bool isdouble) {
+    const auto count       = (int) luaL_checkinteger (L, 1);
+    const auto nchannels   = (int) luaL_checkinteger (L, 2);
+    const auto nframes     = (int) luaL_checkinteger (L, 3);
+    const auto scratchsize = (lua_Integer) luaL_optinteger (L, 4, 0);
+    const auto nscratch    = (int) luaL_optinteger (L, 5, scratchsize > 0 ? 16 : 0);
+    luaL_argcheck (L, count >= 0, 1, "count must be zero or more");
+    luaL_argcheck (L, kv::lua::AudioBufferImpl<float>::fits_inline (nchannels, nframes), 2,
+        "channels must be from 1 to 31 and frames more than zero");
+    luaL_argcheck (L, scratchsize >= 0, 4, "scratch size must be zero or more");
+    luaL_argcheck (L, nscratch >= 0, 5, "scratch buffer count must be zero or more");
+
+    auto* pool = new (lua_newuserdata (L, sizeof (Pool))) Pool();
+    luaL_setmetatable (L, LKV_MT_AUDIO_BUFFER_POOL);
+    pool->isdouble  = isdouble;
+    pool->nchannels = nchannels;
+    pool->nframes   = nframes;
+    pool->buffers.resize ((size_t) count, nullptr);
+    pool->acquired.resize ((size_t) count, 0);
+    pool->available.resize ((size_t) count, 0);
+    pool->scratch.resize ((size_t) nscratch, nullptr);
+
+    // hand out the lowest index first
+    for (int i = 0; i < count; ++i)
+        pool->available[i] = count - 1 - i;
+    pool->navailable = count;
+
+    if (isdouble)
+        pool_create<double> (L, pool, count, nscratch, (size_t) scratchsize);
+    else
+        pool_create<float> (L, pool, count, nscratch, (size_t) scratchsize);
+    return pool;
+}
+
+//==============================================================================
+/// Create a pool of 32bit buffers
+// @int count Number of buffers in the pool
+// @int nchannels Number of channels in each buffer
+// @int nframes Number of samples in each channel
+// @int[opt] scratch Size of the scratch arena in samples
+// @int[opt] nscratch Max scratch buffers handed out per block (default 16)
+// @function AudioBufferPool.new32
+// @return A new pool
+// @within Constructors
+static int pool_new32 (lua_State* L) {
+    pool_new (L, false);
+    return 1;
+}
+
+/// Create a pool of 64bit buffers
+// Same arguments as @{AudioBufferPool.new32}
+// @function AudioBufferPool.new64
+// @return A new pool
+// @within Constructors
+static int pool_new64 (lua_State* L) {
+    pool_new (L, true);
+    return 1;
+}
+
+static int pool_gc (lua_State* L) {
+    ((Pool*) lua_touserdata (L, 1))->~Pool();
+    return 0;
+}
+
+static int pool_tostring (lua_State* L) {
+    auto* pool = (Pool*) lua_touserdata (L, 1);
+    lua_pushfstring (L, "kv.AudioBufferPool: %p", pool);
+    return 1;
+}
+
+/// Take a buffer from the pool.
+// Does not allocate. The buffer has the channel and frame counts the pool
+// was created with.
+// @bool[opt] clear Zero the buffer's samples (default false)
+// @function AudioBufferPool:acquire
+// @return A buffer or nil if none are available
+static int pool_acquire (lua_State* L) {
+    auto* pool = (Pool*) lua_touserdata (L, 1);
+    if (pool->navailable <= 0) {
+        lua_pushnil (L);
+        return 1;
+    }
+
+    const int index = pool->available[--pool->navailable];
+    pool->acquired[index] = 1;
+    const bool clear = lua_toboolean (L, 2);
+    if (pool->isdouble)
+        pool_prepare<double> (pool->buffers[index], pool->nchannels, pool->nframes, clear);
+    else
+        pool_prepare<float> (pool->buffers[index], pool->nchannels, pool->nframes, clear);
+
+    lua_getuservalue (L, 1);
+    lua_rawgeti (L, -1, index + 1);
+    return 1;
+}
+
+/// Return a buffer to the pool.
+// @tparam kv.AudioBuffer buffer A buffer taken with @{AudioBufferPool:acquire}
+// @function AudioBufferPool:release
+// @return True if released, false if the buffer is not acquired from this pool
+static int pool_release (lua_State* L) {
+    auto* pool = (Pool*) lua_touserdata (L, 1);
+    const auto* ptr = lua_touserdata (L, 2);
+    bool released = false;
+
+    for (int i = 0; ptr != nullptr && i < (int) pool->buffers.size(); ++i) {
+        if (pool->buffers[i] != ptr)
+            continue;
+        if (pool->acquired[i] != 0) {
+            pool->acquired[i] = 0;
+            pool->available[pool->navailable++] = i;
+            released = true;
+        }
+        break;
+    }
+
+    lua_pushboolean (L, released);
+    return 1;
+}
+
+/// Take a temporary buffer from the scratch arena.
+// Does not allocate. The buffer is only valid until @{AudioBufferPool:reset},
+// after which it is empty.
+// @int nchannels Number of channels (1 to 31)
+// @int nframes Number of samples in each channel
+// @bool[opt] clear Zero the buffer's samples (default false)
+// @function AudioBufferPool:scratch
+// @return A buffer or nil if the arena or scratch buffers are used up
+static int pool_scratch (lua_State* L) {
+    auto* pool = (Pool*) lua_touserdata (L, 1);
+    const auto nchannels = (int) luaL_checkinteger (L, 2);
+    const auto nframes   = (int) luaL_checkinteger (L, 3);
+    luaL_argcheck (L, nchannels > 0 && nchannels < kv::lua::AudioBufferImpl<float>::maxChannels, 2,
+        "channels must be from 1 to 31");
+    luaL_argcheck (L, nframes > 0, 3, "frames must be more than zero");
+
+    const size_t alignment = kv::lua::AudioBufferImpl<float>::alignment;
+    const size_t sampsize  = pool->isdouble ? sizeof (double) : sizeof (float);
+    const size_t nbytes    = sampsize * (size_t) nchannels * (size_t) nframes;
+    const auto base        = reinterpret_cast<uintptr_t> (pool->arena);
+    const auto start       = (base + pool->arenaused + alignment - 1) & ~(uintptr_t) (alignment - 1);
+    const size_t offset    = (size_t) (start - base);
+
+    if (pool->arena == nullptr || pool->nscratch >= (int) pool->scratch.size() ||
+        offset + nbytes > pool->arenasize + alignment)
+    {
+        lua_pushnil (L);
+        return 1;
+    }
+
+    pool->arenaused = offset + nbytes;
+    auto* handle = pool->scratch[pool->nscratch];
+    const bool clear = lua_toboolean (L, 4);
+    if (pool->isdouble)
+        pool_refer<double> (handle, (char*) start, nchannels, nframes, clear);
+    else
+        pool_refer<float> (handle, (char*) start, nchannels, nframes, clear);
+
+    lua_getuservalue (L, 1);
+    lua_rawgeti (L, -1, pool->scratch_offset() + pool->nscratch);
+    ++pool->nscratch;
+    return 1;
+}
+
+/// Reclaim all scratch buffers.
+// Call at the end of each process call. Scratch buffers handed out since
+// the last reset become empty. Acquired buffers are not affected.
+// @function AudioBufferPool:reset
+static int pool_reset (lua_State* L) {
+    auto* pool = (Pool*) lua_touserdata (L, 1);
+    for (int i = 0; i < pool->nscratch; ++i) {
+        if (pool->isdouble)
+            pool_refer<double> (pool->scratch[i], pool->arena, 0, 0, false);
+        else
+            pool_refer<float> (pool->scratch[i], pool->arena, 0, 0, false);
+    }
+
+    pool->nscratch  = 0;
+    pool->arenaused = 0;
+    return 0;
+}
+
+/// Number of buffers available to acquire.
+// @function AudioBufferPool:available
+// @treturn int
+static int pool_available (lua_State* L) {
+    lua_pushinteger (L, ((Pool*) lua_touserdata (L, 1))->navailable);
+    return 1;
+}
+
+/// Total number of buffers in the pool.
+// @function AudioBufferPool:size
+// @treturn int
+static int pool_size (lua_State* L) {
+    lua_pushinteger (L, (lua_Integer) ((Pool*) lua_touserdata (L, 1))->buffers.size());
+    return 1;
+}
+
+/// Scratch arena samples still free.
+// Alignment padding may make less usable.
+// @function AudioBufferPool:scratchfree
+// @treturn int
+static int pool_scratchfree (lua_State* L) {
+    auto* pool = (Pool*) lua_touserdata (L, 1);
+    const size_t sampsize = pool->isdouble ? sizeof (double) : sizeof (float);
+    const size_t used = juce::jmin (pool->arenaused, pool->arenasize);
+    lua_pushinteger (L, (lua_Integer) ((pool->arenasize - used) / sampsize));
+    return 1;
+}
+
+//==============================================================================
+static const luaL_Reg pool_methods[] = {
+    { "__gc",           pool_gc },
+    { "__tostring",     pool_tostring },
+    { "acquire",        pool_acquire },
+    { "release",        pool_release },
+    { "scratch",        pool_scratch },
+    { "reset",          pool_reset },
+    { "available",      pool_available },
+    { "size",           pool_size },
+    { "scratchfree",    pool_scratchfree },
+    { NULL, NULL }
+};
+
+//==============================================================================
+LKV_EXPORT
+int luaopen_kv_AudioBufferPool (lua_State* L) {
+    if (luaL_newmetatable (L, LKV_MT_AUDIO_BUFFER_POOL)) {
+        lua_pushvalue (L, -1);               /* duplicate the metatable */
+        lua_setfield (L, -2, "__index");     /* mt.__index = mt */
+        luaL_setfuncs (L, pool_methods, 0);
+        lua_pop (L, 1);
+    }
+
+    if (luaL_newmetatable (L, LKV_MT_AUDIO_BUFFER_POOL_TYPE)) {
+        lua_pop (L, 1);
+    }
+
+    lua_newtable (L);
+    luaL_setmetatable (L, LKV_MT_AUDIO_BUFFER_POOL_TYPE);
+    lua_pushcfunction (L, pool_new32);
+    lua_setfield (L, -2, "new32");
+    lua_pushcfunction (L, pool_new64);
+    lua_setfield (L, -2, "new64");
+    lua_pushcfunction (L, pool_new32);
+    lua_setfield (L, -2, "new");
+    return 1;
+}
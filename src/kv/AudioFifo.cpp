@@ -0,0 +1,289 @@
+/// A lock-free audio FIFO between threads.
+// A single producer single consumer ring of multichannel samples built on
+// `juce::AbstractFifo`. One thread pushes while another pops, neither
+// locks nor allocates. Give the FIFO a name to open it from a different
+// Lua state, for example to hand audio from the realtime callback to an
+// analysis or recording script. The ring stays alive while any state
+// holds it.
+// @classmod kv.AudioFifo
+// @pragma nostrip
+// @usage
+// -- realtime callback
+// local fifo = AudioFifo.new (2, 48000, 'recorder')
+// function process (audio)
+//     fifo:push (audio)
+// end
+//
+// -- another thread with its own Lua state
+// local fifo  = AudioFifo.open ('recorder')
+// local block = AudioBuffer.new (2, 1024)
+// while fifo:ready() >= block:length() do
+//     fifo:pop (block)
+//     -- write `block` somewhere
+// end
+
+#include "kv/lua/audio_buffer.hpp"
+#include "kv/lua/shared_object.hpp"
+
+#define LKV_MT_AUDIO_FIFO       "kv.AudioFifo"
+#define LKV_MT_AUDIO_FIFO_TYPE  "kv.AudioFifoClass"
+
+namespace {
+
+/** Ring shared by every Lua state holding the FIFO */
+class AudioFifoImpl final : public kv::lua::SharedObject<AudioFifoImpl> {
+public:
+    AudioFifoImpl (int nchannels, int nframes)
+        : fifo (nframes + 1), data (nchannels, nframes + 1)
+    {
+        data.clear();
+    }
+
+    int channels() const noexcept { return data.getNumChannels(); }
+    int capacity() const noexcept { return fifo.getTotalSize() - 1; }
+    int ready() const noexcept    { return fifo.getNumReady(); }
+    int space() const noexcept    { return fifo.getFreeSpace(); }
+
+    /** Clear the ring. Only while neither side is using it */
+    void reset() noexcept { fifo.reset(); }
+
+    /** Write up to count frames from src, returning the number written */
+    template<typename T>
+    int push (const juce::AudioBuffer<T>& src, int start, int count) noexcept {
+        int start1, size1, start2, size2;
+        fifo.prepareToWrite (count, start1, size1, start2, size2);
+        for (int c = 0; c < channels(); ++c) {
+            const T* in = src.getReadPointer (c) + start;
+            kv::lua::convert_samples (data.getWritePointer (c, start1), in, size1);
+            kv::lua::convert_samples (data.getWritePointer (c, start2), in + size1, size2);
+        }
+        fifo.finishedWrite (size1 + size2);
+        return size1 + size2;
+    }
+
+    /** Read up to count frames into dst, returning the number read */
+    template<typename T>
+    int pop (juce::AudioBuffer<T>& dst, int start, int count) noexcept {
+        int start1, size1, start2, size2;
+        fifo.prepareToRead (count, start1, size1, start2, size2);
+        for (int c = 0; c < channels(); ++c) {
+            T* out = dst.getWritePointer (c) + start;
+            kv::lua::convert_samples (out, data.getReadPointer (c, start1), size1);
+            kv::lua::convert_samples (out + size1, data.getReadPointer (c, start2), size2);
+        }
+        fifo.finishedRead (size1 + size2);
+        return size1 + size2;
+    }
+
+private:
+    juce::AbstractFifo fifo;
+    juce::AudioBuffer<float> data;
+};
+
+}
+
+using Impl = AudioFifoImpl;
+
+static Impl* audiofifo_check (lua_State* L) {
+    auto* impl = *(Impl**) lua_touserdata (L, 1);
+    if (impl == nullptr)
+        luaL_error (L, "FIFO was released");
+    return impl;
+}
+
+/** Pushes an empty handle, so a failed allocation can't leak a reference */
+static Impl** audiofifo_newhandle (lua_State* L) {
+    auto** handle = (Impl**) lua_newuserdata (L, sizeof (Impl*));
+    *handle = nullptr;
+    luaL_setmetatable (L, LKV_MT_AUDIO_FIFO);
+    return handle;
+}
+
+/** Checks the buffer and range arguments of push and pop */
+template<typename T>
+static void audiofifo_checkrange (lua_State* L, Impl* impl, const juce::AudioBuffer<T>& buffer, int& start, int& count) {
+    start = static_cast<int> (luaL_optinteger (L, 3, 1)) - 1;
+    count = static_cast<int> (luaL_optinteger (L, 4, buffer.getNumSamples() - start));
+    luaL_argcheck (L, buffer.getNumChannels() >= impl->channels(), 2, "not enough channels");
+    luaL_argcheck (L, start >= 0 && count >= 0 && start + count <= buffer.getNumSamples(), 3,
+                   "sample range out of bounds");
+}
+
+//==============================================================================
+/// Create a new FIFO.
+// Allocates the whole ring, nothing allocates after this.
+// @int nchannels Number of channels
+// @int capacity Most frames held at once
+// @string[opt] name Name to open the FIFO by from other Lua states
+// @function AudioFifo.new
+// @return A new FIFO
+// @within Constructors
+static int audiofifo_new (lua_State* L) {
+    const auto nchannels = (int) luaL_checkinteger (L, 1);
+    const auto capacity  = (int) luaL_checkinteger (L, 2);
+    const char* name     = luaL_optstring (L, 3, nullptr);
+    luaL_argcheck (L, nchannels > 0, 1, "channels must be more than zero");
+    luaL_argcheck (L, capacity > 0, 2, "capacity must be more than zero");
+
+    auto** handle = audiofifo_newhandle (L);
+    *handle = Impl::create (name, nchannels, capacity);
+    if (*handle == nullptr)
+        return luaL_error (L, "a FIFO named '%s' already exists", name);
+    return 1;
+}
+
+/// Open a named FIFO.
+// Works from any Lua state in the process.
+// @string name Name given to @{AudioFifo.new}
+// @function AudioFifo.open
+// @return The FIFO or nil if there is none by that name
+// @within Constructors
+static int audiofifo_open (lua_State* L) {
+    const char* name = luaL_checkstring (L, 1);
+    auto** handle = audiofifo_newhandle (L);
+    *handle = Impl::open (name);
+    return *handle != nullptr ? 1 : 0;
+}
+
+static int audiofifo_gc (lua_State* L) {
+    auto** impl = (Impl**) lua_touserdata (L, 1);
+    if (*impl != nullptr)
+        (*impl)->release();
+    *impl = nullptr;
+    return 0;
+}
+
+/// Write frames.
+// Writes as many frames as fit, never blocks. Only one thread may push.
+// @tparam kv.AudioBuffer buffer Audio to write
+// @int[opt] start First frame (default 1)
+// @int[opt] count Number of frames (default to the end)
+// @function AudioFifo:push
+// @treturn int Frames written
+static int audiofifo_push (lua_State* L) {
+    auto* impl = audiofifo_check (L);
+    int written = 0;
+    kv::lua::with_audio_buffer (L, 2, [&](auto& buffer) {
+        int start = 0, count = 0;
+        audiofifo_checkrange (L, impl, buffer, start, count);
+        written = impl->push (buffer, start, count);
+    });
+    lua_pushinteger (L, written);
+    return 1;
+}
+
+/// Read frames.
+// Reads as many frames as are ready, never blocks. Only one thread may pop.
+// Frames past the ones read are left untouched.
+// @tparam kv.AudioBuffer buffer Audio to read into
+// @int[opt] start First frame (default 1)
+// @int[opt] count Number of frames (default to the end)
+// @function AudioFifo:pop
+// @treturn int Frames read
+static int audiofifo_pop (lua_State* L) {
+    auto* impl = audiofifo_check (L);
+    int read = 0;
+    kv::lua::with_audio_buffer (L, 2, [&](auto& buffer) {
+        int start = 0, count = 0;
+        audiofifo_checkrange (L, impl, buffer, start, count);
+        read = impl->pop (buffer, start, count);
+    });
+    lua_pushinteger (L, read);
+    return 1;
+}
+
+/// Frames ready to pop.
+// @function AudioFifo:ready
+// @treturn int
+static int audiofifo_ready (lua_State* L) {
+    lua_pushinteger (L, audiofifo_check (L)->ready());
+    return 1;
+}
+
+/// Frames that can be pushed.
+// @function AudioFifo:space
+// @treturn int
+static int audiofifo_space (lua_State* L) {
+    lua_pushinteger (L, audiofifo_check (L)->space());
+    return 1;
+}
+
+/// Most frames held at once.
+// @function AudioFifo:capacity
+// @treturn int
+static int audiofifo_capacity (lua_State* L) {
+    lua_pushinteger (L, audiofifo_check (L)->capacity());
+    return 1;
+}
+
+/// Number of channels.
+// @function AudioFifo:channels
+// @treturn int
+static int audiofifo_channels (lua_State* L) {
+    lua_pushinteger (L, audiofifo_check (L)->channels());
+    return 1;
+}
+
+/// Name of the FIFO.
+// @function AudioFifo:name
+// @treturn string The name or nil if unnamed
+static int audiofifo_name (lua_State* L) {
+    const auto& name = audiofifo_check (L)->getname();
+    if (name.empty())
+        return 0;
+    lua_pushlstring (L, name.data(), name.size());
+    return 1;
+}
+
+/// Discard everything in the FIFO.
+// Only call while neither side is pushing or popping.
+// @function AudioFifo:reset
+static int audiofifo_reset (lua_State* L) {
+    audiofifo_check (L)->reset();
+    return 0;
+}
+
+/// Release this state's reference.
+// The FIFO is freed once no state holds it. Also done when collected.
+// @function AudioFifo:release
+static int audiofifo_release (lua_State* L) {
+    return audiofifo_gc (L);
+}
+
+//==============================================================================
+static const luaL_Reg audiofifo_methods[] = {
+    { "__gc",           audiofifo_gc },
+    { "push",           audiofifo_push },
+    { "pop",            audiofifo_pop },
+    { "ready",          audiofifo_ready },
+    { "space",          audiofifo_space },
+    { "capacity",       audiofifo_capacity },
+    { "channels",       audiofifo_channels },
+    { "name",           audiofifo_name },
+    { "reset",          audiofifo_reset },
+    { "release",        audiofifo_release },
+    { NULL, NULL }
+};
+
+//==============================================================================
+LKV_EXPORT
+int luaopen_kv_AudioFifo (lua_State* L) {
+    if (luaL_newmetatable (L, LKV_MT_AUDIO_FIFO)) {
+        lua_pushvalue (L, -1);               /* duplicate the metatable */
+        lua_setfield (L, -2, "__index");     /* mt.__index = mt */
+        luaL_setfuncs (L, audiofifo_methods, 0);
+        lua_pop (L, 1);
+    }
+
+    if (luaL_newmetatable (L, LKV_MT_AUDIO_FIFO_TYPE)) {
+        lua_pop (L, 1);
+    }
+
+    lua_newtable (L);
+    luaL_setmetatable (L, LKV_MT_AUDIO_FIFO_TYPE);
+    lua_pushcfunction (L, audiofifo_new);
+    lua_setfield (L, -2, "new");
+    lua_pushcfunction (L, audiofifo_open);
+    lua_setfield (L, -2, "open");
+    return 1;
+}
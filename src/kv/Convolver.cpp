@@ -0,0 +1,413 @@
+/// Partitioned FFT convolution.
+// Convolves every channel of an audio buffer with an impulse response, in
+// place, with no added latency. The head of the response is split into
+// blocks of `blocksize` frames and runs in the audio thread with the same
+// cost every block. Long responses can move their tail into larger
+// partitions computed on a background thread.
+// @classmod kv.Convolver
+// @pragma nostrip
+// @usage
+// -- 128 frame head partitions, 4096 frame tail partitions
+// local reverb = Convolver.new (ir, 128, 4096)
+// function process (audio)
+//     reverb:process (audio)
+// end
+
+#include "kv/lua/fft.hpp"
+#include <memory>
+#include <vector>
+
+#define LKV_MT_CONVOLVER        "kv.Convolver"
+#define LKV_MT_CONVOLVER_TYPE   "kv.ConvolverClass"
+
+namespace {
+
+using kv::lua::Complex;
+
+/** Uniformly partitioned overlap-add convolution of one channel.
+    Partial blocks are transformed as they arrive so output is never
+    delayed. Partitions older than the current block are summed once, when
+    a block starts */
+class Partitioned final {
+public:
+    Partitioned (const float* ir, int length, int blocksize)
+        : block (blocksize),
+          bins (blocksize + 1),
+          nsegments (juce::jmax (1, (length + blocksize - 1) / blocksize)),
+          plan (blocksize * 2),
+          irsegments (static_cast<size_t> (nsegments * bins)),
+          insegments (static_cast<size_t> (nsegments * bins)),
+          history (static_cast<size_t> (bins)),
+          spectrum (static_cast<size_t> (bins)),
+          input (static_cast<size_t> (blocksize * 2), 0.f),
+          output (static_cast<size_t> (blocksize * 2), 0.f),
+          overlap (static_cast<size_t> (blocksize), 0.f)
+    {
+        for (int s = 0; s < nsegments; ++s) {
+            const int n = juce::jmin (block, length - s * block);
+            std::fill (input.begin(), input.end(), 0.f);
+            if (n > 0)
+                std::copy (ir + s * block, ir + s * block + n, input.begin());
+            plan.forward (input.data(), irsegments.data() + s * bins);
+        }
+        std::fill (input.begin(), input.end(), 0.f);
+    }
+
+    /** Frames that can be processed before the current block ends */
+    int remaining() const noexcept { return block - position; }
+
+    /** Convolve n frames, n <= remaining(). in and out may be the same */
+    void process (const float* in, float* out, int n) noexcept {
+        const bool starting = position == 0;
+        std::copy (in, in + n, input.begin() + position);
+
+        Complex* current = insegments.data() + segment * bins;
+        plan.forward (input.data(), current);
+
+        if (starting) {
+            std::fill (history.begin(), history.end(), Complex());
+            int index = segment;
+            for (int s = 1; s < nsegments; ++s) {
+                index = index + 1 < nsegments ? index + 1 : 0;
+                kv::lua::complex_multiply_add (history.data(), insegments.data() + index * bins,
+                                               irsegments.data() + s * bins, bins);
+            }
+        }
+
+        std::copy (history.begin(), history.end(), spectrum.begin());
+        kv::lua::complex_multiply_add (spectrum.data(), current, irsegments.data(), bins);
+        plan.inverse (spectrum.data(), output.data());
+
+        for (int i = 0; i < n; ++i)
+            out[i] = output[position + i] + overlap[position + i];
+
+        position += n;
+        if (position == block) {
+            position = 0;
+            std::fill (input.begin(), input.begin() + block, 0.f);
+            std::copy (output.begin() + block, output.end(), overlap.begin());
+            segment = segment > 0 ? segment - 1 : nsegments - 1;
+        }
+    }
+
+    void reset() noexcept {
+        std::fill (insegments.begin(), insegments.end(), Complex());
+        std::fill (input.begin(), input.end(), 0.f);
+        std::fill (overlap.begin(), overlap.end(), 0.f);
+        position = segment = 0;
+    }
+
+private:
+    int block, bins, nsegments;
+    kv::lua::FFTPlan plan;
+    /** Spectra of the response partitions */
+    std::vector<Complex> irsegments;
+    /** Spectra of past input blocks, newest at segment */
+    std::vector<Complex> insegments;
+    /** Sum of older partitions for the current block */
+    std::vector<Complex> history;
+    std::vector<Complex> spectrum;
+    std::vector<float> input, output, overlap;
+    int position { 0 };
+    int segment { 0 };
+};
+
+//==============================================================================
+/** Two stage convolution. The first 2 * tailsize frames of the response
+    run in Partitioned heads with the caller's block size. The rest runs in
+    tailsize partitions, one job per tailsize frames of input. A job started
+    when its input completes isn't heard until tailsize frames later, which
+    gives a background thread a whole tail block to compute it */
+class ConvolverImpl final : private juce::Thread {
+public:
+    ConvolverImpl (const std::vector<std::vector<float>>& ir, int length,
+                   int blocksize, int tailsize, bool threaded)
+        : juce::Thread ("kv.Convolver"),
+          nchannels (static_cast<int> (ir.size())),
+          irlength (length),
+          block (blocksize),
+          tail (tailsize > 0 && length > tailsize * 2 ? tailsize : 0),
+          chunk (static_cast<size_t> (blocksize))
+    {
+        const int headlength = tail > 0 ? tail * 2 : length;
+        for (const auto& channel : ir) {
+            heads.emplace_back (new Partitioned (channel.data(), headlength, block));
+            if (tail > 0)
+                tails.emplace_back (new Tail (channel.data() + headlength, length - headlength, tail));
+        }
+
+        if (tail > 0 && threaded)
+            startThread();
+    }
+
+    ~ConvolverImpl() {
+        if (isThreadRunning()) {
+            signalThreadShouldExit();
+            start.signal();
+            stopThread (-1);
+        }
+    }
+
+    int channels() const noexcept { return nchannels; }
+    int length() const noexcept { return irlength; }
+    int blocksize() const noexcept { return block; }
+    int tailsize() const noexcept { return tail; }
+
+    template<typename T>
+    void process (juce::AudioBuffer<T>& buffer, int start, int count) noexcept {
+        juce::ScopedNoDenormals noDenormals;
+
+        for (int done = 0; done < count;) {
+            int n = juce::jmin (count - done, heads.front()->remaining());
+            if (tail > 0)
+                n = juce::jmin (n, tail - tailpos);
+
+            for (int c = 0; c < nchannels; ++c) {
+                auto* io = buffer.getWritePointer (c, start + done);
+                kv::lua::convert_samples (chunk.data(), io, n);
+                if (tail > 0)
+                    std::copy (chunk.data(), chunk.data() + n, tails[c]->fill.begin() + tailpos);
+
+                heads[c]->process (chunk.data(), chunk.data(), n);
+
+                if (tail > 0)
+                    juce::FloatVectorOperations::add (chunk.data(), tails[c]->play.data() + tailpos, n);
+                kv::lua::convert_samples (io, chunk.data(), n);
+            }
+
+            done += n;
+            if (tail > 0 && (tailpos += n) == tail) {
+                tailpos = 0;
+                nexttail();
+            }
+        }
+    }
+
+    void reset() noexcept {
+        finishtail();
+        for (auto& head : heads)
+            head->reset();
+        for (auto& t : tails)
+            t->reset();
+        tailpos = 0;
+    }
+
+private:
+    /** Tail partitions of one channel and the blocks passed to and from the
+        worker */
+    struct Tail {
+        Tail (const float* ir, int length, int size)
+            : engine (ir, length, size),
+              fill (static_cast<size_t> (size), 0.f),
+              job (static_cast<size_t> (size), 0.f),
+              result (static_cast<size_t> (size), 0.f),
+              play (static_cast<size_t> (size), 0.f) {}
+
+        void run() noexcept { engine.process (job.data(), result.data(), static_cast<int> (job.size())); }
+
+        void reset() noexcept {
+            engine.reset();
+            for (auto* v : { &fill, &job, &result, &play })
+                std::fill (v->begin(), v->end(), 0.f);
+        }
+
+        Partitioned engine;
+        /** Input being collected */
+        std::vector<float> fill;
+        /** Input of the running job */
+        std::vector<float> job;
+        /** Output of the last job */
+        std::vector<float> result;
+        /** Output being mixed in */
+        std::vector<float> play;
+    };
+
+    int nchannels, irlength, block, tail;
+    std::vector<std::unique_ptr<Partitioned>> heads;
+    std::vector<std::unique_ptr<Tail>> tails;
+    std::vector<float> chunk;
+    int tailpos { 0 };
+    /** True while the worker has a job */
+    bool pending { false };
+    juce::WaitableEvent start, finished;
+
+    /** Wait for the worker's job, if any */
+    void finishtail() noexcept {
+        if (pending) {
+            finished.wait (-1);
+            pending = false;
+        }
+    }
+
+    /** A tail block of input is complete. Play the last result and start
+        the next job */
+    void nexttail() noexcept {
+        finishtail();
+        for (auto& t : tails) {
+            std::swap (t->play, t->result);
+            std::swap (t->job, t->fill);
+        }
+
+        if (isThreadRunning()) {
+            pending = true;
+            start.signal();
+        } else {
+            for (auto& t : tails)
+                t->run();
+        }
+    }
+
+    void run() override {
+        while (! threadShouldExit()) {
+            if (! start.wait (100) || threadShouldExit())
+                continue;
+            for (auto& t : tails)
+                t->run();
+            finished.signal();
+        }
+    }
+};
+
+}
+
+using Impl = ConvolverImpl;
+
+//==============================================================================
+/// Create a new convolver.
+// The convolver has one channel per channel of the response. All
+// partitions and their transforms are prepared here, processing doesn't
+// allocate. When `tailsize` is set and the response is longer than twice
+// that, everything past 2 * tailsize frames is convolved in tailsize
+// partitions, on a background thread unless `threaded` is false.
+// @tparam kv.AudioBuffer ir Impulse response
+// @int blocksize Head partition size, a power of two
+// @int[opt] tailsize Tail partition size, a power of two larger than
+// blocksize, or 0 for a single stage (default 0)
+// @bool[opt] threaded Compute the tail on a background thread (default true)
+// @function Convolver.new
+// @return A new convolver
+// @within Constructors
+static int convolver_new (lua_State* L) {
+    const auto blocksize = luaL_checkinteger (L, 2);
+    const auto tailsize  = luaL_optinteger (L, 3, 0);
+    const bool threaded  = lua_isnoneornil (L, 4) || lua_toboolean (L, 4);
+    luaL_argcheck (L, blocksize >= 1 && blocksize <= (1 << 16) && (blocksize & (blocksize - 1)) == 0, 2,
+                   "block size must be a power of two");
+    luaL_argcheck (L, tailsize == 0 || (tailsize > blocksize && tailsize <= (1 << 20) && (tailsize & (tailsize - 1)) == 0), 3,
+                   "tail size must be a power of two larger than block size");
+
+    std::vector<std::vector<float>> ir;
+    int length = 0;
+    kv::lua::with_audio_buffer (L, 1, [&](auto& buffer) {
+        length = buffer.getNumSamples();
+        luaL_argcheck (L, buffer.getNumChannels() > 0 && length > 0, 1, "impulse response is empty");
+        for (int c = 0; c < buffer.getNumChannels(); ++c) {
+            ir.emplace_back (static_cast<size_t> (length));
+            kv::lua::convert_samples (ir.back().data(), buffer.getReadPointer (c), length);
+        }
+    });
+
+    new (lua_newuserdata (L, sizeof (Impl))) Impl (ir, length, (int) blocksize, (int) tailsize, threaded);
+    luaL_setmetatable (L, LKV_MT_CONVOLVER);
+    return 1;
+}
+
+static int convolver_gc (lua_State* L) {
+    ((Impl*) lua_touserdata (L, 1))->~Impl();
+    return 0;
+}
+
+/// Convolve a buffer in place.
+// Any number of frames may be processed per call, the cost is lowest when
+// calls line up with the block size. The buffer must have at least as many
+// channels as the convolver. With a threaded tail, this waits for the
+// worker if it is a whole tail block behind.
+// @tparam kv.AudioBuffer buffer Audio to convolve
+// @int[opt] start First frame (default 1)
+// @int[opt] count Number of frames (default to the end)
+// @function Convolver:process
+static int convolver_process (lua_State* L) {
+    auto* impl = (Impl*) lua_touserdata (L, 1);
+    kv::lua::with_audio_buffer (L, 2, [&](auto& buffer) {
+        const auto start = static_cast<int> (luaL_optinteger (L, 3, 1)) - 1;
+        const auto count = static_cast<int> (luaL_optinteger (L, 4, buffer.getNumSamples() - start));
+        luaL_argcheck (L, buffer.getNumChannels() >= impl->channels(), 2, "not enough channels");
+        luaL_argcheck (L, start >= 0 && count >= 0 && start + count <= buffer.getNumSamples(), 3,
+                       "sample range out of bounds");
+        impl->process (buffer, start, count);
+    });
+    return 0;
+}
+
+/// Clear convolution state.
+// @function Convolver:reset
+static int convolver_reset (lua_State* L) {
+    ((Impl*) lua_touserdata (L, 1))->reset();
+    return 0;
+}
+
+/// Impulse response length.
+// @function Convolver:length
+// @treturn int Frames
+static int convolver_length (lua_State* L) {
+    lua_pushinteger (L, ((Impl*) lua_touserdata (L, 1))->length());
+    return 1;
+}
+
+/// Number of channels.
+// @function Convolver:channels
+// @treturn int
+static int convolver_channels (lua_State* L) {
+    lua_pushinteger (L, ((Impl*) lua_touserdata (L, 1))->channels());
+    return 1;
+}
+
+/// Head partition size.
+// @function Convolver:blocksize
+// @treturn int Frames
+static int convolver_blocksize (lua_State* L) {
+    lua_pushinteger (L, ((Impl*) lua_touserdata (L, 1))->blocksize());
+    return 1;
+}
+
+/// Tail partition size.
+// Zero when the whole response runs in the head.
+// @function Convolver:tailsize
+// @treturn int Frames
+static int convolver_tailsize (lua_State* L) {
+    lua_pushinteger (L, ((Impl*) lua_touserdata (L, 1))->tailsize());
+    return 1;
+}
+
+//==============================================================================
+static const luaL_Reg convolver_methods[] = {
+    { "__gc",           convolver_gc },
+    { "process",        convolver_process },
+    { "reset",          convolver_reset },
+    { "length",         convolver_length },
+    { "channels",       convolver_channels },
+    { "blocksize",      convolver_blocksize },
+    { "tailsize",       convolver_tailsize },
+    { NULL, NULL }
+};
+
+//==============================================================================
+LKV_EXPORT
+int luaopen_kv_Convolver (lua_State* L) {
+    if (luaL_newmetatable (L, LKV_MT_CONVOLVER)) {
+        lua_pushvalue (L, -1);               /* duplicate the metatable */
+        lua_setfield (L, -2, "__index");     /* mt.__index = mt */
+        luaL_setfuncs (L, convolver_methods, 0);
+        lua_pop (L, 1);
+    }
+
+    if (luaL_newmetatable (L, LKV_MT_CONVOLVER_TYPE)) {
+        lua_pop (L, 1);
+    }
+
+    lua_newtable (L);
+    luaL_setmetatable (L, LKV_MT_CONVOLVER_TYPE);
+    lua_pushcfunction (L, convolver_new);
+    lua_setfield (L, -2, "new");
+    return 1;
+}
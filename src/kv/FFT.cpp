@@ -0,0 +1,438 @@
+/// Fast Fourier transforms.
+// Preplanned power of two transforms, real and complex, reading from and
+// writing to audio buffers. Spectra are stored in the first two channels of
+// a kv.AudioBuffer, either as real and imaginary parts or as magnitude and
+// phase, one bin per frame. A real transform of size N has N / 2 + 1 bins.
+//
+// Analysis windows and a weighted overlap-add helper make short time
+// Fourier transform processing possible without per-frame allocations.
+// @classmod kv.FFT
+// @pragma nostrip
+// @usage
+// local fft = FFT.new (1024)
+// fft:window ('hann')
+// fft:format ('polar')
+// local spectrum = AudioBuffer.new32 (2, fft:bins())
+// function analyze (audio, frame)
+//     fft:forward (audio, 1, frame, spectrum)
+// end
+
+#include "kv/lua/fft.hpp"
+#include <cmath>
+
+#define LKV_MT_FFT          "kv.FFT"
+#define LKV_MT_FFT_TYPE     "kv.FFTClass"
+
+namespace {
+
+using kv::lua::Complex;
+
+enum WindowType { Rectangular = 0, Hann, Hamming, Blackman };
+
+const char* const window_types[] = { "rectangular", "hann", "hamming", "blackman", nullptr };
+
+enum SpectrumFormat { ComplexFormat = 0, PolarFormat };
+
+const char* const spectrum_formats[] = { "complex", "polar", nullptr };
+
+/** Windowed real and complex transforms with their scratch space */
+class FFTImpl final {
+public:
+    explicit FFTImpl (int n)
+        : plan (n),
+          window (static_cast<size_t> (n), 1.f),
+          frame (static_cast<size_t> (n)),
+          work (static_cast<size_t> (n))
+    {}
+
+    int length() const noexcept { return plan.size(); }
+    int bins() const noexcept { return plan.bins(); }
+
+    SpectrumFormat getformat() const noexcept { return format; }
+    void setformat (SpectrumFormat f) noexcept { format = f; }
+
+    WindowType getwindow() const noexcept { return wtype; }
+
+    void setwindow (WindowType type) noexcept {
+        wtype = type;
+        const int size = length();
+        const double k = 2.0 * juce::MathConstants<double>::pi / size;
+        for (int i = 0; i < size; ++i) {
+            double w = 1.0;
+            switch (type) {
+                case Rectangular: w = 1.0; break;
+                case Hann:        w = 0.5 - 0.5 * std::cos (k * i); break;
+                case Hamming:     w = 0.54 - 0.46 * std::cos (k * i); break;
+                case Blackman:    w = 0.42 - 0.5 * std::cos (k * i) + 0.08 * std::cos (2.0 * k * i); break;
+            }
+            window[i] = static_cast<float> (w);
+        }
+        hop = 0;
+    }
+
+    /** Window a frame of audio and transform it. Reads past the end of the
+        channel are zero */
+    template<typename T>
+    void forward (const juce::AudioBuffer<T>& src, int channel, int start) noexcept {
+        const int size  = length();
+        const int avail = juce::jlimit (0, size, src.getNumSamples() - start);
+        if (avail > 0)
+            kv::lua::convert_samples (frame.data(), src.getReadPointer (channel, start), avail);
+        std::fill (frame.begin() + avail, frame.end(), 0.f);
+        juce::FloatVectorOperations::multiply (frame.data(), window.data(), size);
+        plan.forward (frame.data(), work.data());
+    }
+
+    /** Write bins from the last forward transform */
+    template<typename T>
+    void getspectrum (juce::AudioBuffer<T>& dst) const noexcept {
+        auto* a = dst.getWritePointer (0);
+        auto* b = dst.getWritePointer (1);
+        const int nbins = bins();
+        if (format == PolarFormat) {
+            for (int k = 0; k < nbins; ++k) {
+                a[k] = static_cast<T> (std::abs (work[k]));
+                b[k] = static_cast<T> (std::arg (work[k]));
+            }
+        } else {
+            for (int k = 0; k < nbins; ++k) {
+                a[k] = static_cast<T> (work[k].real());
+                b[k] = static_cast<T> (work[k].imag());
+            }
+        }
+    }
+
+    /** Write magnitudes from the last forward transform */
+    template<typename T>
+    void getmagnitudes (T* dst) const noexcept {
+        for (int k = 0; k < bins(); ++k)
+            dst[k] = static_cast<T> (std::abs (work[k]));
+    }
+
+    /** Read bins and inverse transform into the frame */
+    template<typename T>
+    void inverse (const juce::AudioBuffer<T>& spectrum) noexcept {
+        const auto* a = spectrum.getReadPointer (0);
+        const auto* b = spectrum.getReadPointer (1);
+        const int nbins = bins();
+        if (format == PolarFormat) {
+            for (int k = 0; k < nbins; ++k)
+                work[k] = std::polar (static_cast<float> (a[k]), static_cast<float> (b[k]));
+        } else {
+            for (int k = 0; k < nbins; ++k)
+                work[k] = { static_cast<float> (a[k]), static_cast<float> (b[k]) };
+        }
+        plan.inverse (work.data(), frame.data());
+    }
+
+    /** Write the frame to a channel, clipped to its length */
+    template<typename T>
+    void write (juce::AudioBuffer<T>& dst, int channel, int start) const noexcept {
+        const int n = juce::jlimit (0, length(), dst.getNumSamples() - start);
+        if (n > 0)
+            kv::lua::convert_samples (dst.getWritePointer (channel, start), frame.data(), n);
+    }
+
+    /** Window the frame, scale for the hop size and add it to a channel */
+    template<typename T>
+    void overlapadd (juce::AudioBuffer<T>& dst, int channel, int start, int hopsize) noexcept {
+        if (hopsize != hop) {
+            hop  = hopsize;
+            gain = overlapgain (hopsize);
+        }
+
+        const int n = juce::jlimit (0, length(), dst.getNumSamples() - start);
+        if (n <= 0)
+            return;
+        auto* out = dst.getWritePointer (channel, start);
+        for (int i = 0; i < n; ++i)
+            out[i] += static_cast<T> (frame[i] * window[i] * gain);
+    }
+
+    /** Complex transform of size N, in place on two channels */
+    template<typename T>
+    void transform (juce::AudioBuffer<T>& data, bool inverse) noexcept {
+        const int size = length();
+        auto* re = data.getWritePointer (0);
+        auto* im = data.getWritePointer (1);
+        for (int i = 0; i < size; ++i)
+            work[i] = { static_cast<float> (re[i]), static_cast<float> (im[i]) };
+
+        plan.complex (work.data(), inverse);
+
+        for (int i = 0; i < size; ++i) {
+            re[i] = static_cast<T> (work[i].real());
+            im[i] = static_cast<T> (work[i].imag());
+        }
+    }
+
+private:
+    kv::lua::FFTPlan plan;
+    std::vector<float> window;
+    /** Time domain frame */
+    std::vector<float> frame;
+    /** Complex scratch, holds the spectrum after a forward transform */
+    std::vector<Complex> work;
+    WindowType wtype { Rectangular };
+    SpectrumFormat format { ComplexFormat };
+    /** Hop the overlap-add gain was computed for */
+    int hop { 0 };
+    float gain { 1.f };
+
+    /** Inverse of the sum of squared windows landing on each output sample,
+        averaged over a hop */
+    float overlapgain (int hopsize) const noexcept {
+        double total = 0.0;
+        for (const auto w : window)
+            total += static_cast<double> (w) * w;
+        const double mean = total / hopsize;
+        return mean > 0.0 ? static_cast<float> (1.0 / mean) : 0.f;
+    }
+};
+
+}
+
+using Impl = FFTImpl;
+
+/** Checks a spectrum buffer has two channels and enough frames for fn */
+template<typename Fn>
+static void fft_with_spectrum (lua_State* L, int arg, int frames, Fn&& fn) {
+    kv::lua::with_audio_buffer (L, arg, [&](auto& spectrum) {
+        luaL_argcheck (L, spectrum.getNumChannels() >= 2, arg, "spectrum needs two channels");
+        luaL_argcheck (L, spectrum.getNumSamples() >= frames, arg, "spectrum too short");
+        fn (spectrum);
+    });
+}
+
+static int fft_checkchannel (lua_State* L, int arg, int nchans) {
+    const auto channel = static_cast<int> (luaL_checkinteger (L, arg));
+    luaL_argcheck (L, channel >= 1 && channel <= nchans, arg, "channel out of range");
+    return channel - 1;
+}
+
+static int fft_checkstart (lua_State* L, int arg, int nframes) {
+    const auto start = static_cast<int> (luaL_optinteger (L, arg, 1));
+    luaL_argcheck (L, start >= 1 && start <= nframes + 1, arg, "frame out of range");
+    return start - 1;
+}
+
+//==============================================================================
+/// Create a new transform.
+// Tables and scratch space are allocated here, transforms don't allocate.
+// @int size Transform size, a power of two of at least 2
+// @function FFT.new
+// @return A new FFT
+// @within Constructors
+static int fft_new (lua_State* L) {
+    const auto size = luaL_checkinteger (L, 1);
+    luaL_argcheck (L, size >= 2 && size <= (1 << 24) && (size & (size - 1)) == 0, 1,
+                   "size must be a power of two");
+    new (lua_newuserdata (L, sizeof (Impl))) Impl (static_cast<int> (size));
+    luaL_setmetatable (L, LKV_MT_FFT);
+    return 1;
+}
+
+static int fft_gc (lua_State* L) {
+    ((Impl*) lua_touserdata (L, 1))->~Impl();
+    return 0;
+}
+
+/// Transform a frame of audio.
+// Reads `size` frames from a channel, applies the window and writes the
+// bins to the first two channels of `spectrum`. Frames past the end of the
+// source are treated as silence.
+// @tparam kv.AudioBuffer src Audio to read
+// @int channel Channel to read
+// @int start First frame to read
+// @tparam kv.AudioBuffer spectrum Destination with at least `bins` frames
+// @function FFT:forward
+static int fft_forward (lua_State* L) {
+    auto* impl = (Impl*) lua_touserdata (L, 1);
+    kv::lua::with_audio_buffer (L, 2, [&](auto& src) {
+        const int channel = fft_checkchannel (L, 3, src.getNumChannels());
+        const int start   = fft_checkstart (L, 4, src.getNumSamples());
+        fft_with_spectrum (L, 5, impl->bins(), [&](auto& spectrum) {
+            impl->forward (src, channel, start);
+            impl->getspectrum (spectrum);
+        });
+    });
+    return 0;
+}
+
+/// Transform a frame of audio to magnitudes.
+// Like forward, but only writes bin magnitudes to one channel. The usual
+// path for spectrum analyzers.
+// @tparam kv.AudioBuffer src Audio to read
+// @int channel Channel to read
+// @int start First frame to read
+// @tparam kv.AudioBuffer dst Destination with at least `bins` frames
+// @int[opt] dstchannel Channel to write (default 1)
+// @function FFT:magnitudes
+static int fft_magnitudes (lua_State* L) {
+    auto* impl = (Impl*) lua_touserdata (L, 1);
+    kv::lua::with_audio_buffer (L, 2, [&](auto& src) {
+        const int channel = fft_checkchannel (L, 3, src.getNumChannels());
+        const int start   = fft_checkstart (L, 4, src.getNumSamples());
+        kv::lua::with_audio_buffer (L, 5, [&](auto& dst) {
+            const int dstchan = static_cast<int> (luaL_optinteger (L, 6, 1)) - 1;
+            luaL_argcheck (L, dstchan >= 0 && dstchan < dst.getNumChannels(), 6, "channel out of range");
+            luaL_argcheck (L, dst.getNumSamples() >= impl->bins(), 5, "destination too short");
+            impl->forward (src, channel, start);
+            impl->getmagnitudes (dst.getWritePointer (dstchan));
+        });
+    });
+    return 0;
+}
+
+/// Inverse transform a spectrum to audio.
+// Reads bins from the first two channels of `spectrum` and writes `size`
+// frames to a channel, clipped to its length. No window is applied.
+// @tparam kv.AudioBuffer spectrum Bins to read
+// @tparam kv.AudioBuffer dst Audio to write
+// @int channel Channel to write
+// @int[opt] start First frame to write (default 1)
+// @function FFT:inverse
+static int fft_inverse (lua_State* L) {
+    auto* impl = (Impl*) lua_touserdata (L, 1);
+    fft_with_spectrum (L, 2, impl->bins(), [&](auto& spectrum) {
+        kv::lua::with_audio_buffer (L, 3, [&](auto& dst) {
+            const int channel = fft_checkchannel (L, 4, dst.getNumChannels());
+            const int start   = fft_checkstart (L, 5, dst.getNumSamples());
+            impl->inverse (spectrum);
+            impl->write (dst, channel, start);
+        });
+    });
+    return 0;
+}
+
+/// Inverse transform and overlap-add.
+// Inverse transforms the spectrum, applies the window again and adds the
+// result to a channel. Output is scaled by the window's overlap at the hop
+// size, so analysis with forward and resynthesis with overlapadd at the
+// same hop gives back the input.
+// @tparam kv.AudioBuffer spectrum Bins to read
+// @tparam kv.AudioBuffer dst Audio to add to
+// @int channel Channel to add to
+// @int start First frame to add to
+// @int hop Frames between successive frames
+// @function FFT:overlapadd
+static int fft_overlapadd (lua_State* L) {
+    auto* impl = (Impl*) lua_touserdata (L, 1);
+    fft_with_spectrum (L, 2, impl->bins(), [&](auto& spectrum) {
+        kv::lua::with_audio_buffer (L, 3, [&](auto& dst) {
+            const int channel = fft_checkchannel (L, 4, dst.getNumChannels());
+            const int start   = fft_checkstart (L, 5, dst.getNumSamples());
+            const auto hop    = luaL_checkinteger (L, 6);
+            luaL_argcheck (L, hop >= 1 && hop <= impl->length(), 6, "hop must be between 1 and size");
+            impl->inverse (spectrum);
+            impl->overlapadd (dst, channel, start, static_cast<int> (hop));
+        });
+    });
+    return 0;
+}
+
+/// Complex transform in place.
+// Channel 1 holds the real parts and channel 2 the imaginary parts of
+// `size` points. The inverse is scaled by 1 / size. Windows and the
+// spectrum format don't apply.
+// @tparam kv.AudioBuffer data Points to transform
+// @bool[opt] inverse True for the inverse transform (default false)
+// @function FFT:transform
+static int fft_transform (lua_State* L) {
+    auto* impl = (Impl*) lua_touserdata (L, 1);
+    const bool inverse = lua_toboolean (L, 3);
+    fft_with_spectrum (L, 2, impl->length(), [&](auto& data) {
+        impl->transform (data, inverse);
+    });
+    return 0;
+}
+
+/// Set the analysis window.
+// One of "rectangular", "hann", "hamming" or "blackman". Windows are
+// periodic, as suits overlap-add.
+// @string type Window type (default "rectangular")
+// @function FFT:window
+
+/// Get the analysis window.
+// @treturn string Window type
+// @function FFT:window
+static int fft_window (lua_State* L) {
+    auto* impl = (Impl*) lua_touserdata (L, 1);
+    if (lua_gettop (L) >= 2) {
+        impl->setwindow (static_cast<WindowType> (luaL_checkoption (L, 2, nullptr, window_types)));
+        return 0;
+    }
+    lua_pushstring (L, window_types [impl->getwindow()]);
+    return 1;
+}
+
+/// Set the spectrum format.
+// "complex" stores real and imaginary parts, "polar" stores magnitude and
+// phase in radians.
+// @string format Spectrum format (default "complex")
+// @function FFT:format
+
+/// Get the spectrum format.
+// @treturn string Spectrum format
+// @function FFT:format
+static int fft_format (lua_State* L) {
+    auto* impl = (Impl*) lua_touserdata (L, 1);
+    if (lua_gettop (L) >= 2) {
+        impl->setformat (static_cast<SpectrumFormat> (luaL_checkoption (L, 2, nullptr, spectrum_formats)));
+        return 0;
+    }
+    lua_pushstring (L, spectrum_formats [impl->getformat()]);
+    return 1;
+}
+
+/// Transform size.
+// @function FFT:size
+// @treturn int
+static int fft_size (lua_State* L) {
+    lua_pushinteger (L, ((Impl*) lua_touserdata (L, 1))->length());
+    return 1;
+}
+
+/// Number of bins in a real spectrum.
+// @function FFT:bins
+// @treturn int size / 2 + 1
+static int fft_bins (lua_State* L) {
+    lua_pushinteger (L, ((Impl*) lua_touserdata (L, 1))->bins());
+    return 1;
+}
+
+//==============================================================================
+static const luaL_Reg fft_methods[] = {
+    { "__gc",           fft_gc },
+    { "forward",        fft_forward },
+    { "magnitudes",     fft_magnitudes },
+    { "inverse",        fft_inverse },
+    { "overlapadd",     fft_overlapadd },
+    { "transform",      fft_transform },
+    { "window",         fft_window },
+    { "format",         fft_format },
+    { "size",           fft_size },
+    { "bins",           fft_bins },
+    { NULL, NULL }
+};
+
+//==============================================================================
+LKV_EXPORT
+int luaopen_kv_FFT (lua_State* L) {
+    if (luaL_newmetatable (L, LKV_MT_FFT)) {
+        lua_pushvalue (L, -1);               /* duplicate the metatable */
+        lua_setfield (L, -2, "__index");     /* mt.__index = mt */
+        luaL_setfuncs (L, fft_methods, 0);
+        lua_pop (L, 1);
+    }
+
+    if (luaL_newmetatable (L, LKV_MT_FFT_TYPE)) {
+        lua_pop (L, 1);
+    }
+
+    lua_newtable (L);
+    luaL_setmetatable (L, LKV_MT_FFT_TYPE);
+    lua_pushcfunction (L, fft_new);
+    lua_setfield (L, -2, "new");
+    return 1;
+}
@@ -0,0 +1,244 @@
+/// A bank of cascaded biquad filters.
+// Holds a cascade of biquad sections applied to every channel of an audio
+// buffer, in place. Coefficients are set with the designers below, or
+// directly, and changes ramp smoothly per sample when smoothing is on.
+// Filter state is kept between calls.
+// @classmod kv.FilterBank
+// @pragma nostrip
+// @usage
+// local eq = FilterBank.new (2, 3, 48000)
+// eq:design (1, 'highpass', 40)
+// eq:design (2, 'peak', 2500, 1.2, -3.0)
+// eq:design (3, 'highshelf', 8000, 0.7071, 2.0)
+// eq:smoothing (256)
+// function process (audio)
+//     eq:process (audio)
+// end
+
+#include "kv/lua/filter_bank.hpp"
+
+#define LKV_MT_FILTER_BANK          "kv.FilterBank"
+#define LKV_MT_FILTER_BANK_TYPE     "kv.FilterBankClass"
+
+using kv::lua::Coeffs;
+using kv::lua::FilterBankImpl;
+using kv::lua::design;
+using kv::lua::FilterType;
+using kv::lua::filter_types;
+
+using Impl = FilterBankImpl;
+
+static int filterbank_checksection (lua_State* L, Impl* impl, int arg) {
+    const auto section = static_cast<int> (luaL_checkinteger (L, arg));
+    luaL_argcheck (L, section >= 1 && section <= impl->size(), arg, "section out of range");
+    return section - 1;
+}
+
+//==============================================================================
+/// Create a new filter bank.
+// Sections start as pass through.
+// @int nchannels Number of channels
+// @int nsections Number of cascaded biquad sections
+// @number[opt] samplerate Sample rate used by the designers (default 44100)
+// @function FilterBank.new
+// @return A new filter bank
+// @within Constructors
+static int filterbank_new (lua_State* L) {
+    const auto nchannels = (int) luaL_checkinteger (L, 1);
+    const auto nsections = (int) luaL_checkinteger (L, 2);
+    const auto rate      = luaL_optnumber (L, 3, 44100.0);
+    luaL_argcheck (L, nchannels > 0, 1, "channels must be more than zero");
+    luaL_argcheck (L, nsections > 0, 2, "sections must be more than zero");
+    luaL_argcheck (L, rate > 0, 3, "sample rate must be more than zero");
+
+    new (lua_newuserdata (L, sizeof (Impl))) Impl (nchannels, nsections, rate);
+    luaL_setmetatable (L, LKV_MT_FILTER_BANK);
+    return 1;
+}
+
+static int filterbank_gc (lua_State* L) {
+    ((Impl*) lua_touserdata (L, 1))->~Impl();
+    return 0;
+}
+
+/// Design a section.
+// Uses the RBJ audio EQ cookbook formulas. Type is one of "lowpass",
+// "highpass", "bandpass", "notch", "allpass", "peak", "lowshelf" or
+// "highshelf". For shelves `q` sets the slope, 0.7071 being the steepest
+// without overshoot.
+// @int section Section to set
+// @string type Filter type
+// @number freq Center or corner frequency in Hz
+// @number[opt] q Quality factor (default 0.7071)
+// @number[opt] gain Gain in decibels for peak and shelf types (default 0)
+// @function FilterBank:design
+static int filterbank_design (lua_State* L) {
+    auto* impl = (Impl*) lua_touserdata (L, 1);
+    const int section = filterbank_checksection (L, impl, 2);
+    const auto type   = static_cast<FilterType> (luaL_checkoption (L, 3, nullptr, filter_types));
+    const auto freq   = luaL_checknumber (L, 4);
+    const auto q      = luaL_optnumber (L, 5, 0.7071067811865476);
+    const auto gain   = luaL_optnumber (L, 6, 0.0);
+    luaL_argcheck (L, freq > 0 && freq < impl->rate() * 0.5, 4, "frequency must be between 0 and nyquist");
+    luaL_argcheck (L, q > 0, 5, "q must be more than zero");
+    impl->set (section, design (type, impl->rate(), freq, q, gain));
+    return 0;
+}
+
+/// Set a section's coefficients directly.
+// Coefficients are normalized so a0 is 1.
+// @int section Section to set
+// @number b0
+// @number b1
+// @number b2
+// @number a1
+// @number a2
+// @function FilterBank:setcoeffs
+static int filterbank_setcoeffs (lua_State* L) {
+    auto* impl = (Impl*) lua_touserdata (L, 1);
+    const int section = filterbank_checksection (L, impl, 2);
+    impl->set (section, { luaL_checknumber (L, 3), luaL_checknumber (L, 4), luaL_checknumber (L, 5),
+                          luaL_checknumber (L, 6), luaL_checknumber (L, 7) });
+    return 0;
+}
+
+/// Get a section's coefficients.
+// Returns the target if a change is still ramping.
+// @int section Section to get
+// @treturn number b0
+// @treturn number b1
+// @treturn number b2
+// @treturn number a1
+// @treturn number a2
+// @function FilterBank:coeffs
+static int filterbank_coeffs (lua_State* L) {
+    auto* impl = (Impl*) lua_touserdata (L, 1);
+    const auto& c = impl->coeffs (filterbank_checksection (L, impl, 2));
+    lua_pushnumber (L, c.b0);
+    lua_pushnumber (L, c.b1);
+    lua_pushnumber (L, c.b2);
+    lua_pushnumber (L, c.a1);
+    lua_pushnumber (L, c.a2);
+    return 5;
+}
+
+/// Filter a buffer in place.
+// The buffer must have at least as many channels as the filter bank.
+// @tparam kv.AudioBuffer buffer Audio to filter
+// @int[opt] start First frame (default 1)
+// @int[opt] count Number of frames (default to the end)
+// @function FilterBank:process
+static int filterbank_process (lua_State* L) {
+    auto* impl = (Impl*) lua_touserdata (L, 1);
+    kv::lua::with_audio_buffer (L, 2, [&](auto& buffer) {
+        const auto start = static_cast<int> (luaL_optinteger (L, 3, 1)) - 1;
+        const auto count = static_cast<int> (luaL_optinteger (L, 4, buffer.getNumSamples() - start));
+        luaL_argcheck (L, buffer.getNumChannels() >= impl->channels(), 2, "not enough channels");
+        luaL_argcheck (L, start >= 0 && count >= 0 && start + count <= buffer.getNumSamples(), 3,
+                       "sample range out of bounds");
+        impl->process (buffer, start, count);
+    });
+    return 0;
+}
+
+/// Set coefficient smoothing.
+// Coefficient changes made after this ramp linearly per sample over the
+// given number of frames. Zero applies changes immediately.
+// @int frames Ramp length (default 0)
+// @function FilterBank:smoothing
+
+/// Get coefficient smoothing.
+// @treturn int Ramp length in frames
+// @function FilterBank:smoothing
+static int filterbank_smoothing (lua_State* L) {
+    auto* impl = (Impl*) lua_touserdata (L, 1);
+    if (lua_gettop (L) >= 2) {
+        impl->setsmoothing (juce::jmax (0, static_cast<int> (luaL_checkinteger (L, 2))));
+        return 0;
+    }
+    lua_pushinteger (L, impl->getsmoothing());
+    return 1;
+}
+
+/// Set the sample rate used by the designers.
+// Existing coefficients are not redesigned.
+// @number rate Sample rate
+// @function FilterBank:setsamplerate
+static int filterbank_setsamplerate (lua_State* L) {
+    auto* impl = (Impl*) lua_touserdata (L, 1);
+    const auto rate = luaL_checknumber (L, 2);
+    luaL_argcheck (L, rate > 0, 2, "sample rate must be more than zero");
+    impl->setrate (rate);
+    return 0;
+}
+
+/// Clear filter state.
+// Also completes any coefficient ramps.
+// @function FilterBank:reset
+static int filterbank_reset (lua_State* L) {
+    ((Impl*) lua_touserdata (L, 1))->reset();
+    return 0;
+}
+
+/// Magnitude response of the whole cascade.
+// @number freq Frequency in Hz
+// @treturn number Linear gain
+// @function FilterBank:magnitude
+static int filterbank_magnitude (lua_State* L) {
+    auto* impl = (Impl*) lua_touserdata (L, 1);
+    lua_pushnumber (L, impl->magnitude (luaL_checknumber (L, 2)));
+    return 1;
+}
+
+/// Number of sections.
+// @function FilterBank:size
+// @treturn int
+static int filterbank_size (lua_State* L) {
+    lua_pushinteger (L, ((Impl*) lua_touserdata (L, 1))->size());
+    return 1;
+}
+
+/// Number of channels.
+// @function FilterBank:channels
+// @treturn int
+static int filterbank_channels (lua_State* L) {
+    lua_pushinteger (L, ((Impl*) lua_touserdata (L, 1))->channels());
+    return 1;
+}
+
+//==============================================================================
+static const luaL_Reg filterbank_methods[] = {
+    { "__gc",           filterbank_gc },
+    { "design",         filterbank_design },
+    { "setcoeffs",      filterbank_setcoeffs },
+    { "coeffs",         filterbank_coeffs },
+    { "process",        filterbank_process },
+    { "smoothing",      filterbank_smoothing },
+    { "setsamplerate",  filterbank_setsamplerate },
+    { "reset",          filterbank_reset },
+    { "magnitude",      filterbank_magnitude },
+    { "size",           filterbank_size },
+    { "channels",       filterbank_channels },
+    { NULL, NULL }
+};
+
+//==============================================================================
+LKV_EXPORT
+int luaopen_kv_FilterBank (lua_State* L) {
+    if (luaL_newmetatable (L, LKV_MT_FILTER_BANK)) {
+        lua_pushvalue (L, -1);               /* duplicate the metatable */
+        lua_setfield (L, -2, "__index");     /* mt.__index = mt */
+        luaL_setfuncs (L, filterbank_methods, 0);
+        lua_pop (L, 1);
+    }
+
+    if (luaL_newmetatable (L, LKV_MT_FILTER_BANK_TYPE)) {
+        lua_pop (L, 1);
+    }
+
+    lua_newtable (L);
+    luaL_setmetatable (L, LKV_MT_FILTER_BANK_TYPE);
+    lua_pushcfunction (L, filterbank_new);
+    lua_setfield (L, -2, "new");
+    return 1;
+}
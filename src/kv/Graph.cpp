@@ -0,0 +1,1426 @@
+/// A native DSP graph.
+// Nodes and connections are declared from Lua once, then every block is
+// rendered in C++. Nodes run in topological order over channel buffers
+// taken from a shared pool, and a buffer is reused as soon as the last node
+// reading it has run. Lua only describes the topology and changes
+// parameters, except for "lua" nodes which call back into a function.
+//
+// Node types and the arguments `add` takes after the type and channel count:
+//
+// - "gain": [gain]. Parameter "gain", ramped over 20ms.
+// - "biquad": type, freq, [q], [gain]. Types as in @{kv.FilterBank:design}.
+// Parameters "freq", "q" and "gain".
+// - "delay": maxdelay, [delay], [feedback]. Delay in frames. Parameters
+// "delay" and "feedback".
+// - "mixer": ninputs. Sums inputs connected to ports 1 to ninputs.
+// Parameters "gain1" to "gainN", ramped over a block.
+// - "lua": fn. Calls `fn (audio, midi)` with the node's audio and MIDI,
+// processed in place. Both buffers are only valid during the call.
+//
+// Connections into a node are summed. A mono source feeds every channel of
+// its destination, otherwise channels connect one to one.
+//
+// With `threads` set, nodes on independent branches render in parallel on
+// a fixed pool of workers that steal ready nodes from each other. Every
+// block waits for all nodes before returning.
+// @classmod kv.Graph
+// @pragma nostrip
+// @usage
+// local graph = Graph.new (2, 512, 48000)
+// local eq    = graph:add ('biquad', 2, 'lowpass', 2000)
+// local amp   = graph:add ('gain', 2, 0.5)
+// graph:connect (graph:input(), eq)
+// graph:connect (eq, amp)
+// graph:connect (amp, graph:output())
+// function process (audio, midi)
+//     graph:process (audio, midi)
+// end
+
+#include "kv/lua/filter_bank.hpp"
+#include "kv/lua/midi_buffer.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#define LKV_MT_GRAPH        "kv.Graph"
+#define LKV_MT_GRAPH_TYPE   "kv.GraphClass"
+
+namespace {
+
+enum NodeKind { InputKind = 0, OutputKind, GainKind, BiquadKind, DelayKind, MixerKind, LuaKind };
+
+const char* const node_kinds[] = {
+    "input", "output", "gain", "biquad", "delay", "mixer", "lua", nullptr
+};
+
+/** An audio connection into a node's input port */
+struct Connection {
+    int source;
+    int port;
+};
+
+/** Linear ramp towards a target */
+struct Ramp {
+    float value { 1.f }, target { 1.f }, step { 0.f };
+    int remaining { 0 };
+
+    void set (float v, int frames) noexcept {
+        target = v;
+        remaining = juce::jmax (0, frames);
+        if (remaining == 0)
+            value = v;
+        else
+            step = (target - value) / remaining;
+    }
+
+    void finish() noexcept {
+        value = target;
+        remaining = 0;
+    }
+};
+
+//==============================================================================
+class Node {
+public:
+    Node (NodeKind k, int nchannels, int nports = 1)
+        : kind (k), channels (nchannels), ports (nports) {}
+    virtual ~Node() = default;
+
+    const NodeKind kind;
+    const int channels;
+    const int ports;
+
+    /** Audio connections, in the order made */
+    std::vector<Connection> inputs;
+    /** Nodes MIDI is taken from */
+    std::vector<int> midiinputs;
+    /** MIDI of this node, nullptr when the node has no MIDI */
+    juce::MidiBuffer* midi { nullptr };
+
+    /** Add a source channel to one of this node's channels */
+    virtual void accumulate (int /*port*/, float* dst, const float* src, int nframes) noexcept {
+        juce::FloatVectorOperations::add (dst, src, nframes);
+    }
+
+    /** Process summed inputs in place */
+    virtual void process (float* const* /*io*/, int /*nframes*/) noexcept {}
+
+    virtual bool set (const char* /*name*/, double /*value*/) { return false; }
+    virtual bool get (const char* /*name*/, double& /*value*/) const { return false; }
+    virtual void reset() noexcept {}
+};
+
+/** Graph input and output */
+class IONode final : public Node {
+public:
+    IONode (NodeKind k, int nchannels)
+        : Node (k, nchannels)
+    {
+        midi = &buffer;
+        buffer.ensureSize (2048);
+    }
+
+private:
+    juce::MidiBuffer buffer;
+};
+
+class GainNode final : public Node {
+public:
+    GainNode (int nchannels, double rate, float initial)
+        : Node (GainKind, nchannels),
+          rampframes (juce::roundToInt (rate * 0.02))
+    {
+        gain.set (initial, 0);
+    }
+
+    void process (float* const* io, int nframes) noexcept override {
+        if (gain.remaining <= 0) {
+            for (int c = 0; c < channels; ++c)
+                juce::FloatVectorOperations::multiply (io[c], gain.value, nframes);
+            return;
+        }
+
+        const int n = juce::jmin (nframes, gain.remaining);
+        for (int c = 0; c < channels; ++c) {
+            float g = gain.value;
+            for (int i = 0; i < n; ++i) {
+                g += gain.step;
+                io[c][i] *= g;
+            }
+            juce::FloatVectorOperations::multiply (io[c] + n, gain.target, nframes - n);
+        }
+
+        gain.remaining -= n;
+        if (gain.remaining > 0)
+            gain.value += gain.step * n;
+        else
+            gain.finish();
+    }
+
+    bool set (const char* name, double value) override {
+        if (std::strcmp (name, "gain") != 0)
+            return false;
+        gain.set (static_cast<float> (value), rampframes);
+        return true;
+    }
+
+    bool get (const char* name, double& value) const override {
+        if (std::strcmp (name, "gain") != 0)
+            return false;
+        value = gain.target;
+        return true;
+    }
+
+    void reset() noexcept override { gain.finish(); }
+
+private:
+    int rampframes;
+    Ramp gain;
+};
+
+class BiquadNode final : public Node {
+public:
+    BiquadNode (int nchannels, double samplerate, kv::lua::FilterType t, double f, double qual, double db)
+        : Node (BiquadKind, nchannels),
+          filter (nchannels, 1, samplerate),
+          type (t), freq (f), q (qual), gain (db)
+    {
+        filter.set (0, kv::lua::design (type, filter.rate(), freq, q, gain));
+        filter.setsmoothing (64);
+    }
+
+    void process (float* const* io, int nframes) noexcept override {
+        juce::AudioBuffer<float> buffer (io, channels, nframes);
+        filter.process (buffer, 0, nframes);
+    }
+
+    bool set (const char* name, double value) override {
+        if (std::strcmp (name, "freq") == 0)
+            freq = juce::jlimit (1.0, filter.rate() * 0.499, value);
+        else if (std::strcmp (name, "q") == 0)
+            q = juce::jmax (0.01, value);
+        else if (std::strcmp (name, "gain") == 0)
+            gain = value;
+        else
+            return false;
+        filter.set (0, kv::lua::design (type, filter.rate(), freq, q, gain));
+        return true;
+    }
+
+    bool get (const char* name, double& value) const override {
+        if (std::strcmp (name, "freq") == 0)
+            value = freq;
+        else if (std::strcmp (name, "q") == 0)
+            value = q;
+        else if (std::strcmp (name, "gain") == 0)
+            value = gain;
+        else
+            return false;
+        return true;
+    }
+
+    void reset() noexcept override { filter.reset(); }
+
+private:
+    kv::lua::FilterBankImpl filter;
+    kv::lua::FilterType type;
+    double freq, q, gain;
+};
+
+class DelayNode final : public Node {
+public:
+    DelayNode (int nchannels, int maxdelay, int initial, float fb)
+        : Node (DelayKind, nchannels),
+          length (maxdelay + 1),
+          lines (static_cast<size_t> (nchannels * (maxdelay + 1)), 0.f),
+          delay (juce::jlimit (0, maxdelay, initial)),
+          feedback (fb)
+    {}
+
+    void process (float* const* io, int nframes) noexcept override {
+        int pos = 0;
+        for (int c = 0; c < channels; ++c) {
+            float* line = lines.data() + c * length;
+            pos = write;
+            for (int i = 0; i < nframes; ++i) {
+                int read = pos - delay;
+                if (read < 0)
+                    read += length;
+                const float y = line[read];
+                line[pos] = io[c][i] + y * feedback;
+                if (delay > 0)
+                    io[c][i] = y;
+                if (++pos == length)
+                    pos = 0;
+            }
+        }
+        write = pos;
+    }
+
+    bool set (const char* name, double value) override {
+        if (std::strcmp (name, "delay") == 0)
+            delay = juce::jlimit (0, length - 1, juce::roundToInt (value));
+        else if (std::strcmp (name, "feedback") == 0)
+            feedback = static_cast<float> (juce::jlimit (-0.999, 0.999, value));
+        else
+            return false;
+        return true;
+    }
+
+    bool get (const char* name, double& value) const override {
+        if (std::strcmp (name, "delay") == 0)
+            value = delay;
+        else if (std::strcmp (name, "feedback") == 0)
+            value = feedback;
+        else
+            return false;
+        return true;
+    }
+
+    void reset() noexcept override {
+        std::fill (lines.begin(), lines.end(), 0.f);
+        write = 0;
+    }
+
+private:
+    int length;
+    std::vector<float> lines;
+    int write { 0 };
+    int delay;
+    float feedback;
+};
+
+class MixerNode final : public Node {
+public:
+    MixerNode (int nchannels, int ninputs)
+        : Node (MixerKind, nchannels, ninputs),
+          gains (static_cast<size_t> (ninputs))
+    {}
+
+    void accumulate (int port, float* dst, const float* src, int nframes) noexcept override {
+        const auto& g = gains[port];
+        if (g.remaining <= 0) {
+            juce::FloatVectorOperations::addWithMultiply (dst, src, g.value, nframes);
+            return;
+        }
+
+        const float step = (g.target - g.value) / nframes;
+        float v = g.value;
+        for (int i = 0; i < nframes; ++i) {
+            v += step;
+            dst[i] += src[i] * v;
+        }
+    }
+
+    void process (float* const*, int) noexcept override {
+        for (auto& g : gains)
+            g.finish();
+    }
+
+    bool set (const char* name, double value) override {
+        const int port = parseport (name);
+        if (port < 0)
+            return false;
+        gains[port].set (static_cast<float> (value), 1);
+        return true;
+    }
+
+    bool get (const char* name, double& value) const override {
+        const int port = parseport (name);
+        if (port < 0)
+            return false;
+        value = gains[port].target;
+        return true;
+    }
+
+    void reset() noexcept override {
+        for (auto& g : gains)
+            g.finish();
+    }
+
+private:
+    std::vector<Ramp> gains;
+
+    /** Index of a "gainN" parameter or -1 */
+    int parseport (const char* name) const noexcept {
+        if (std::strncmp (name, "gain", 4) != 0 || name[4] == '\0')
+            return -1;
+        char* end = nullptr;
+        const long port = std::strtol (name + 4, &end, 10);
+        return *end == '\0' && port >= 1 && port <= ports ? static_cast<int> (port - 1) : -1;
+    }
+};
+
+/** Calls a Lua function. The function and the buffers handed to it are
+    kept in the graph's user value, indexed by node id */
+class LuaNode final : public Node {
+public:
+    LuaNode (int nchannels, kv::lua::AudioBufferImpl<float>* a, kv::lua::MidiBufferImpl* m)
+        : Node (LuaKind, nchannels),
+          audio (a)
+    {
+        midi = &m->buffer;
+    }
+
+    kv::lua::AudioBufferImpl<float>* audio;
+};
+
+//==============================================================================
+/** Chase-Lev work stealing deque of node indexes. The owner pushes and pops
+    at the bottom, other threads steal from the top. Capacity is fixed, a
+    block never queues more than every node once */
+class WorkQueue final {
+public:
+    void resize (int capacity) {
+        int size = 1;
+        while (size < capacity)
+            size *= 2;
+        items.reset (new std::atomic<int> [static_cast<size_t> (size)]);
+        mask = size - 1;
+        clear();
+    }
+
+    /** Only call while no thread is using the queue */
+    void clear() noexcept {
+        top.store (0, std::memory_order_relaxed);
+        bottom.store (0, std::memory_order_relaxed);
+    }
+
+    void push (int value) noexcept {
+        const auto b = bottom.load (std::memory_order_relaxed);
+        items[b & mask].store (value, std::memory_order_relaxed);
+        bottom.store (b + 1, std::memory_order_release);
+    }
+
+    /** Returns the newest item or -1 */
+    int pop() noexcept {
+        const auto b = bottom.load (std::memory_order_relaxed) - 1;
+        bottom.store (b, std::memory_order_relaxed);
+        std::atomic_thread_fence (std::memory_order_seq_cst);
+        auto t = top.load (std::memory_order_relaxed);
+
+        if (t > b) {
+            bottom.store (b + 1, std::memory_order_relaxed);
+            return -1;
+        }
+
+        int value = items[b & mask].load (std::memory_order_relaxed);
+        if (t == b) {
+            // last item, race thieves for it
+            if (! top.compare_exchange_strong (t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                value = -1;
+            bottom.store (b + 1, std::memory_order_relaxed);
+        }
+        return value;
+    }
+
+    /** Returns the oldest item, or -1 if empty or lost to another thread */
+    int steal() noexcept {
+        auto t = top.load (std::memory_order_acquire);
+        std::atomic_thread_fence (std::memory_order_seq_cst);
+        const auto b = bottom.load (std::memory_order_acquire);
+        if (t >= b)
+            return -1;
+        const int value = items[t & mask].load (std::memory_order_relaxed);
+        if (! top.compare_exchange_strong (t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            return -1;
+        return value;
+    }
+
+private:
+    std::unique_ptr<std::atomic<int>[]> items;
+    int64_t mask { 0 };
+    alignas (64) std::atomic<int64_t> top { 0 };
+    alignas (64) std::atomic<int64_t> bottom { 0 };
+};
+
+/** Nodes only the rendering thread may run. Any thread pushes, the
+    rendering thread pops */
+class MainQueue final {
+public:
+    void resize (int capacity) {
+        items.reset (new std::atomic<int> [static_cast<size_t> (capacity)]);
+        for (int i = 0; i < capacity; ++i)
+            items[i].store (0, std::memory_order_relaxed);
+        clear();
+    }
+
+    /** Only call when every pushed item was popped */
+    void clear() noexcept {
+        write.store (0, std::memory_order_relaxed);
+        read = 0;
+    }
+
+    void push (int value) noexcept {
+        items[write.fetch_add (1, std::memory_order_relaxed)].store (value + 1, std::memory_order_release);
+    }
+
+    /** Returns the next item or -1 */
+    int pop() noexcept {
+        if (read >= write.load (std::memory_order_acquire))
+            return -1;
+        // claimed but maybe not stored yet
+        const int value = items[read].load (std::memory_order_acquire);
+        if (value == 0)
+            return -1;
+        items[read++].store (0, std::memory_order_relaxed);
+        return value - 1;
+    }
+
+private:
+    std::unique_ptr<std::atomic<int>[]> items;
+    std::atomic<int> write { 0 };
+    int read { 0 };
+};
+
+/** A parameter change made from a lua node while workers are rendering */
+struct DeferredParam {
+    Node* node;
+    char name [16];
+    double value;
+};
+
+//==============================================================================
+class GraphImpl final {
+public:
+    GraphImpl (int nchannels, int blocksize, double rate)
+        : channels (nchannels), maxframes (blocksize), samplerate (rate)
+    {
+        nodes.emplace_back (new IONode (InputKind, nchannels));
+        nodes.emplace_back (new IONode (OutputKind, nchannels));
+        queues.emplace_back (new WorkQueue());
+    }
+
+    ~GraphImpl() {
+        stopworkers();
+    }
+
+    static constexpr int inputid  = 1;
+    static constexpr int outputid = 2;
+
+    const int channels;
+    const int maxframes;
+    const double samplerate;
+
+    /** Returns the node with an id, or nullptr */
+    Node* find (int id) const noexcept {
+        return id >= 1 && id <= (int) nodes.size() ? nodes[id - 1].get() : nullptr;
+    }
+
+    /** True while process is running */
+    bool isrendering() const noexcept { return rendering; }
+
+    /** True while worker threads may be reading the topology */
+    bool islocked() const noexcept { return rendering && ! workers.empty(); }
+
+    /** Add a node and return its id */
+    int add (Node* node) {
+        nodes.emplace_back (node);
+        dirty = true;
+        return static_cast<int> (nodes.size());
+    }
+
+    void remove (int id) {
+        for (auto& node : nodes) {
+            if (node == nullptr)
+                continue;
+            auto& in = node->inputs;
+            in.erase (std::remove_if (in.begin(), in.end(), [id](const Connection& c) { return c.source == id; }), in.end());
+            auto& mi = node->midiinputs;
+            mi.erase (std::remove (mi.begin(), mi.end(), id), mi.end());
+        }
+        // drop changes waiting on the node
+        auto* node = nodes[id - 1].get();
+        const auto end = std::remove_if (deferred.begin(), deferred.begin() + ndeferred,
+                                         [node](const DeferredParam& p) { return p.node == node; });
+        ndeferred = static_cast<int> (end - deferred.begin());
+        // a lua node may be removing itself, keep it until the block is done
+        if (rendering)
+            removed.push_back (std::move (nodes[id - 1]));
+        nodes[id - 1].reset();
+        dirty = true;
+    }
+
+    /** True if dst is upstream of src, or the same node */
+    bool upstream (int dst, int src) const {
+        std::vector<char> seen (nodes.size(), 0);
+        std::vector<int> stack { src };
+        while (! stack.empty()) {
+            const int id = stack.back();
+            stack.pop_back();
+            if (id == dst)
+                return true;
+            if (seen[id - 1])
+                continue;
+            seen[id - 1] = 1;
+            const auto* node = find (id);
+            for (const auto& c : node->inputs)
+                stack.push_back (c.source);
+            for (const auto m : node->midiinputs)
+                stack.push_back (m);
+        }
+        return false;
+    }
+
+    bool connect (int src, int dst, int port) {
+        auto& in = find (dst)->inputs;
+        for (const auto& c : in)
+            if (c.source == src && c.port == port)
+                return false;
+        in.push_back ({ src, port });
+        dirty = true;
+        return true;
+    }
+
+    bool disconnect (int src, int dst, int port) {
+        auto& in = find (dst)->inputs;
+        const auto size = in.size();
+        in.erase (std::remove_if (in.begin(), in.end(), [&](const Connection& c) {
+            return c.source == src && (port < 0 || c.port == port);
+        }), in.end());
+        dirty |= in.size() != size;
+        return in.size() != size;
+    }
+
+    bool connectmidi (int src, int dst) {
+        auto& in = find (dst)->midiinputs;
+        if (std::find (in.begin(), in.end(), src) != in.end())
+            return false;
+        in.push_back (src);
+        dirty = true;
+        return true;
+    }
+
+    bool disconnectmidi (int src, int dst) {
+        auto& in = find (dst)->midiinputs;
+        const auto it = std::find (in.begin(), in.end(), src);
+        if (it == in.end())
+            return false;
+        in.erase (it);
+        dirty = true;
+        return true;
+    }
+
+    /** Set a parameter. Changes made while rendering apply once the block
+        is done, whatever the number of threads. Returns false if the node
+        has no such parameter or too many changes are waiting */
+    bool setparam (Node* node, const char* name, double value) {
+        if (! rendering)
+            return node->set (name, value);
+
+        double current = 0.0;
+        if (ndeferred >= (int) deferred.size() || std::strlen (name) >= sizeof (DeferredParam::name)
+            || ! node->get (name, current))
+            return false;
+        auto& param = deferred[ndeferred++];
+        param.node  = node;
+        param.value = value;
+        std::strcpy (param.name, name);
+        return true;
+    }
+
+    bool needsprepare() const noexcept { return dirty; }
+
+    /** Number of worker threads */
+    int threads() const noexcept { return static_cast<int> (workers.size()); }
+
+    /** Start or stop worker threads. Zero renders on the calling thread only */
+    void setthreads (int count) {
+        stopworkers();
+        queues.clear();
+        queues.emplace_back (new WorkQueue());
+        for (int i = 1; i <= count; ++i) {
+            queues.emplace_back (new WorkQueue());
+            workers.emplace_back (new Worker (*this, i));
+        }
+        dirty = true;
+        for (auto& w : workers)
+            w->startThread();
+    }
+
+    /** Sort nodes and assign channel buffers. Allocates */
+    void prepare() {
+        const int count = static_cast<int> (nodes.size());
+
+        consumers.assign (static_cast<size_t> (count), {});
+        predecessors.assign (static_cast<size_t> (count), 0);
+        for (int i = 0; i < count; ++i) {
+            if (nodes[i] == nullptr)
+                continue;
+            std::vector<int> sources;
+            for (const auto& c : nodes[i]->inputs)
+                sources.push_back (c.source - 1);
+            for (const auto m : nodes[i]->midiinputs)
+                sources.push_back (m - 1);
+            std::sort (sources.begin(), sources.end());
+            sources.erase (std::unique (sources.begin(), sources.end()), sources.end());
+            for (const auto s : sources)
+                consumers[s].push_back (i);
+            predecessors[i] = static_cast<int> (sources.size());
+        }
+
+        // Kahn's algorithm, taking the lowest ready id so order is stable
+        std::vector<int> waiting (predecessors);
+        order.clear();
+        std::vector<char> done (static_cast<size_t> (count), 0);
+        for (;;) {
+            int next = -1;
+            for (int i = 0; i < count && next < 0; ++i)
+                if (nodes[i] != nullptr && ! done[i] && waiting[i] == 0)
+                    next = i;
+            if (next < 0)
+                break;
+            done[next] = 1;
+            order.push_back (next);
+            for (const auto c : consumers[next])
+                --waiting[c];
+        }
+
+        // ancestors of every node, as bit sets
+        const size_t words = static_cast<size_t> ((count + 63) / 64);
+        std::vector<std::vector<uint64_t>> ancestors (static_cast<size_t> (count), std::vector<uint64_t> (words, 0));
+        for (const auto i : order) {
+            for (const auto c : consumers[i]) {
+                for (size_t w = 0; w < words; ++w)
+                    ancestors[c][w] |= ancestors[i][w];
+                ancestors[c][(size_t) i / 64] |= uint64_t (1) << (i % 64);
+            }
+        }
+        auto isancestor = [&](int a, int of) {
+            return (ancestors[of][(size_t) a / 64] >> (a % 64)) & 1;
+        };
+
+        // A node's channels are free once its last reader has run. Another
+        // node may take them only if it comes after the owner and every
+        // reader in any schedule, so parallel renders never share a buffer
+        std::vector<int> position (static_cast<size_t> (count), 0), lastuse (static_cast<size_t> (count), 0);
+        for (int p = 0; p < (int) order.size(); ++p)
+            position[order[p]] = lastuse[order[p]] = p;
+        for (const auto i : order)
+            for (const auto c : consumers[i])
+                lastuse[i] = juce::jmax (lastuse[i], position[c]);
+
+        struct FreeSlot { int slot, owner; };
+        std::vector<FreeSlot> free;
+        std::vector<std::vector<int>> slots (static_cast<size_t> (count));
+        nslots = 0;
+        for (int p = 0; p < (int) order.size(); ++p) {
+            const int i = order[p];
+            for (int c = 0; c < nodes[i]->channels; ++c) {
+                int taken = -1;
+                for (int f = (int) free.size(); --f >= 0 && taken < 0;) {
+                    const int owner = free[f].owner;
+                    bool safe = isancestor (owner, i);
+                    for (const auto r : consumers[owner])
+                        safe = safe && isancestor (r, i);
+                    if (safe) {
+                        taken = free[f].slot;
+                        free.erase (free.begin() + f);
+                    }
+                }
+                slots[i].push_back (taken >= 0 ? taken : nslots++);
+            }
+
+            for (const auto j : order) {
+                if (lastuse[j] == p)
+                    for (auto s = slots[j].rbegin(); s != slots[j].rend(); ++s)
+                        free.push_back ({ *s, j });
+            }
+        }
+
+        memory.assign (static_cast<size_t> (nslots * maxframes), 0.f);
+        outputs.assign (static_cast<size_t> (count), {});
+        for (const auto i : order)
+            for (const auto s : slots[i])
+                outputs[i].push_back (memory.data() + s * maxframes);
+
+        pending.reset (new std::atomic<int> [static_cast<size_t> (juce::jmax (1, count))]);
+        for (auto& q : queues)
+            q->resize (count);
+        mainqueue.resize (juce::jmax (1, count));
+        deferred.resize (64);
+        ndeferred = 0;
+        dirty = false;
+    }
+
+    /** Render order as node ids */
+    std::vector<int> renderorder() const {
+        std::vector<int> ids;
+        for (const auto i : order)
+            ids.push_back (i + 1);
+        return ids;
+    }
+
+    /** Number of channel buffers in the pool */
+    int buffers() const noexcept { return nslots; }
+
+    /** Wall time of the last process call in milliseconds */
+    double rendertime() const noexcept { return lasttime; }
+
+    void reset() noexcept {
+        for (auto& node : nodes)
+            if (node != nullptr)
+                node->reset();
+    }
+
+    /** Render one block. Lua nodes are called through L with the graph's
+        user value at uvindex. Returns false with an error message on the
+        stack if a Lua node failed */
+    template<typename T>
+    bool process (lua_State* L, int uvindex, juce::AudioBuffer<T>& audio, int nframes, kv::lua::MidiBufferImpl* midi) {
+        juce::ScopedNoDenormals noDenormals;
+        const double started = juce::Time::getMillisecondCounterHiRes();
+
+        auto& input = outputs[inputid - 1];
+        for (int c = 0; c < channels; ++c)
+            kv::lua::convert_samples (input[c], audio.getReadPointer (c), nframes);
+        nodes[inputid - 1]->midi->clear();
+        if (midi != nullptr)
+            nodes[inputid - 1]->midi->addEvents (midi->buffer, 0, nframes, 0);
+
+        rendering = true;
+        renderstate = L;
+        renderuv    = uvindex;
+        renderframes = nframes;
+        failed = false;
+
+        if (workers.empty()) {
+            for (const auto i : order)
+                if (nodes[i] != nullptr && ! failed)
+                    run (i);
+        } else {
+            schedule();
+        }
+
+        rendering = false;
+        removed.clear();
+        for (int i = 0; i < ndeferred; ++i)
+            deferred[i].node->set (deferred[i].name, deferred[i].value);
+        ndeferred = 0;
+        lasttime = juce::Time::getMillisecondCounterHiRes() - started;
+        if (failed)
+            return false;
+
+        auto& output = outputs[outputid - 1];
+        for (int c = 0; c < channels; ++c)
+            kv::lua::convert_samples (audio.getWritePointer (c), output[c], nframes);
+        if (midi != nullptr) {
+            midi->buffer.clear();
+            midi->add (*nodes[outputid - 1]->midi, 0, nframes, 0);
+        }
+
+        return true;
+    }
+
+private:
+    /** Renders nodes from the work queues until the block is done */
+    class Worker final : public juce::Thread {
+    public:
+        Worker (GraphImpl& g, int i)
+            : juce::Thread ("kv.Graph"), graph (g), index (i) {}
+
+        juce::WaitableEvent start;
+
+        void run() override {
+            while (! threadShouldExit()) {
+                if (! start.wait (100) || threadShouldExit())
+                    continue;
+                juce::ScopedNoDenormals noDenormals;
+                graph.work (index);
+                graph.busy.fetch_sub (1, std::memory_order_release);
+            }
+        }
+
+    private:
+        GraphImpl& graph;
+        const int index;
+    };
+
+    std::vector<std::unique_ptr<Node>> nodes;
+    bool dirty { true };
+
+    /** Node indexes in render order */
+    std::vector<int> order;
+    /** Distinct nodes reading each node */
+    std::vector<std::vector<int>> consumers;
+    /** Number of distinct nodes each node reads */
+    std::vector<int> predecessors;
+    /** Channel pointers of each node into memory */
+    std::vector<std::vector<float*>> outputs;
+    std::vector<float> memory;
+    int nslots { 0 };
+
+    bool rendering { false };
+    lua_State* renderstate { nullptr };
+    int renderuv { 0 };
+    int renderframes { 0 };
+    bool failed { false };
+    double lasttime { 0.0 };
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    /** Work queues, the rendering thread's first */
+    std::vector<std::unique_ptr<WorkQueue>> queues;
+    MainQueue mainqueue;
+    /** Inputs each node is still waiting for this block */
+    std::unique_ptr<std::atomic<int>[]> pending;
+    /** Nodes not yet rendered this block */
+    std::atomic<int> remaining { 0 };
+    /** Workers still inside work() */
+    std::atomic<int> busy { 0 };
+    std::vector<DeferredParam> deferred;
+    int ndeferred { 0 };
+    /** Nodes removed while rendering, deleted once the block is done */
+    std::vector<std::unique_ptr<Node>> removed;
+
+    void stopworkers() {
+        for (auto& w : workers)
+            w->signalThreadShouldExit();
+        for (auto& w : workers) {
+            w->start.signal();
+            w->stopThread (-1);
+        }
+        workers.clear();
+    }
+
+    /** Sum a node's inputs into its channels */
+    void gather (int index, int nframes) noexcept {
+        auto* node = nodes[index].get();
+        auto& io = outputs[index];
+        for (auto* ch : io)
+            juce::FloatVectorOperations::clear (ch, nframes);
+
+        for (const auto& c : node->inputs) {
+            // sources added by a lua node mid block aren't prepared yet
+            if (c.source > (int) outputs.size() || outputs[c.source - 1].empty())
+                continue;
+            const auto& src = outputs[c.source - 1];
+            const int nsrc = static_cast<int> (src.size());
+            for (int ch = 0; ch < node->channels; ++ch) {
+                if (nsrc == 1)
+                    node->accumulate (c.port, io[ch], src[0], nframes);
+                else if (ch < nsrc)
+                    node->accumulate (c.port, io[ch], src[ch], nframes);
+            }
+        }
+
+        if (node->midi != nullptr) {
+            node->midi->clear();
+            for (const auto m : node->midiinputs)
+                if (auto* src = nodes[m - 1] != nullptr ? nodes[m - 1]->midi : nullptr)
+                    node->midi->addEvents (*src, 0, nframes, 0);
+        }
+    }
+
+    /** Gather and render one node */
+    void run (int index) {
+        if (index == inputid - 1)
+            return;
+
+        gather (index, renderframes);
+        auto* node = nodes[index].get();
+        if (node->kind != LuaKind) {
+            node->process (outputs[index].data(), renderframes);
+            return;
+        }
+
+        if (failed)
+            return;
+        auto* L = renderstate;
+        auto* luanode = static_cast<LuaNode*> (node);
+        luanode->audio->refer_to (outputs[index].data(), node->channels, renderframes);
+        lua_rawgeti (L, renderuv, index + 1);
+        lua_rawgeti (L, -1, 1);
+        lua_rawgeti (L, -2, 2);
+        lua_rawgeti (L, -3, 3);
+        lua_remove (L, -4);
+        // the error message stays on the stack
+        failed = lua_pcall (L, 2, 0, 0) != LUA_OK;
+        // the script may keep the buffer, don't leave it pointing at graph memory
+        luanode->audio->free();
+    }
+
+    /** Render the block across the rendering thread and the workers */
+    void schedule() {
+        int total = 0;
+        for (auto& q : queues)
+            q->clear();
+        mainqueue.clear();
+        for (const auto i : order) {
+            pending[i].store (predecessors[i], std::memory_order_relaxed);
+            ++total;
+        }
+        remaining.store (total, std::memory_order_relaxed);
+
+        for (const auto i : order)
+            if (predecessors[i] == 0)
+                enqueue (0, i);
+
+        busy.store (static_cast<int> (workers.size()), std::memory_order_relaxed);
+        for (auto& w : workers)
+            w->start.signal();
+
+        work (0);
+        while (busy.load (std::memory_order_acquire) > 0)
+            std::this_thread::yield();
+    }
+
+    void enqueue (int queue, int index) noexcept {
+        if (nodes[index]->kind == LuaKind)
+            mainqueue.push (index);
+        else
+            queues[queue]->push (index);
+    }
+
+    /** Run ready nodes until every node of the block has rendered. Queue
+        zero belongs to the rendering thread, the only one running lua nodes */
+    void work (int queue) {
+        const int nqueues = static_cast<int> (queues.size());
+        while (remaining.load (std::memory_order_acquire) > 0) {
+            int index = queue == 0 ? mainqueue.pop() : -1;
+            if (index < 0)
+                index = queues[queue]->pop();
+            for (int s = 1; index < 0 && s < nqueues; ++s)
+                index = queues[(queue + s) % nqueues]->steal();
+            if (index < 0) {
+                std::this_thread::yield();
+                continue;
+            }
+
+            run (index);
+            for (const auto c : consumers[index])
+                if (pending[c].fetch_sub (1, std::memory_order_acq_rel) == 1)
+                    enqueue (queue, c);
+            remaining.fetch_sub (1, std::memory_order_acq_rel);
+        }
+    }
+};
+
+}
+
+using Impl = GraphImpl;
+
+static int graph_checknode (lua_State* L, Impl* impl, int arg) {
+    const auto id = static_cast<int> (luaL_checkinteger (L, arg));
+    luaL_argcheck (L, impl->find (id) != nullptr, arg, "no such node");
+    return id;
+}
+
+/** Topology changes from a lua node are fine on one thread, but workers
+    read it all block */
+static Impl* graph_checkunlocked (lua_State* L) {
+    auto* impl = (Impl*) lua_touserdata (L, 1);
+    if (impl->islocked())
+        luaL_error (L, "can't change the graph while threads are rendering");
+    return impl;
+}
+
+/** Prepare reallocates every buffer, so never mid block */
+static void graph_checkprepare (lua_State* L, Impl* impl) {
+    if (! impl->needsprepare())
+        return;
+    if (impl->isrendering())
+        luaL_error (L, "can't prepare the graph while it is rendering");
+    impl->prepare();
+}
+
+//==============================================================================
+/// Create a new graph.
+// The graph starts with an input and an output node.
+// @int nchannels Channels in and out of the graph
+// @int blocksize Most frames processed per call
+// @number[opt] samplerate Sample rate (default 44100)
+// @function Graph.new
+// @return A new graph
+// @within Constructors
+static int graph_new (lua_State* L) {
+    const auto nchannels = (int) luaL_checkinteger (L, 1);
+    const auto blocksize = (int) luaL_checkinteger (L, 2);
+    const auto rate      = luaL_optnumber (L, 3, 44100.0);
+    luaL_argcheck (L, nchannels > 0 && nchannels < kv::lua::AudioBufferImpl<float>::maxChannels, 1,
+                   "channels must be from 1 to 31");
+    luaL_argcheck (L, blocksize > 0, 2, "block size must be more than zero");
+    luaL_argcheck (L, rate > 0, 3, "sample rate must be more than zero");
+
+    new (lua_newuserdata (L, sizeof (Impl))) Impl (nchannels, blocksize, rate);
+    luaL_setmetatable (L, LKV_MT_GRAPH);
+    lua_newtable (L);
+    lua_setuservalue (L, -2);
+    return 1;
+}
+
+static int graph_gc (lua_State* L) {
+    ((Impl*) lua_touserdata (L, 1))->~Impl();
+    return 0;
+}
+
+/// Add a node.
+// See the module description for node types and their arguments.
+// @string type Node type
+// @int nchannels Number of channels
+// @param ... Arguments for the node type
+// @function Graph:add
+// @treturn int Node id
+static int graph_add (lua_State* L) {
+    auto* impl = graph_checkunlocked (L);
+    const auto kind      = static_cast<NodeKind> (luaL_checkoption (L, 2, nullptr, node_kinds));
+    const auto nchannels = (int) luaL_checkinteger (L, 3);
+    luaL_argcheck (L, kind != InputKind && kind != OutputKind, 2, "graphs have one input and output");
+    luaL_argcheck (L, nchannels > 0 && nchannels < kv::lua::AudioBufferImpl<float>::maxChannels, 3,
+                   "channels must be from 1 to 31");
+
+    Node* node = nullptr;
+    switch (kind) {
+        case GainKind: {
+            node = new GainNode (nchannels, impl->samplerate, (float) luaL_optnumber (L, 4, 1.0));
+            break;
+        }
+
+        case BiquadKind: {
+            const auto type = static_cast<kv::lua::FilterType> (luaL_checkoption (L, 4, nullptr, kv::lua::filter_types));
+            const auto freq = luaL_checknumber (L, 5);
+            const auto q    = luaL_optnumber (L, 6, 0.7071067811865476);
+            const auto gain = luaL_optnumber (L, 7, 0.0);
+            luaL_argcheck (L, freq > 0 && freq < impl->samplerate * 0.5, 5, "frequency must be between 0 and nyquist");
+            luaL_argcheck (L, q > 0, 6, "q must be more than zero");
+            node = new BiquadNode (nchannels, impl->samplerate, type, freq, q, gain);
+            break;
+        }
+
+        case DelayKind: {
+            const auto maxdelay = (int) luaL_checkinteger (L, 4);
+            const auto delay    = (int) luaL_optinteger (L, 5, 0);
+            const auto feedback = luaL_optnumber (L, 6, 0.0);
+            luaL_argcheck (L, maxdelay >= 0, 4, "max delay must be zero or more");
+            luaL_argcheck (L, std::abs (feedback) < 1.0, 6, "feedback must be less than 1");
+            node = new DelayNode (nchannels, maxdelay, delay, (float) feedback);
+            break;
+        }
+
+        case MixerKind: {
+            const auto ninputs = (int) luaL_checkinteger (L, 4);
+            luaL_argcheck (L, ninputs > 0, 4, "mixer needs at least one input");
+            node = new MixerNode (nchannels, ninputs);
+            break;
+        }
+
+        case LuaKind: {
+            luaL_checktype (L, 4, LUA_TFUNCTION);
+            lua_getuservalue (L, 1);
+            lua_createtable (L, 3, 0);
+            lua_pushvalue (L, 4);
+            lua_rawseti (L, -2, 1);
+            auto* audio = kv::lua::new_audio_buffer<float> (L, 0, 0);
+            lua_rawseti (L, -2, 2);
+            auto** midi = kv::lua::new_midibuffer (L);
+            (*midi)->reserve (2048);
+            lua_rawseti (L, -2, 3);
+            node = new LuaNode (nchannels, audio, *midi);
+            const int id = impl->add (node);
+            lua_rawseti (L, -2, id);
+            lua_pushinteger (L, id);
+            return 1;
+        }
+
+        default:
+            break;
+    }
+
+    lua_pushinteger (L, impl->add (node));
+    return 1;
+}
+
+/// Remove a node and its connections.
+// @int node Node id
+// @function Graph:remove
+static int graph_remove (lua_State* L) {
+    auto* impl = graph_checkunlocked (L);
+    const int id = graph_checknode (L, impl, 2);
+    luaL_argcheck (L, id != Impl::inputid && id != Impl::outputid, 2, "can't remove input or output");
+    impl->remove (id);
+    lua_getuservalue (L, 1);
+    lua_pushnil (L);
+    lua_rawseti (L, -2, id);
+    return 0;
+}
+
+/// Connect audio between nodes.
+// Fails with an error if the connection would make a cycle.
+// @int src Source node id
+// @int dst Destination node id
+// @int[opt] port Destination port, for mixers (default 1)
+// @function Graph:connect
+// @treturn bool False if already connected
+static int graph_connect (lua_State* L) {
+    auto* impl = graph_checkunlocked (L);
+    const int src  = graph_checknode (L, impl, 2);
+    const int dst  = graph_checknode (L, impl, 3);
+    const int port = static_cast<int> (luaL_optinteger (L, 4, 1));
+    luaL_argcheck (L, src != Impl::outputid, 2, "output can't be a source");
+    luaL_argcheck (L, dst != Impl::inputid, 3, "input can't be a destination");
+    luaL_argcheck (L, port >= 1 && port <= impl->find (dst)->ports, 4, "port out of range");
+    if (impl->upstream (dst, src))
+        return luaL_error (L, "connection would make a cycle");
+    lua_pushboolean (L, impl->connect (src, dst, port - 1));
+    return 1;
+}
+
+/// Disconnect audio between nodes.
+// @int src Source node id
+// @int dst Destination node id
+// @int[opt] port Destination port, all ports if not given
+// @function Graph:disconnect
+// @treturn bool True if anything was disconnected
+static int graph_disconnect (lua_State* L) {
+    auto* impl = graph_checkunlocked (L);
+    const int src  = graph_checknode (L, impl, 2);
+    const int dst  = graph_checknode (L, impl, 3);
+    const int port = static_cast<int> (luaL_optinteger (L, 4, 0)) - 1;
+    lua_pushboolean (L, impl->disconnect (src, dst, port));
+    return 1;
+}
+
+/// Connect MIDI between nodes.
+// Only the input, output and "lua" nodes carry MIDI.
+// @int src Source node id
+// @int dst Destination node id
+// @function Graph:connectmidi
+// @treturn bool False if already connected
+static int graph_connectmidi (lua_State* L) {
+    auto* impl = graph_checkunlocked (L);
+    const int src = graph_checknode (L, impl, 2);
+    const int dst = graph_checknode (L, impl, 3);
+    luaL_argcheck (L, src != Impl::outputid && impl->find (src)->midi != nullptr, 2, "not a MIDI source");
+    luaL_argcheck (L, dst != Impl::inputid && impl->find (dst)->midi != nullptr, 3, "not a MIDI destination");
+    if (impl->upstream (dst, src))
+        return luaL_error (L, "connection would make a cycle");
+    lua_pushboolean (L, impl->connectmidi (src, dst));
+    return 1;
+}
+
+/// Disconnect MIDI between nodes.
+// @int src Source node id
+// @int dst Destination node id
+// @function Graph:disconnectmidi
+// @treturn bool True if disconnected
+static int graph_disconnectmidi (lua_State* L) {
+    auto* impl = graph_checkunlocked (L);
+    const int src = graph_checknode (L, impl, 2);
+    const int dst = graph_checknode (L, impl, 3);
+    lua_pushboolean (L, impl->disconnectmidi (src, dst));
+    return 1;
+}
+
+/// Set a node parameter.
+// Changes made by a "lua" node apply after the block, so output doesn't
+// depend on the number of threads.
+// @int node Node id
+// @string name Parameter name
+// @number value New value
+// @function Graph:set
+static int graph_set (lua_State* L) {
+    auto* impl = (Impl*) lua_touserdata (L, 1);
+    auto* node = impl->find (graph_checknode (L, impl, 2));
+    const char* name = luaL_checkstring (L, 3);
+    if (! impl->setparam (node, name, luaL_checknumber (L, 4))) {
+        double value = 0.0;
+        if (impl->isrendering() && node->get (name, value))
+            return luaL_error (L, "too many parameter changes while rendering");
+        return luaL_error (L, "%s nodes have no parameter '%s'", node_kinds[node->kind], name);
+    }
+    return 0;
+}
+
+/// Get a node parameter.
+// Returns the target of a parameter that is still ramping.
+// @int node Node id
+// @string name Parameter name
+// @function Graph:get
+// @treturn number The value
+static int graph_get (lua_State* L) {
+    auto* impl = (Impl*) lua_touserdata (L, 1);
+    auto* node = impl->find (graph_checknode (L, impl, 2));
+    const char* name = luaL_checkstring (L, 3);
+    double value = 0.0;
+    if (! node->get (name, value))
+        return luaL_error (L, "%s nodes have no parameter '%s'", node_kinds[node->kind], name);
+    lua_pushnumber (L, value);
+    return 1;
+}
+
+/// Sort nodes and assign buffers.
+// Called by process when the topology has changed. Allocates, so call it
+// ahead of processing after changing connections.
+// @function Graph:prepare
+static int graph_prepare (lua_State* L) {
+    auto* impl = (Impl*) lua_touserdata (L, 1);
+    if (impl->isrendering())
+        return luaL_error (L, "can't prepare the graph while it is rendering");
+    impl->prepare();
+    return 0;
+}
+
+/// Render a block in place.
+// The buffer must have at least as many channels as the graph and at most
+// `blocksize` frames. MIDI in the buffer is fed to the input node and
+// replaced with MIDI reaching the output node.
+// @tparam kv.AudioBuffer audio Audio in and out
+// @tparam[opt] kv.MidiBuffer midi MIDI in and out
+// @function Graph:process
+static int graph_process (lua_State* L) {
+    auto* impl = (Impl*) lua_touserdata (L, 1);
+    kv::lua::MidiBufferImpl* midi = nullptr;
+    if (! lua_isnoneornil (L, 3)) {
+        auto** mb = (kv::lua::MidiBufferImpl**) luaL_checkudata (L, 3, LKV_MT_MIDI_BUFFER);
+        luaL_argcheck (L, *mb != nullptr, 3, "MIDI buffer was freed");
+        midi = *mb;
+    }
+
+    if (impl->isrendering())
+        return luaL_error (L, "graph is already rendering");
+    graph_checkprepare (L, impl);
+
+    lua_settop (L, 3);
+    lua_getuservalue (L, 1);
+    bool ok = true;
+    kv::lua::with_audio_buffer (L, 2, [&](auto& audio) {
+        luaL_argcheck (L, audio.getNumChannels() >= impl->channels, 2, "not enough channels");
+        luaL_argcheck (L, audio.getNumSamples() <= impl->maxframes, 2, "too many frames");
+        ok = impl->process (L, 4, audio, audio.getNumSamples(), midi);
+    });
+
+    if (! ok)
+        return lua_error (L);
+    return 0;
+}
+
+/// Clear the state of every node.
+// @function Graph:reset
+static int graph_reset (lua_State* L) {
+    graph_checkunlocked (L)->reset();
+    return 0;
+}
+
+/// Input node id.
+// @function Graph:input
+// @treturn int
+static int graph_input (lua_State* L) {
+    lua_pushinteger (L, Impl::inputid);
+    return 1;
+}
+
+/// Output node id.
+// @function Graph:output
+// @treturn int
+static int graph_output (lua_State* L) {
+    lua_pushinteger (L, Impl::outputid);
+    return 1;
+}
+
+/// Render order.
+// Prepares the graph if needed.
+// @function Graph:order
+// @treturn table Node ids in the order they run
+static int graph_order (lua_State* L) {
+    auto* impl = (Impl*) lua_touserdata (L, 1);
+    graph_checkprepare (L, impl);
+    const auto ids = impl->renderorder();
+    lua_createtable (L, (int) ids.size(), 0);
+    for (int i = 0; i < (int) ids.size(); ++i) {
+        lua_pushinteger (L, ids[i]);
+        lua_rawseti (L, -2, i + 1);
+    }
+    return 1;
+}
+
+/// Number of pooled channel buffers.
+// Prepares the graph if needed.
+// @function Graph:buffers
+// @treturn int
+static int graph_buffers (lua_State* L) {
+    auto* impl = (Impl*) lua_touserdata (L, 1);
+    graph_checkprepare (L, impl);
+    lua_pushinteger (L, impl->buffers());
+    return 1;
+}
+
+/// Set the number of worker threads.
+// Independent branches of the graph then render in parallel, with the
+// calling thread rendering too. Zero renders everything on the calling
+// thread. Output is the same for any number of threads. "lua" nodes always
+// run on the calling thread. Starts threads, so don't call it while
+// processing audio.
+// @int count Number of workers (default 0)
+// @function Graph:threads
+
+/// Get the number of worker threads.
+// @function Graph:threads
+// @treturn int
+static int graph_threads (lua_State* L) {
+    auto* impl = (Impl*) lua_touserdata (L, 1);
+    if (lua_gettop (L) >= 2) {
+        const auto count = static_cast<int> (luaL_checkinteger (L, 2));
+        luaL_argcheck (L, count >= 0 && count <= 64, 2, "threads must be from 0 to 64");
+        if (impl->isrendering())
+            return luaL_error (L, "can't change threads while rendering");
+        impl->setthreads (count);
+        return 0;
+    }
+    lua_pushinteger (L, impl->threads());
+    return 1;
+}
+
+/// Wall clock time of the last process call.
+// @function Graph:rendertime
+// @treturn number Milliseconds
+static int graph_rendertime (lua_State* L) {
+    lua_pushnumber (L, ((Impl*) lua_touserdata (L, 1))->rendertime());
+    return 1;
+}
+
+//==============================================================================
+static const luaL_Reg graph_methods[] = {
+    { "__gc",           graph_gc },
+    { "add",            graph_add },
+    { "remove",         graph_remove },
+    { "connect",        graph_connect },
+    { "disconnect",     graph_disconnect },
+    { "connectmidi",    graph_connectmidi },
+    { "disconnectmidi", graph_disconnectmidi },
+    { "set",            graph_set },
+    { "get",            graph_get },
+    { "prepare",        graph_prepare },
+    { "process",        graph_process },
+    { "reset",          graph_reset },
+    { "input",          graph_input },
+    { "output",         graph_output },
+    { "order",          graph_order },
+    { "buffers",        graph_buffers },
+    { "threads",        graph_threads },
+    { "rendertime",     graph_rendertime },
+    { NULL, NULL }
+};
+
+//==============================================================================
+LKV_EXPORT
+int luaopen_kv_Graph (lua_State* L) {
+    if (luaL_newmetatable (L, LKV_MT_GRAPH)) {
+        lua_pushvalue (L, -1);               /* duplicate the metatable */
+        lua_setfield (L, -2, "__index");     /* mt.__index = mt */
+        luaL_setfuncs (L, graph_methods, 0);
+        lua_pop (L, 1);
+    }
+
+    if (luaL_newmetatable (L, LKV_MT_GRAPH_TYPE)) {
+        lua_pop (L, 1);
+    }
+
+    lua_newtable (L);
+    luaL_setmetatable (L, LKV_MT_GRAPH_TYPE);
+    lua_pushcfunction (L, graph_new);
+    lua_setfield (L, -2, "new");
+    return 1;
+}
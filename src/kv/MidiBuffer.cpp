@@ -7,6 +7,8 @@
 #include "kv/lua/midi_buffer.hpp"
 #include "bytes.h"
 #include "packed.h"
+#include <algorithm>
+#include <limits>
 #define LKV_MT_MIDI_BUFFER_TYPE "kv.MidiBufferClass"
 
 using MidiBuffer    = juce::MidiBuffer;
@@ -20,6 +22,7 @@ using Impl          = kv::lua::MidiBufferImpl;
 // @within Constructors
 
 /// Create a new MIDI Buffer
+// Also reserves as much scratch storage, used by merging.
 // @param size Size in bytes
 // @function MidiBuffer.new
 // @return A new MIDI Buffer
@@ -28,12 +31,38 @@ static int midibuffer_new (lua_State* L) {
     auto** impl = kv::lua::new_midibuffer (L);
     if (lua_gettop (L) > 1) {
         if (lua_isinteger (L, 2)) {
-            (**impl).buffer.ensureSize (static_cast<size_t> (lua_tointeger (L, 2)));
+            (**impl).reserve (static_cast<size_t> (lua_tointeger (L, 2)));
         }
     }
     return 1;
 }
 
+static const char* const overflow_policies[] = { "newest", "oldest", "grow", nullptr };
+
+/// Create a fixed capacity MIDI Buffer.
+// Allocates once here. Adding an event that doesn't fit follows the
+// overflow policy instead of growing the buffer:
+//
+// - `"newest"`: drop the incoming event (default)
+// - `"oldest"`: drop events from the start of the buffer until it fits
+// - `"grow"`: add it anyway, allocating. For finding a good capacity
+//
+// Every event dropped, or added past capacity, is counted in
+// @{MidiBuffer:overflows}. Each event takes its MIDI bytes plus 6.
+// @int size Capacity in bytes
+// @string[opt] policy Overflow policy
+// @function MidiBuffer.fixed
+// @return A new MIDI Buffer
+// @within Constructors
+static int midibuffer_fixed (lua_State* L) {
+    const auto size   = luaL_checkinteger (L, 1);
+    const auto policy = luaL_checkoption (L, 2, "newest", overflow_policies);
+    luaL_argcheck (L, size > 0 && size <= std::numeric_limits<int>::max(), 1, "size must be more than zero");
+    auto** impl = kv::lua::new_midibuffer (L);
+    (**impl).setfixed (static_cast<int> (size), policy);
+    return 1;
+}
+
 static int midibuffer_free (lua_State* L) {
     auto** impl = (Impl**) lua_touserdata (L, 1);
     if (nullptr != *impl) {
@@ -47,7 +76,10 @@ static int midibuffer_free (lua_State* L) {
 static int midibuffer_reserve (lua_State* L) {
     if (auto* impl = *(Impl**) lua_touserdata (L, 1)) {
         auto size = lua_tointeger (L, 2);
-        (*impl).buffer.ensureSize (static_cast<size_t> (size));
+        if ((*impl).capacity > 0 && size > (*impl).capacity)
+            (*impl).setfixed (static_cast<int> (size), (*impl).overflow);
+        else
+            (*impl).reserve (static_cast<size_t> (size));
         lua_pushinteger (L, size);
     } else {
         lua_pushboolean (L, false);
@@ -56,6 +88,31 @@ static int midibuffer_reserve (lua_State* L) {
 }
 
 //==============================================================================
+/** Push a cached closure over the buffer, creating it on first use. Loops
+    reuse it so iterating makes no garbage */
+static void midibuffer_pushclosure (lua_State* L, Impl* impl, int& ref, lua_CFunction fn, int nupvalues) {
+    if (ref == LUA_REFNIL) {
+        lua_pushlightuserdata (L, impl);
+        lua_insert (L, -1 - nupvalues);
+        lua_pushcclosure (L, fn, 1 + nupvalues);
+        ref = luaL_ref (L, LUA_REGISTRYINDEX);
+    } else {
+        lua_pop (L, nupvalues);
+    }
+    lua_rawgeti (L, LUA_REGISTRYINDEX, ref);
+}
+
+/** Push the buffer's view, creating it on first use */
+static kv::lua::MidiView* midibuffer_pushview (lua_State* L, Impl* impl) {
+    if (impl->viewref == LUA_REFNIL) {
+        impl->view = new (lua_newuserdata (L, sizeof (kv::lua::MidiView))) kv::lua::MidiView();
+        luaL_setmetatable (L, LKV_MT_MIDI_VIEW);
+        impl->viewref = luaL_ref (L, LUA_REGISTRYINDEX);
+    }
+    lua_rawgeti (L, LUA_REGISTRYINDEX, impl->viewref);
+    return impl->view;
+}
+
 static int midibuffer_events_closure (lua_State* L) {
     auto* impl = (Impl*) lua_touserdata (L, lua_upvalueindex (1));
     
@@ -76,8 +133,7 @@ static int midibuffer_events_closure (lua_State* L) {
 static int midibuffer_events (lua_State* L) {
     auto* impl = *(Impl**) lua_touserdata (L, 1);
     impl->reset_iter();
-    lua_pushlightuserdata (L, impl);
-    lua_pushcclosure (L, midibuffer_events_closure, 1);
+    midibuffer_pushclosure (L, impl, impl->eventsref, midibuffer_events_closure, 0);
     return 1;
 }
 
@@ -101,25 +157,354 @@ static int midibuffer_messages_closure (lua_State* L) {
 static int midibuffer_messages (lua_State* L) {
     auto* impl = *(Impl**) lua_touserdata (L, 1);
     impl->reset_iter();
-    lua_pushlightuserdata (L, impl);
-    lua_pushcclosure (L, midibuffer_messages_closure, 1);
+    midibuffer_pushclosure (L, impl, impl->messagesref, midibuffer_messages_closure, 0);
+    return 1;
+}
+
+//==============================================================================
+/** Point the view at an event of the buffer */
+static inline void midibuffer_setview (Impl* impl, kv::lua::MidiView* view,
+                                       const juce::MidiMessageMetadata& ref) noexcept
+{
+    *view = { impl, static_cast<int> (ref.data - impl->buffer.data.begin()),
+              ref.numBytes, ref.samplePosition };
+}
+
+static int midibuffer_views_closure (lua_State* L) {
+    auto* impl = (Impl*) lua_touserdata (L, lua_upvalueindex (1));
+    auto* view = (kv::lua::MidiView*) lua_touserdata (L, lua_upvalueindex (2));
+    if (impl->iter == impl->buffer.end()) {
+        *view = {};
+        lua_pushnil (L);
+        return 1;
+    }
+
+    const auto& ref = *impl->iter;
+    midibuffer_setview (impl, view, ref);
+    lua_pushvalue (L, lua_upvalueindex (2));
+    lua_pushinteger (L, ref.samplePosition + 1);
+    ++impl->iter;
+    return 2;
+}
+
+static int midibuffer_views (lua_State* L) {
+    auto* impl = *(Impl**) lua_touserdata (L, 1);
+    impl->iter = impl->buffer.begin();
+    *midibuffer_pushview (L, impl) = {};
+    midibuffer_pushclosure (L, impl, impl->viewsref, midibuffer_views_closure, 1);
+    return 1;
+}
+
+static int midibuffer_foreach (lua_State* L) {
+    auto* impl = *(Impl**) lua_touserdata (L, 1);
+    luaL_checktype (L, 2, LUA_TFUNCTION);
+    lua_settop (L, 2);
+    auto* view = midibuffer_pushview (L, impl);
+    *view = {};
+
+    for (const auto ref : impl->buffer) {
+        midibuffer_setview (impl, view, ref);
+        lua_pushvalue (L, 2);
+        lua_pushvalue (L, 3);
+        lua_pushinteger (L, ref.samplePosition + 1);
+        if (lua_pcall (L, 2, 1, 0) != LUA_OK) {
+            *view = {};
+            return lua_error (L);
+        }
+        const bool stop = lua_type (L, -1) == LUA_TBOOLEAN && ! lua_toboolean (L, -1);
+        lua_pop (L, 1);
+        if (stop)
+            break;
+    }
+
+    *view = {};
+    return 0;
+}
+
+//==============================================================================
+/** Destination of one decoded field: a table, a kv.ByteArray or nothing */
+struct DecodeColumn final {
+    int table { 0 };
+    kv_bytes_t* bytes { nullptr };
+
+    void check (lua_State* L, int arg, bool allowbytes) {
+        if (lua_isnoneornil (L, arg))
+            return;
+        if (lua_istable (L, arg)) {
+            table = arg;
+            return;
+        }
+        bytes = allowbytes ? (kv_bytes_t*) luaL_testudata (L, arg, LKV_MT_BYTE_ARRAY) : nullptr;
+        luaL_argcheck (L, bytes != nullptr, arg, allowbytes ? "expected table or kv.ByteArray" : "expected table");
+    }
+
+    /** Most events this column holds */
+    lua_Integer limit() const noexcept {
+        return bytes != nullptr ? static_cast<lua_Integer> (bytes->size)
+                                : std::numeric_limits<lua_Integer>::max();
+    }
+
+    void set (lua_State* L, lua_Integer index, lua_Integer value) const {
+        if (table != 0) {
+            lua_pushinteger (L, value);
+            lua_rawseti (L, table, index + 1);
+        } else if (bytes != nullptr) {
+            bytes->data[index] = static_cast<uint8_t> (value);
+        }
+    }
+};
+
+static int midibuffer_decode (lua_State* L) {
+    auto* impl = *(Impl**) lua_touserdata (L, 1);
+    DecodeColumn frames, status, data1, data2;
+    frames.check (L, 2, false);
+    status.check (L, 3, true);
+    data1.check (L, 4, true);
+    data2.check (L, 5, true);
+    const auto limit = std::min ({ frames.limit(), status.limit(), data1.limit(), data2.limit() });
+
+    auto* buffer = reinterpret_cast<kv_midi_buffer_t*> (impl);
+    const auto end = kv_midi_buffer_end (buffer);
+    lua_Integer count = 0;
+    for (auto iter = kv_midi_buffer_begin (buffer); iter != end && count < limit;
+         iter = kv_midi_buffer_next (buffer, iter))
+    {
+        const auto size = kv_midi_buffer_iter_size ((uint8_t*) iter);
+        const uint8_t* data = kv_midi_buffer_iter_data ((uint8_t*) iter);
+        frames.set (L, count, kv_midi_buffer_iter_frame ((uint8_t*) iter) + 1);
+        status.set (L, count, size > 0 ? data[0] : 0);
+        data1.set (L, count, size > 1 ? data[1] : 0);
+        data2.set (L, count, size > 2 ? data[2] : 0);
+        ++count;
+    }
+
+    lua_pushinteger (L, count);
+    return 1;
+}
+
+//==============================================================================
+/** kv.MidiView, one event of a buffer handed out by views() and foreach().
+    Reads the bytes in place, so it is only valid during the loop step that
+    produced it. Each use checks the event is still where the view left it,
+    so a view kept past its loop raises an error instead of reading freed or
+    moved memory */
+
+using MidiView = kv::lua::MidiView;
+
+/** The event a view points at, resolved against its buffer */
+struct MidiViewEvent {
+    const juce::uint8*  data;
+    int                 size;
+    int                 frame;
+};
+
+static MidiViewEvent midiview_check (lua_State* L) {
+    const auto* view = (MidiView*) lua_touserdata (L, 1);
+    if (view->owner == nullptr)
+        luaL_error (L, "MIDI view used outside of its loop");
+
+    constexpr int header = static_cast<int> (sizeof (juce::int32) + sizeof (juce::uint16));
+    const auto& bytes = view->owner->buffer.data;
+    juce::int32 frame = -1;
+    juce::uint16 size = 0;
+    if (view->offset >= header && view->offset + view->size <= bytes.size()) {
+        const auto* event = bytes.begin() + view->offset - header;
+        std::memcpy (&frame, event, sizeof (frame));
+        std::memcpy (&size, event + sizeof (frame), sizeof (size));
+    }
+    if (frame != view->frame || static_cast<int> (size) != view->size)
+        luaL_error (L, "MIDI view's buffer changed since it was handed out");
+
+    return { bytes.begin() + view->offset, view->size, view->frame };
+}
+
+static inline int midiview_byte (const MidiViewEvent& view, int index) noexcept {
+    return index < view.size ? static_cast<int> (view.data[index]) : 0;
+}
+
+static inline bool midiview_ischannel (const MidiViewEvent& view) noexcept {
+    return view.size > 0 && view.data[0] >= 0x80 && view.data[0] < 0xf0;
+}
+
+/// Number of bytes.
+// @function MidiView:size
+// @treturn int
+static int midiview_size (lua_State* L) {
+    lua_pushinteger (L, midiview_check (L).size);
+    return 1;
+}
+
+/// Audio frame of the event.
+// @function MidiView:frame
+// @treturn int Frame index, starting at 1
+static int midiview_frame (lua_State* L) {
+    lua_pushinteger (L, midiview_check (L).frame + 1);
+    return 1;
+}
+
+/// Get one byte.
+// @int index Byte index, starting at 1
+// @function MidiView:byte
+// @treturn int The byte or 0 if out of range
+static int midiview_getbyte (lua_State* L) {
+    const auto& view = midiview_check (L);
+    const auto index = static_cast<int> (luaL_checkinteger (L, 2)) - 1;
+    lua_pushinteger (L, index >= 0 ? midiview_byte (view, index) : 0);
+    return 1;
+}
+
+/// Get every byte.
+// @function MidiView:bytes
+// @treturn int... The bytes
+static int midiview_bytes (lua_State* L) {
+    const auto& view = midiview_check (L);
+    luaL_checkstack (L, view.size, "too many bytes");
+    for (int i = 0; i < view.size; ++i)
+        lua_pushinteger (L, view.data[i]);
+    return view.size;
+}
+
+/// Event packed into an integer.
+// Same layout as @{kv.midi}. Only the first four bytes are packed.
+// @function MidiView:packed
+// @treturn int
+static int midiview_packed (lua_State* L) {
+    const auto& view = midiview_check (L);
+    kv_packed_t pack;
+    pack.packed = 0;
+    for (int i = 0; i < 4 && i < view.size; ++i)
+        pack.data[i] = view.data[i];
+    lua_pushinteger (L, pack.packed);
+    return 1;
+}
+
+/// Status byte.
+// @function MidiView:status
+// @treturn int
+static int midiview_status (lua_State* L) {
+    lua_pushinteger (L, midiview_byte (midiview_check (L), 0));
+    return 1;
+}
+
+/// MIDI channel.
+// @function MidiView:channel
+// @treturn int Channel 1 to 16, or 0 for system messages
+static int midiview_channel (lua_State* L) {
+    const auto& view = midiview_check (L);
+    lua_pushinteger (L, midiview_ischannel (view) ? (view.data[0] & 0x0f) + 1 : 0);
+    return 1;
+}
+
+/// True if a note on with a velocity.
+// @function MidiView:isnoteon
+// @treturn bool
+static int midiview_isnoteon (lua_State* L) {
+    const auto& view = midiview_check (L);
+    lua_pushboolean (L, view.size >= 3 && (view.data[0] & 0xf0) == 0x90 && view.data[2] > 0);
+    return 1;
+}
+
+/// True if a note off, or a note on with zero velocity.
+// @function MidiView:isnoteoff
+// @treturn bool
+static int midiview_isnoteoff (lua_State* L) {
+    const auto& view = midiview_check (L);
+    const auto type = view.size >= 3 ? view.data[0] & 0xf0 : 0;
+    lua_pushboolean (L, type == 0x80 || (type == 0x90 && view.data[2] == 0));
+    return 1;
+}
+
+/// True if a controller.
+// @function MidiView:iscontroller
+// @treturn bool
+static int midiview_iscontroller (lua_State* L) {
+    const auto& view = midiview_check (L);
+    lua_pushboolean (L, view.size >= 3 && (view.data[0] & 0xf0) == 0xb0);
+    return 1;
+}
+
+/// True if SysEx.
+// @function MidiView:issysex
+// @treturn bool
+static int midiview_issysex (lua_State* L) {
+    const auto& view = midiview_check (L);
+    lua_pushboolean (L, view.size > 0 && view.data[0] == 0xf0);
+    return 1;
+}
+
+/// Second byte, the note of note messages and the controller number of
+// controllers.
+// @function MidiView:data1
+// @treturn int
+
+/// Note number.
+// Same as @{MidiView:data1}.
+// @function MidiView:note
+// @treturn int
+
+/// Controller number.
+// Same as @{MidiView:data1}.
+// @function MidiView:controller
+// @treturn int
+static int midiview_data1 (lua_State* L) {
+    lua_pushinteger (L, midiview_byte (midiview_check (L), 1));
+    return 1;
+}
+
+/// Third byte, the velocity of note messages and the value of
+// controllers.
+// @function MidiView:data2
+// @treturn int
+
+/// Note velocity.
+// Same as @{MidiView:data2}.
+// @function MidiView:velocity
+// @treturn int
+
+/// Controller value.
+// Same as @{MidiView:data2}.
+// @function MidiView:value
+// @treturn int
+static int midiview_data2 (lua_State* L) {
+    lua_pushinteger (L, midiview_byte (midiview_check (L), 2));
     return 1;
 }
 
+static const luaL_Reg view_methods[] = {
+    { "size",           midiview_size },
+    { "frame",          midiview_frame },
+    { "byte",           midiview_getbyte },
+    { "bytes",          midiview_bytes },
+    { "packed",         midiview_packed },
+    { "status",         midiview_status },
+    { "channel",        midiview_channel },
+    { "isnoteon",       midiview_isnoteon },
+    { "isnoteoff",      midiview_isnoteoff },
+    { "iscontroller",   midiview_iscontroller },
+    { "issysex",        midiview_issysex },
+    { "data1",          midiview_data1 },
+    { "note",           midiview_data1 },
+    { "controller",     midiview_data1 },
+    { "data2",          midiview_data2 },
+    { "velocity",       midiview_data2 },
+    { "value",          midiview_data2 },
+    { NULL, NULL }
+};
+
 //==============================================================================
 static int midibuffer_addmessage (lua_State* L) {
     auto* impl = *(Impl**) lua_touserdata (L, 1);
-    impl->buffer.addEvent (
-        **(MidiMessage**) lua_touserdata (L, 2), 
-        static_cast<int> (lua_tointeger (L, 3) + 1));
+    const auto& msg = **(MidiMessage**) lua_touserdata (L, 2);
+    impl->add (msg.getRawData(), msg.getRawDataSize(),
+               static_cast<int> (lua_tointeger (L, 3) + 1));
     return 0;
 }
 
 static int midibuffer_addevent (lua_State* L) {
     auto* impl = *(Impl**) lua_touserdata (L, 1);
-    impl->buffer.addEvent ((juce::uint8*) lua_touserdata (L, 2),
-                            static_cast<int> (lua_tointeger (L, 3)),
-                            static_cast<int> (lua_tointeger (L, 4) - 1));
+    impl->add ((juce::uint8*) lua_touserdata (L, 2),
+               static_cast<int> (lua_tointeger (L, 3)),
+               static_cast<int> (lua_tointeger (L, 4) - 1));
     return 0;
 }
 
@@ -128,6 +513,8 @@ static int midibuffer_swap (lua_State* L) {
         return 0;
     auto* impl = *(Impl**) lua_touserdata (L, 1);
     auto* o    = *(Impl**) lua_touserdata (L, 2);
+    if (! impl->canswap (*o))
+        return luaL_error (L, "can't swap a fixed buffer with a smaller one");
     impl->buffer.swapWith (o->buffer);
     return 0;
 }
@@ -142,8 +529,8 @@ static int midibuffer_clear (lua_State* L) {
         }
 
         case 3: {
-            (*impl).buffer.clear (static_cast<int> (lua_tointeger (L, 2) - 1),
-                                  static_cast<int> (lua_tointeger (L, 3)));
+            (*impl).clear (static_cast<int> (lua_tointeger (L, 2) - 1),
+                           static_cast<int> (lua_tointeger (L, 3)));
             break;
         }
     }
@@ -160,6 +547,20 @@ static int midibuffer_clear_range (lua_State* L) {
 }
 #endif
 
+static int midibuffer_capacity (lua_State* L) {
+    auto* impl = *(Impl**) lua_touserdata (L, 1);
+    lua_pushinteger (L, impl->capacity);
+    return 1;
+}
+
+static int midibuffer_overflows (lua_State* L) {
+    auto* impl = *(Impl**) lua_touserdata (L, 1);
+    if (lua_gettop (L) >= 2)
+        impl->overflows = luaL_checkinteger (L, 2);
+    lua_pushinteger (L, impl->overflows);
+    return 1;
+}
+
 static int midibuffer_size (lua_State* L) {
     auto* impl = *(Impl**) lua_touserdata (L, 1);
     lua_pushinteger (L, (*impl).buffer.getNumEvents());
@@ -169,7 +570,7 @@ static int midibuffer_size (lua_State* L) {
 static int midibuffer_addbuffer (lua_State* L) {
     auto* impl = *(Impl**) lua_touserdata (L, 1);
     if (lua_gettop (L) >= 5) {
-        impl->buffer.addEvents (
+        impl->add (
             **(MidiBuffer**) lua_touserdata (L, 2),
             static_cast<int> (lua_tointeger (L, 3) - 1),
             static_cast<int> (lua_tointeger (L, 4)),
@@ -185,7 +586,7 @@ static int midibuffer_insertbytes (lua_State* L) {
     auto* b = (kv_bytes_t*) lua_touserdata (L, 2);
     auto  n = static_cast<int> (lua_tointeger (L, 3));
     auto  f = static_cast<int> (lua_tointeger (L, 4)) - 1;
-    impl->buffer.addEvent (b->data, n, f);
+    impl->add (b->data, n, f);
     return 0;
 }
 
@@ -194,11 +595,88 @@ static int midibuffer_insert (lua_State* L) {
     kv_packed_t pack;
     pack.packed = lua_tointeger (L, 2);
 
-    impl->buffer.addEvent ((uint8_t*) pack.data, 4,
-                           static_cast<int> (lua_tointeger (L, 3) - 1));
+    impl->add ((uint8_t*) pack.data, 4,
+               static_cast<int> (lua_tointeger (L, 3) - 1));
     return 0;
 }
 
+static int midibuffer_insertmany (lua_State* L) {
+    auto* impl = *(Impl**) lua_touserdata (L, 1);
+    luaL_checktype (L, 2, LUA_TTABLE);
+    luaL_checktype (L, 3, LUA_TTABLE);
+    const auto ndata   = static_cast<lua_Integer> (lua_rawlen (L, 2));
+    const auto nframes = static_cast<lua_Integer> (lua_rawlen (L, 3));
+    const auto count   = lua_isnoneornil (L, 4) ? ndata : luaL_checkinteger (L, 4);
+    luaL_argcheck (L, count >= 0 && count <= ndata, lua_isnoneornil (L, 4) ? 2 : 4,
+                   "count out of range");
+    luaL_argcheck (L, count <= nframes, 3, "fewer frames than messages");
+    lua_Integer added = 0;
+    for (lua_Integer i = 1; i <= count; ++i) {
+        lua_rawgeti (L, 2, i);
+        lua_rawgeti (L, 3, i);
+        kv_packed_t pack;
+        pack.packed = lua_tointeger (L, -2);
+        if (impl->add ((uint8_t*) pack.data, 4, static_cast<int> (lua_tointeger (L, -1) - 1)))
+            ++added;
+        lua_pop (L, 2);
+    }
+    lua_pushinteger (L, added);
+    return 1;
+}
+
+/// Merge many buffers into one.
+// A single pass k-way merge of every source, in time order, into `dest`.
+// Events already in `dest` are kept. Events on the same frame keep the
+// order of the sources, after those already in `dest`. The destination
+// is sized once up front, a fixed buffer follows its overflow policy
+// instead. Sources are left untouched and `dest` is skipped if listed.
+// Merging uses twice the destination's memory: its events are read from
+// scratch storage that `MidiBuffer.new (size)` and `reserve` set aside
+// along with the buffer.
+// @tparam kv.MidiBuffer dest Buffer to merge into
+// @tab sources Buffers to merge
+// @tab[opt] offsets Frames added to each source's events (default 0)
+// @function MidiBuffer.merge
+// @treturn int Number of events in `dest`
+// @usage
+// MidiBuffer.merge (out, { port1, port2, port3 })
+static int midibuffer_merge (lua_State* L) {
+    auto** impl = (Impl**) luaL_checkudata (L, 1, LKV_MT_MIDI_BUFFER);
+    luaL_argcheck (L, *impl != nullptr, 1, "MIDI buffer was freed");
+    luaL_checktype (L, 2, LUA_TTABLE);
+    const bool hasoffsets = ! lua_isnoneornil (L, 3);
+    if (hasoffsets)
+        luaL_checktype (L, 3, LUA_TTABLE);
+
+    // check everything first, an error while merging would lose events
+    const auto count = static_cast<int> (lua_rawlen (L, 2));
+    for (int i = 1; i <= count; ++i) {
+        lua_rawgeti (L, 2, i);
+        auto** src = (Impl**) luaL_testudata (L, -1, LKV_MT_MIDI_BUFFER);
+        if (src == nullptr || *src == nullptr)
+            return luaL_error (L, "source %d is not a MIDI buffer", i);
+        lua_pop (L, 1);
+        if (hasoffsets && lua_rawgeti (L, 3, i) != LUA_TNIL && ! lua_isinteger (L, -1))
+            return luaL_error (L, "offset %d is not an integer", i);
+        if (hasoffsets)
+            lua_pop (L, 1);
+    }
+
+    lua_pushinteger (L, (*impl)->merge (count, [L, hasoffsets] (int i) {
+        lua_rawgeti (L, 2, i + 1);
+        const auto* src = *(Impl**) lua_touserdata (L, -1);
+        lua_pop (L, 1);
+        int offset = 0;
+        if (hasoffsets) {
+            lua_rawgeti (L, 3, i + 1);
+            offset = static_cast<int> (lua_tointeger (L, -1));
+            lua_pop (L, 1);
+        }
+        return std::make_pair (&src->buffer, offset);
+    }));
+    return 1;
+}
+
 //==============================================================================
 
 /// Methods.
@@ -224,7 +702,26 @@ static const luaL_Reg buffer_methods[] = {
     // @function MidiBuffer:size
     { "size",               midibuffer_size },
 
+    /// Fixed capacity in bytes.
+    // @function MidiBuffer:capacity
+    // @treturn int Capacity, or 0 if the buffer grows as needed
+    { "capacity",           midibuffer_capacity },
+
+    /// Number of overflowed events.
+    // Counts events a fixed buffer dropped, or added past capacity with
+    // the `"grow"` policy.
+    // @function MidiBuffer:overflows
+    // @treturn int
+
+    /// Set the overflow count.
+    // @int count New count, usually 0
+    // @function MidiBuffer:overflows
+    // @treturn int
+    { "overflows",          midibuffer_overflows },
+
     /// Reserve an amount of space.
+    // Raises the capacity of a fixed buffer. Scratch storage used by
+    // merging is reserved to the same size.
     // @param size Size in bytes to reserve
     // @function MidiBuffer:reserve
     // @return Size reserved in bytes or false
@@ -233,16 +730,32 @@ static const luaL_Reg buffer_methods[] = {
     /// Exchanges the contents of this buffer with another one.
     // This is a quick operation, because no memory allocating or copying is done, it
     // just swaps the internal state of the two buffers.
+    // A fixed buffer can only swap with one whose storage is at least its
+    // capacity.
     // @function MidiBuffer:swap
     // @tparam kv.MidiBuffer other Buffer to swap with
     { "swap",               midibuffer_swap },
 
     /// Insert some MIDI in the buffer.
+    // Events at or after the last frame in the buffer are written straight
+    // to the end, so inserting in time order costs the same however full
+    // the buffer is. Earlier frames are sorted in.
     // @function MidiBuffer:insert
     // @int data Packed integer data
     // @int frame Sample index to insert at
     { "insert",             midibuffer_insert },
 
+    /// Insert many packed messages.
+    // Same as calling @{MidiBuffer:insert} for each pair, in one call.
+    // @function MidiBuffer:insertmany
+    // @tab data Packed integer messages
+    // @tab frames Frame of each message, starting at 1
+    // @int[opt] count Number to insert, at most the length of both tables
+    // (default #data)
+    // @treturn int Number inserted, less than count if a fixed buffer
+    // dropped some
+    { "insertmany",         midibuffer_insertmany },
+
     /// Insert some bytes into the buffer.
     // The kv.ByteArray passed in should contain a complete MIDI message
     // of any type.
@@ -253,7 +766,8 @@ static const luaL_Reg buffer_methods[] = {
     { "addbytes",        midibuffer_insertbytes },
 
     /// Iterate over MIDI data.
-    // Iterate over midi data in this buffer
+    // Iterate over midi data in this buffer. The iterator is created once
+    // per buffer and reused.
     // @function MidiBuffer:events
     // @return Event data iterator
     // @usage
@@ -272,8 +786,52 @@ static const luaL_Reg buffer_methods[] = {
     // @int frame Insert index
     { "addevent",           midibuffer_addevent },
 
+    /// Iterate over views of the events.
+    // Makes no garbage: the iterator and the view are created once per
+    // buffer and reused. The view points into the buffer, so it is only
+    // valid until the next step of the loop or a change to the buffer.
+    // @function MidiBuffer:views
+    // @return view iterator
+    // @usage
+    // -- @view    A kv.MidiView
+    // -- @frame   Audio frame index in buffer
+    // for view, frame in buffer:views() do
+    //     if view:isnoteon() then print (view:note()) end
+    // end
+    { "views",              midibuffer_views },
+
+    /// Call a function for every event.
+    // The loop runs in C with the same reused view as @{MidiBuffer:views}.
+    // Return false from the function to stop early. Don't change the
+    // buffer from inside it.
+    // @function MidiBuffer:foreach
+    // @func fn Called as `fn (view, frame)`
+    { "foreach",            midibuffer_foreach },
+
+    /// Decode every event into arrays.
+    // Fills one array per field in a single call, so scanning a block
+    // needs no iterator steps or message objects. Pass nil to skip a
+    // field. A kv.ByteArray limits the count to its size. Entries past the
+    // returned count are left as they were, so reusing sized tables
+    // doesn't allocate.
+    // @function MidiBuffer:decode
+    // @tab frames Frame of each event, starting at 1
+    // @tparam table|kv.ByteArray status Status bytes
+    // @tparam table|kv.ByteArray data1 Second bytes, 0 if none
+    // @tparam table|kv.ByteArray data2 Third bytes, 0 if none
+    // @treturn int Number of events decoded
+    // @usage
+    // local frames, status, data1, data2 = {}, {}, {}, {}
+    // local n = buffer:decode (frames, status, data1, data2)
+    // for i = 1, n do
+    //     if status[i] & 0xf0 == 0xb0 then cc[data1[i]] = data2[i] end
+    // end
+    { "decode",             midibuffer_decode },
+
     /// Iterate over MIDI Messages.  
-    // Iterate over messages (kv.MidiMessage) in the buffer
+    // Iterate over messages (kv.MidiMessage) in the buffer. Each event is
+    // copied into one reused message, which allocates for large SysEx.
+    // Prefer @{MidiBuffer:views} in realtime code.
     // @function MidiBuffer:messages
     // @return message iterator
     // @usage
@@ -290,6 +848,14 @@ static const luaL_Reg buffer_methods[] = {
     // @int frame Insert index
     { "addmessage",        midibuffer_addmessage },
 
+    /// Merge buffers into this one.
+    // Same as @{MidiBuffer.merge} with this buffer as the destination.
+    // @function MidiBuffer:merge
+    // @tab sources Buffers to merge
+    // @tab[opt] offsets Frames added to each source's events
+    // @treturn int Number of events in this buffer
+    { "merge",              midibuffer_merge },
+
     /// Add messages from another buffer.
     // @function MidiBuffer:addbuffer
     // @tparam kv.MidiBuffer buf Buffer to copy from
@@ -298,6 +864,50 @@ static const luaL_Reg buffer_methods[] = {
     { NULL, NULL }
 };
 
+//==============================================================================
+static Impl* to_impl (kv_midi_buffer_t* buf) noexcept {
+    return reinterpret_cast<Impl*> (buf);
+}
+
+kv_midi_buffer_t* kv_midi_buffer_new (lua_State* L, size_t size) {
+    auto** impl = kv::lua::new_midibuffer (L);
+    if (size > 0)
+        (**impl).reserve (size);
+    return reinterpret_cast<kv_midi_buffer_t*> (*impl);
+}
+
+size_t kv_midi_buffer_capacity (kv_midi_buffer_t* buf) {
+    return static_cast<size_t> (to_impl (buf)->buffer.data.getNumAllocated());
+}
+
+int kv_midi_buffer_swap (kv_midi_buffer_t* a, kv_midi_buffer_t* b) {
+    if (! to_impl (a)->canswap (*to_impl (b)))
+        return 0;
+    to_impl (a)->buffer.swapWith (to_impl (b)->buffer);
+    return 1;
+}
+
+void kv_midi_buffer_clear (kv_midi_buffer_t* buf) {
+    to_impl (buf)->buffer.clear();
+}
+
+void kv_midi_buffer_insert (kv_midi_buffer_t* buf, const uint8_t* bytes, size_t len, int frame) {
+    to_impl (buf)->add (bytes, static_cast<int> (len), frame);
+}
+
+kv_midi_buffer_iter_t kv_midi_buffer_begin (kv_midi_buffer_t* buf) {
+    return to_impl (buf)->buffer.data.getRawDataPointer();
+}
+
+kv_midi_buffer_iter_t kv_midi_buffer_end (kv_midi_buffer_t* buf) {
+    auto& data = to_impl (buf)->buffer.data;
+    return data.getRawDataPointer() + data.size();
+}
+
+kv_midi_buffer_iter_t kv_midi_buffer_next (kv_midi_buffer_t*, kv_midi_buffer_iter_t iter) {
+    return (uint8_t*) iter + kv_midi_buffer_iter_total_size ((uint8_t*) iter);
+}
+
 //==============================================================================
 LKV_EXPORT
 int luaopen_kv_MidiBuffer (lua_State* L) {
@@ -308,6 +918,13 @@ int luaopen_kv_MidiBuffer (lua_State* L) {
         lua_pop (L, 1);
     }
 
+    if (luaL_newmetatable (L, LKV_MT_MIDI_VIEW)) {
+        lua_pushvalue (L, -1);               /* duplicate the metatable */
+        lua_setfield (L, -2, "__index");     /* mt.__index = mt */
+        luaL_setfuncs (L, view_methods, 0);
+        lua_pop (L, 1);
+    }
+
     if (luaL_newmetatable (L, LKV_MT_MIDI_BUFFER_TYPE)) {
         lua_pop (L, 1);
     }
@@ -316,5 +933,9 @@ int luaopen_kv_MidiBuffer (lua_State* L) {
     luaL_setmetatable (L, LKV_MT_MIDI_BUFFER_TYPE);
     lua_pushcfunction (L, midibuffer_new);
     lua_setfield (L, -2, "new");
+    lua_pushcfunction (L, midibuffer_fixed);
+    lua_setfield (L, -2, "fixed");
+    lua_pushcfunction (L, midibuffer_merge);
+    lua_setfield (L, -2, "merge");
     return 1;
 }
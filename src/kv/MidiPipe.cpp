@@ -0,0 +1,293 @@
+/// A bank of preallocated MIDI buffers.
+// Holds any number of @{kv.MidiBuffer}s created up front, for routing many
+// MIDI ports per block without creating buffers. `get` returns the same
+// buffer object every call. Resizing within the reserved count never
+// allocates.
+// @classmod kv.MidiPipe
+// @pragma nostrip
+// @usage
+// local pipe = MidiPipe.new (16, 16, 2048)
+// function process (audio, midi)
+//     pipe:clear()
+//     pipe:split (midi)          -- channel 1 to buffer 1 and so on
+//     -- process pipe:get (1) .. pipe:get (16)
+//     midi:clear()
+//     pipe:merge (midi)
+// end
+
+#include "kv/lua/midi_buffer.hpp"
+#include <algorithm>
+#include <vector>
+
+#define LKV_MT_MIDI_PIPE_TYPE   "kv.MidiPipeClass"
+
+using kv::lua::MidiBufferImpl;
+
+/** Userdata of kv.MidiPipe. Buffers are kv.MidiBuffer userdata kept alive
+    with registry references */
+struct kv_midi_pipe_impl_t final {
+    /** Every reserved buffer, the first `used` are in the pipe */
+    std::vector<MidiBufferImpl*> buffers;
+    std::vector<int> refs;
+    int used { 0 };
+    /** Bytes reserved in each new buffer */
+    size_t bytes { 0 };
+};
+
+using Impl = kv_midi_pipe_t;
+
+LKV_EXPORT int luaopen_kv_MidiPipe (lua_State* L);
+
+static void midipipe_reserve (lua_State* L, Impl* pipe, int count) {
+    while ((int) pipe->buffers.size() < count) {
+        auto** buffer = kv::lua::new_midibuffer (L);
+        if (pipe->bytes > 0)
+            (*buffer)->reserve (pipe->bytes);
+        pipe->buffers.push_back (*buffer);
+        pipe->refs.push_back (luaL_ref (L, LUA_REGISTRYINDEX));
+    }
+}
+
+static Impl* midipipe_push (lua_State* L, int nbuffers, int nreserved, size_t bytes) {
+    if (luaL_getmetatable (L, LKV_MT_MIDI_PIPE) == LUA_TNIL) {
+        luaL_requiref (L, LKV_MT_MIDI_PIPE, luaopen_kv_MidiPipe, 0);
+        lua_pop (L, 1);
+    }
+    lua_pop (L, 1);
+
+    auto* pipe = new (lua_newuserdata (L, sizeof (Impl))) Impl();
+    luaL_setmetatable (L, LKV_MT_MIDI_PIPE);
+    pipe->bytes = bytes;
+    pipe->buffers.reserve ((size_t) nreserved);
+    pipe->refs.reserve ((size_t) nreserved);
+    midipipe_reserve (L, pipe, nreserved);
+    pipe->used = nbuffers;
+    return pipe;
+}
+
+//==============================================================================
+kv_midi_pipe_t* kv_midi_pipe_new (lua_State* L, int nbuffers) {
+    return midipipe_push (L, nbuffers, nbuffers, 0);
+}
+
+void kv_midi_pipe_free (lua_State* L, kv_midi_pipe_t* pipe) {
+    for (const auto ref : pipe->refs)
+        luaL_unref (L, LUA_REGISTRYINDEX, ref);
+    pipe->refs.clear();
+    pipe->buffers.clear();
+    pipe->used = 0;
+}
+
+int kv_midi_pipe_size (kv_midi_pipe_t* pipe) {
+    return pipe->used;
+}
+
+void kv_midi_pipe_clear (kv_midi_pipe_t* pipe, int index) {
+    if (index >= 0 && index < pipe->used) {
+        pipe->buffers[index]->buffer.clear();
+        return;
+    }
+
+    for (int i = 0; i < pipe->used; ++i)
+        pipe->buffers[i]->buffer.clear();
+}
+
+void kv_midi_pipe_resize (lua_State* L, kv_midi_pipe_t* pipe, int nbuffers) {
+    midipipe_reserve (L, pipe, nbuffers);
+    for (int i = nbuffers; i < pipe->used; ++i)
+        pipe->buffers[i]->buffer.clear();
+    pipe->used = nbuffers;
+}
+
+kv_midi_buffer_t* kv_midi_pipe_get (kv_midi_pipe_t* pipe, int index) {
+    return index >= 0 && index < pipe->used
+        ? reinterpret_cast<kv_midi_buffer_t*> (pipe->buffers[index])
+        : nullptr;
+}
+
+//==============================================================================
+static int midipipe_checkindex (lua_State* L, Impl* pipe, int arg) {
+    const auto index = static_cast<int> (luaL_checkinteger (L, arg));
+    luaL_argcheck (L, index >= 1 && index <= pipe->used, arg, "buffer index out of range");
+    return index - 1;
+}
+
+/** A pipe index or a kv.MidiBuffer */
+static MidiBufferImpl* midipipe_checkbuffer (lua_State* L, Impl* pipe, int arg, int& index) {
+    index = -1;
+    if (lua_isinteger (L, arg)) {
+        index = midipipe_checkindex (L, pipe, arg);
+        return pipe->buffers[index];
+    }
+
+    auto** mb = (MidiBufferImpl**) luaL_checkudata (L, arg, LKV_MT_MIDI_BUFFER);
+    luaL_argcheck (L, *mb != nullptr, arg, "MIDI buffer was freed");
+    return *mb;
+}
+
+/// Create a new pipe.
+// @int nbuffers Number of buffers
+// @int[opt] reserve Buffers to create up front, so resizing up to this
+// doesn't allocate (default nbuffers)
+// @int[opt] bytes Bytes reserved in each buffer (default 0)
+// @function MidiPipe.new
+// @return A new pipe
+// @within Constructors
+static int midipipe_new (lua_State* L) {
+    const auto nbuffers = (int) luaL_checkinteger (L, 1);
+    const auto nreserve = (int) luaL_optinteger (L, 2, nbuffers);
+    const auto bytes    = (lua_Integer) luaL_optinteger (L, 3, 0);
+    luaL_argcheck (L, nbuffers >= 0, 1, "buffers must be zero or more");
+    luaL_argcheck (L, bytes >= 0, 3, "bytes must be zero or more");
+    midipipe_push (L, nbuffers, juce::jmax (nbuffers, nreserve), (size_t) bytes);
+    return 1;
+}
+
+static int midipipe_gc (lua_State* L) {
+    auto* pipe = (Impl*) lua_touserdata (L, 1);
+    kv_midi_pipe_free (L, pipe);
+    pipe->~Impl();
+    return 0;
+}
+
+/// Get a buffer.
+// Returns the same kv.MidiBuffer every call.
+// @int index Buffer index
+// @function MidiPipe:get
+// @treturn kv.MidiBuffer
+static int midipipe_get (lua_State* L) {
+    auto* pipe = (Impl*) lua_touserdata (L, 1);
+    lua_rawgeti (L, LUA_REGISTRYINDEX, pipe->refs[midipipe_checkindex (L, pipe, 2)]);
+    return 1;
+}
+
+/// Number of buffers.
+// @function MidiPipe:size
+// @treturn int
+static int midipipe_size (lua_State* L) {
+    lua_pushinteger (L, kv_midi_pipe_size ((Impl*) lua_touserdata (L, 1)));
+    return 1;
+}
+
+/// Number of buffers created.
+// Resizing up to this doesn't allocate.
+// @function MidiPipe:reserved
+// @treturn int
+static int midipipe_reserved (lua_State* L) {
+    lua_pushinteger (L, (lua_Integer) ((Impl*) lua_touserdata (L, 1))->buffers.size());
+    return 1;
+}
+
+/// Change the number of buffers.
+// Buffers dropped are cleared. Only allocates when growing past the
+// reserved count.
+// @int nbuffers New number of buffers
+// @function MidiPipe:resize
+static int midipipe_resize (lua_State* L) {
+    auto* pipe = (Impl*) lua_touserdata (L, 1);
+    const auto nbuffers = (int) luaL_checkinteger (L, 2);
+    luaL_argcheck (L, nbuffers >= 0, 2, "buffers must be zero or more");
+    kv_midi_pipe_resize (L, pipe, nbuffers);
+    return 0;
+}
+
+/// Clear every buffer.
+// @function MidiPipe:clear
+
+/// Clear one buffer.
+// @int index Buffer index
+// @function MidiPipe:clear
+static int midipipe_clear (lua_State* L) {
+    auto* pipe = (Impl*) lua_touserdata (L, 1);
+    kv_midi_pipe_clear (pipe, lua_isnoneornil (L, 2) ? -1 : midipipe_checkindex (L, pipe, 2));
+    return 0;
+}
+
+/// Merge buffers into one.
+// A single pass merge, see @{MidiBuffer.merge}. Events are added to the
+// destination in time order. The destination is skipped if also listed
+// as a source.
+// @tparam int|kv.MidiBuffer dst Buffer index or buffer to merge into
+// @int ... Buffer indexes to merge (default every buffer)
+// @function MidiPipe:merge
+static int midipipe_merge (lua_State* L) {
+    auto* pipe = (Impl*) lua_touserdata (L, 1);
+    int dstindex = -1;
+    auto* dst = midipipe_checkbuffer (L, pipe, 2, dstindex);
+
+    const int top = lua_gettop (L);
+    const int count = top > 2 ? top - 2 : pipe->used;
+    for (int i = 3; i <= top; ++i)
+        midipipe_checkindex (L, pipe, i);
+
+    dst->merge (count, [=] (int i) {
+        const int index = top > 2 ? static_cast<int> (lua_tointeger (L, i + 3)) - 1 : i;
+        const auto* src = pipe->buffers[index];
+        return std::make_pair (index != dstindex && src != dst ? &src->buffer : nullptr, 0);
+    });
+    return 0;
+}
+
+/// Split a buffer by MIDI channel.
+// Channel messages on channel N go to buffer `first + N - 1`, so sixteen
+// buffers from `first` must exist. System messages go to all sixteen.
+// @tparam int|kv.MidiBuffer src Buffer index or buffer to split
+// @int[opt] first First of the channel buffers (default 1)
+// @function MidiPipe:split
+static int midipipe_split (lua_State* L) {
+    auto* pipe = (Impl*) lua_touserdata (L, 1);
+    int srcindex = -1;
+    auto* src = midipipe_checkbuffer (L, pipe, 2, srcindex);
+    const auto first = static_cast<int> (luaL_optinteger (L, 3, 1)) - 1;
+    luaL_argcheck (L, first >= 0 && first + 16 <= pipe->used, 3, "not enough buffers for 16 channels");
+
+    auto** channels = pipe->buffers.data() + first;
+    luaL_argcheck (L, std::find (channels, channels + 16, src) == channels + 16, 2,
+                   "source is one of the channel buffers");
+    for (const auto event : src->buffer) {
+        if (event.numBytes <= 0)
+            continue;
+        const auto status = event.data[0];
+        if (status < 0xf0) {
+            channels[status & 0x0f]->add (event.data, event.numBytes, event.samplePosition);
+            continue;
+        }
+        for (int c = 0; c < 16; ++c)
+            channels[c]->add (event.data, event.numBytes, event.samplePosition);
+    }
+    return 0;
+}
+
+//==============================================================================
+static const luaL_Reg midipipe_methods[] = {
+    { "__gc",           midipipe_gc },
+    { "get",            midipipe_get },
+    { "size",           midipipe_size },
+    { "reserved",       midipipe_reserved },
+    { "resize",         midipipe_resize },
+    { "clear",          midipipe_clear },
+    { "merge",          midipipe_merge },
+    { "split",          midipipe_split },
+    { NULL, NULL }
+};
+
+//==============================================================================
+LKV_EXPORT
+int luaopen_kv_MidiPipe (lua_State* L) {
+    if (luaL_newmetatable (L, LKV_MT_MIDI_PIPE)) {
+        lua_pushvalue (L, -1);               /* duplicate the metatable */
+        lua_setfield (L, -2, "__index");     /* mt.__index = mt */
+        luaL_setfuncs (L, midipipe_methods, 0);
+        lua_pop (L, 1);
+    }
+
+    if (luaL_newmetatable (L, LKV_MT_MIDI_PIPE_TYPE)) {
+        lua_pop (L, 1);
+    }
+
+    lua_newtable (L);
+    luaL_setmetatable (L, LKV_MT_MIDI_PIPE_TYPE);
+    lua_pushcfunction (L, midipipe_new);
+    lua_setfield (L, -2, "new");
+    return 1;
+}
@@ -0,0 +1,331 @@
+/// A lock-free MIDI event queue between threads.
+// A fixed capacity queue of timestamped MIDI messages. Any number of
+// threads push packed messages, as made by @{kv.midi.noteon} and friends,
+// and the audio thread drains them into a @{kv.MidiBuffer}. Pushing and
+// draining never lock or allocate.
+//
+// Timestamps are milliseconds on the @{MidiQueue.now} clock. A drain
+// places events from the last block's worth of time before it at the
+// matching frames, so timing between events is kept at the cost of one
+// block of latency. Older events land on the first frame.
+//
+// Name the queue to open it from another Lua state, like a GUI script.
+// @classmod kv.MidiQueue
+// @pragma nostrip
+// @usage
+// -- realtime callback
+// local queue = MidiQueue.new (1024, 48000, 'keyboard')
+// function process (audio, midi)
+//     queue:drain (midi, audio:length())
+// end
+//
+// -- GUI thread with its own Lua state
+// local queue = MidiQueue.open ('keyboard')
+// queue:push (midi.noteon (1, 60, 100))
+
+#include "kv/lua/midi_buffer.hpp"
+#include "kv/lua/shared_object.hpp"
+#include "packed.h"
+#include <atomic>
+#include <cmath>
+#include <memory>
+
+#define LKV_MT_MIDI_QUEUE       "kv.MidiQueue"
+#define LKV_MT_MIDI_QUEUE_TYPE  "kv.MidiQueueClass"
+
+namespace {
+
+/** Bounded multiple producer single consumer queue. Each cell carries a
+    sequence number telling producers and the consumer whose turn it is */
+class MidiQueueImpl final : public kv::lua::SharedObject<MidiQueueImpl> {
+public:
+    struct Event {
+        int64_t packed;
+        double time;
+    };
+
+    MidiQueueImpl (int capacity, double rate)
+        : samplerate (rate)
+    {
+        int size = 1;
+        while (size < capacity)
+            size *= 2;
+        cells.reset (new Cell [static_cast<size_t> (size)]);
+        mask = static_cast<size_t> (size - 1);
+        for (size_t i = 0; i <= mask; ++i)
+            cells[i].sequence.store (i, std::memory_order_relaxed);
+    }
+
+    const double samplerate;
+
+    int capacity() const noexcept { return static_cast<int> (mask + 1); }
+
+    /** Events waiting, approximate while other threads push */
+    int size() const noexcept {
+        const auto first = head.load (std::memory_order_acquire);
+        return static_cast<int> (tail.load (std::memory_order_acquire) - first);
+    }
+
+    /** Queue an event from any thread. False if full */
+    bool push (const Event& event) noexcept {
+        auto pos = tail.load (std::memory_order_relaxed);
+        for (;;) {
+            auto& cell = cells[pos & mask];
+            const auto seq = cell.sequence.load (std::memory_order_acquire);
+            const auto diff = static_cast<intptr_t> (seq) - static_cast<intptr_t> (pos);
+            if (diff == 0) {
+                if (tail.compare_exchange_weak (pos, pos + 1, std::memory_order_relaxed)) {
+                    cell.event = event;
+                    cell.sequence.store (pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = tail.load (std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /** Take the oldest event. Only one thread may pop */
+    bool pop (Event& event) noexcept {
+        const auto pos = head.load (std::memory_order_relaxed);
+        auto& cell = cells[pos & mask];
+        if (cell.sequence.load (std::memory_order_acquire) != pos + 1)
+            return false;
+        event = cell.event;
+        cell.sequence.store (pos + mask + 1, std::memory_order_release);
+        head.store (pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    /** Move every waiting event into a buffer of nframes ending at now.
+        Returns the number of events added */
+    int drain (kv::lua::MidiBufferImpl& buffer, int nframes, double now) noexcept {
+        const double start = now - 1000.0 * nframes / samplerate;
+        int count = 0;
+        Event event;
+        while (pop (event)) {
+            const auto frame = static_cast<int> (std::floor ((event.time - start) * samplerate / 1000.0));
+            kv_packed_t pack;
+            pack.packed = event.packed;
+            if (buffer.add (pack.data, 4, juce::jlimit (0, nframes - 1, frame)))
+                ++count;
+        }
+        return count;
+    }
+
+    /** Drop every waiting event. Consumer only */
+    void clear() noexcept {
+        Event event;
+        while (pop (event)) {}
+    }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        Event event;
+    };
+
+    std::unique_ptr<Cell[]> cells;
+    size_t mask { 0 };
+    alignas (64) std::atomic<size_t> tail { 0 };
+    alignas (64) std::atomic<size_t> head { 0 };
+};
+
+}
+
+using Impl = MidiQueueImpl;
+
+static Impl* midiqueue_check (lua_State* L) {
+    auto* impl = *(Impl**) lua_touserdata (L, 1);
+    if (impl == nullptr)
+        luaL_error (L, "queue was released");
+    return impl;
+}
+
+/** Pushes an empty handle, so a failed allocation can't leak a reference */
+static Impl** midiqueue_newhandle (lua_State* L) {
+    auto** handle = (Impl**) lua_newuserdata (L, sizeof (Impl*));
+    *handle = nullptr;
+    luaL_setmetatable (L, LKV_MT_MIDI_QUEUE);
+    return handle;
+}
+
+//==============================================================================
+/// Create a new queue.
+// Allocates every slot, nothing allocates after this.
+// @int capacity Most events waiting at once, rounded up to a power of two
+// @number[opt] samplerate Rate of the buffers drained into (default 44100)
+// @string[opt] name Name to open the queue by from other Lua states
+// @function MidiQueue.new
+// @return A new queue
+// @within Constructors
+static int midiqueue_new (lua_State* L) {
+    const auto capacity = (int) luaL_checkinteger (L, 1);
+    const auto rate     = luaL_optnumber (L, 2, 44100.0);
+    const char* name    = luaL_optstring (L, 3, nullptr);
+    luaL_argcheck (L, capacity > 0 && capacity <= (1 << 24), 1, "capacity must be from 1 to 16777216");
+    luaL_argcheck (L, rate > 0, 2, "sample rate must be more than zero");
+
+    auto** handle = midiqueue_newhandle (L);
+    *handle = Impl::create (name, capacity, rate);
+    if (*handle == nullptr)
+        return luaL_error (L, "a queue named '%s' already exists", name);
+    return 1;
+}
+
+/// Open a named queue.
+// Works from any Lua state in the process.
+// @string name Name given to @{MidiQueue.new}
+// @function MidiQueue.open
+// @return The queue or nil if there is none by that name
+// @within Constructors
+static int midiqueue_open (lua_State* L) {
+    const char* name = luaL_checkstring (L, 1);
+    auto** handle = midiqueue_newhandle (L);
+    *handle = Impl::open (name);
+    return *handle != nullptr ? 1 : 0;
+}
+
+/// Current time.
+// @function MidiQueue.now
+// @treturn number Milliseconds on the clock timestamps use
+static int midiqueue_now (lua_State* L) {
+    lua_pushnumber (L, juce::Time::getMillisecondCounterHiRes());
+    return 1;
+}
+
+static int midiqueue_gc (lua_State* L) {
+    auto** impl = (Impl**) lua_touserdata (L, 1);
+    if (*impl != nullptr)
+        (*impl)->release();
+    *impl = nullptr;
+    return 0;
+}
+
+/// Queue a message.
+// Safe from any thread.
+// @int msg Packed MIDI message
+// @number[opt] time Timestamp in milliseconds (default now)
+// @function MidiQueue:push
+// @treturn bool False if the queue is full
+static int midiqueue_push (lua_State* L) {
+    auto* impl = midiqueue_check (L);
+    const auto packed = luaL_checkinteger (L, 2);
+    const auto time   = lua_isnoneornil (L, 3) ? juce::Time::getMillisecondCounterHiRes()
+                                               : luaL_checknumber (L, 3);
+    lua_pushboolean (L, impl->push ({ static_cast<int64_t> (packed), time }));
+    return 1;
+}
+
+/// Move waiting messages into a buffer.
+// Only one thread may drain. Reserve space in the buffer ahead, or use a
+// fixed buffer, so adding events doesn't allocate. Events a fixed buffer
+// drops are taken from the queue but not counted.
+// @tparam kv.MidiBuffer buffer Buffer to add events to
+// @int nframes Frames in the block
+// @number[opt] now Time of the end of the block (default now)
+// @function MidiQueue:drain
+// @treturn int Number of events added
+static int midiqueue_drain (lua_State* L) {
+    auto* impl = midiqueue_check (L);
+    auto** mb = (kv::lua::MidiBufferImpl**) luaL_checkudata (L, 2, LKV_MT_MIDI_BUFFER);
+    const auto nframes = (int) luaL_checkinteger (L, 3);
+    const auto now = lua_isnoneornil (L, 4) ? juce::Time::getMillisecondCounterHiRes()
+                                            : luaL_checknumber (L, 4);
+    luaL_argcheck (L, *mb != nullptr, 2, "MIDI buffer was freed");
+    luaL_argcheck (L, nframes > 0, 3, "frames must be more than zero");
+    lua_pushinteger (L, impl->drain (**mb, nframes, now));
+    return 1;
+}
+
+/// Drop every waiting message.
+// Only from the thread that drains.
+// @function MidiQueue:clear
+static int midiqueue_clear (lua_State* L) {
+    midiqueue_check (L)->clear();
+    return 0;
+}
+
+/// Number of waiting messages.
+// Approximate while other threads push or drain.
+// @function MidiQueue:size
+// @treturn int
+static int midiqueue_size (lua_State* L) {
+    lua_pushinteger (L, midiqueue_check (L)->size());
+    return 1;
+}
+
+/// Most messages waiting at once.
+// @function MidiQueue:capacity
+// @treturn int
+static int midiqueue_capacity (lua_State* L) {
+    lua_pushinteger (L, midiqueue_check (L)->capacity());
+    return 1;
+}
+
+/// Sample rate used to place events.
+// @function MidiQueue:samplerate
+// @treturn number
+static int midiqueue_samplerate (lua_State* L) {
+    lua_pushnumber (L, midiqueue_check (L)->samplerate);
+    return 1;
+}
+
+/// Name of the queue.
+// @function MidiQueue:name
+// @treturn string The name or nil if unnamed
+static int midiqueue_name (lua_State* L) {
+    const auto& name = midiqueue_check (L)->getname();
+    if (name.empty())
+        return 0;
+    lua_pushlstring (L, name.data(), name.size());
+    return 1;
+}
+
+/// Release this state's reference.
+// The queue is freed once no state holds it. Also done when collected.
+// @function MidiQueue:release
+static int midiqueue_release (lua_State* L) {
+    return midiqueue_gc (L);
+}
+
+//==============================================================================
+static const luaL_Reg midiqueue_methods[] = {
+    { "__gc",           midiqueue_gc },
+    { "push",           midiqueue_push },
+    { "drain",          midiqueue_drain },
+    { "clear",          midiqueue_clear },
+    { "size",           midiqueue_size },
+    { "capacity",       midiqueue_capacity },
+    { "samplerate",     midiqueue_samplerate },
+    { "name",           midiqueue_name },
+    { "release",        midiqueue_release },
+    { NULL, NULL }
+};
+
+//==============================================================================
+LKV_EXPORT
+int luaopen_kv_MidiQueue (lua_State* L) {
+    if (luaL_newmetatable (L, LKV_MT_MIDI_QUEUE)) {
+        lua_pushvalue (L, -1);               /* duplicate the metatable */
+        lua_setfield (L, -2, "__index");     /* mt.__index = mt */
+        luaL_setfuncs (L, midiqueue_methods, 0);
+        lua_pop (L, 1);
+    }
+
+    if (luaL_newmetatable (L, LKV_MT_MIDI_QUEUE_TYPE)) {
+        lua_pop (L, 1);
+    }
+
+    lua_newtable (L);
+    luaL_setmetatable (L, LKV_MT_MIDI_QUEUE_TYPE);
+    lua_pushcfunction (L, midiqueue_new);
+    lua_setfield (L, -2, "new");
+    lua_pushcfunction (L, midiqueue_open);
+    lua_setfield (L, -2, "open");
+    lua_pushcfunction (L, midiqueue_now);
+    lua_setfield (L, -2, "now");
+    return 1;
+}
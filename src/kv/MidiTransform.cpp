@@ -0,0 +1,360 @@
+/// Filter and rewrite MIDI in one pass.
+// A rule set compiled once from a table, then applied to a
+// @{kv.MidiBuffer} in place. Covers what most MIDI scripts do by hand in a
+// loop over @{MidiBuffer:messages}: keep some types, channels or notes,
+// move channels, transpose, shape velocity and renumber controllers.
+//
+// Rules are applied in this order: type, channel and note filters on the
+// incoming message, then channel remap, transpose, velocity and controller
+// remap. Notes transposed out of 0 to 127 are dropped. System messages
+// only go through the type filter.
+// @classmod kv.MidiTransform
+// @pragma nostrip
+// @usage
+// local split = MidiTransform.new {
+//     channels  = { 1 },
+//     notes     = { 0, 59 },
+//     channel   = 2,
+//     transpose = -12,
+//     velocity  = function (v) return math.floor (127 * (v / 127) ^ 0.5) end
+// }
+// function process (audio, midi)
+//     split:apply (midi)
+// end
+
+#include "kv/lua/midi_buffer.hpp"
+#include "packed.h"
+#include <cstring>
+
+#define LKV_MT_MIDI_TRANSFORM       "kv.MidiTransform"
+#define LKV_MT_MIDI_TRANSFORM_TYPE  "kv.MidiTransformClass"
+
+namespace {
+
+/** Names accepted by the `types` rule, index is the type bit */
+static const char* const transform_types[] = {
+    "noteoff", "noteon", "aftertouch", "controller",
+    "program", "pressure", "pitchbend", "system",
+    nullptr
+};
+
+enum : int { TypeNoteOff = 0, TypeNoteOn = 1, TypeSystem = 7 };
+
+class MidiTransformImpl final {
+public:
+    MidiTransformImpl() {
+        for (int i = 0; i < 16; ++i)
+            channelmap[i] = static_cast<juce::uint8> (i);
+        for (int i = 0; i < 128; ++i) {
+            velocity[i] = static_cast<juce::uint8> (i);
+            controllers[i] = static_cast<juce::int16> (i);
+        }
+    }
+
+    /** Bit per message type kept, see transform_types */
+    juce::uint8 types { 0xff };
+    /** Bit per input channel kept */
+    juce::uint16 channels { 0xffff };
+    int notelow { 0 }, notehigh { 127 };
+    juce::uint8 channelmap [16];
+    int transpose { 0 };
+    /** Output velocity of note ons, zero stays zero */
+    juce::uint8 velocity [128];
+    /** Output controller number, or -1 to drop */
+    juce::int16 controllers [128];
+
+    /** Rewrite one message in place, returns false to drop it */
+    bool process (juce::uint8* data, int size) const noexcept {
+        const auto status = data[0];
+        if (status >= 0xf0)
+            return (types & (1 << TypeSystem)) != 0;
+        if (status < 0x80)
+            return true;
+
+        const int kind    = status & 0xf0;
+        const int channel = status & 0x0f;
+        int type = (kind >> 4) - 8;
+        if (type == TypeNoteOn && size >= 3 && data[2] == 0)
+            type = TypeNoteOff;
+        if ((types & (1 << type)) == 0 || (channels & (1 << channel)) == 0)
+            return false;
+
+        data[0] = static_cast<juce::uint8> (kind | channelmap[channel]);
+        if (size < 2)
+            return true;
+
+        switch (kind) {
+            case 0x80:
+            case 0x90:
+            case 0xa0: {
+                if (data[1] < notelow || data[1] > notehigh)
+                    return false;
+                const int note = data[1] + transpose;
+                if (note < 0 || note > 127)
+                    return false;
+                data[1] = static_cast<juce::uint8> (note);
+                if (kind == 0x90 && size >= 3)
+                    data[2] = velocity[data[2] & 0x7f];
+                break;
+            }
+
+            case 0xb0: {
+                const auto cc = controllers[data[1] & 0x7f];
+                if (cc < 0)
+                    return false;
+                data[1] = static_cast<juce::uint8> (cc);
+                break;
+            }
+
+            default:
+                break;
+        }
+
+        return true;
+    }
+
+    /** Transform a whole buffer in place. Kept events are moved down over
+        the dropped ones, then the leftover tail is cut through the buffer's
+        scratch storage. Returns events kept */
+    int apply (kv::lua::MidiBufferImpl& midi) {
+        auto& data = midi.buffer.data;
+        juce::uint8* const first = data.getRawDataPointer();
+        juce::uint8* const end   = first + data.size();
+        juce::uint8* out = first;
+        int count = 0;
+        for (auto* iter = first; iter < end;) {
+            const auto total = static_cast<size_t> (kv_midi_buffer_iter_total_size (iter));
+            const auto size  = static_cast<int> (kv_midi_buffer_iter_size (iter));
+            // a dropped event may be left half rewritten, it is overwritten
+            // or cut off below
+            if (size > 0 && process (kv_midi_buffer_iter_data (iter), size)) {
+                if (out != iter)
+                    std::memmove (out, iter, total);
+                out += total;
+                ++count;
+            }
+            iter += total;
+        }
+
+        midi.truncate (static_cast<int> (out - first));
+        return count;
+    }
+};
+
+}
+
+using Impl = MidiTransformImpl;
+
+//==============================================================================
+/** Reads a list of names or numbers at a rules field into a bit mask */
+static int midixform_checkbits (lua_State* L, int field, const char* name, int count, const char* const* names) {
+    int bits = 0;
+    const auto len = static_cast<int> (lua_rawlen (L, field));
+    for (int i = 1; i <= len; ++i) {
+        lua_rawgeti (L, field, i);
+        const int bit = names != nullptr ? luaL_checkoption (L, -1, nullptr, names)
+                                         : static_cast<int> (luaL_checkinteger (L, -1)) - 1;
+        if (bit < 0 || bit >= count)
+            luaL_error (L, "%s: value %d out of range", name, i);
+        bits |= 1 << bit;
+        lua_pop (L, 1);
+    }
+    return bits;
+}
+
+static void midixform_checkchannel (lua_State* L, lua_Integer channel, const char* name) {
+    if (channel < 1 || channel > 16)
+        luaL_error (L, "%s: channel must be from 1 to 16", name);
+}
+
+/** Fill `impl` from the rules table at index 1 */
+static void midixform_compile (lua_State* L, Impl* impl) {
+    if (lua_getfield (L, 1, "types") != LUA_TNIL) {
+        luaL_checktype (L, -1, LUA_TTABLE);
+        impl->types = static_cast<juce::uint8> (midixform_checkbits (L, lua_gettop (L), "types", 8, transform_types));
+    }
+    lua_pop (L, 1);
+
+    if (lua_getfield (L, 1, "channels") != LUA_TNIL) {
+        luaL_checktype (L, -1, LUA_TTABLE);
+        impl->channels = static_cast<juce::uint16> (midixform_checkbits (L, lua_gettop (L), "channels", 16, nullptr));
+    }
+    lua_pop (L, 1);
+
+    if (lua_getfield (L, 1, "notes") != LUA_TNIL) {
+        luaL_checktype (L, -1, LUA_TTABLE);
+        lua_rawgeti (L, -1, 1);
+        lua_rawgeti (L, -2, 2);
+        impl->notelow  = static_cast<int> (luaL_checkinteger (L, -2));
+        impl->notehigh = static_cast<int> (luaL_checkinteger (L, -1));
+        if (impl->notelow < 0 || impl->notehigh > 127 || impl->notelow > impl->notehigh)
+            luaL_error (L, "notes: expected { low, high } from 0 to 127");
+        lua_pop (L, 2);
+    }
+    lua_pop (L, 1);
+
+    const int type = lua_getfield (L, 1, "channel");
+    if (type == LUA_TNUMBER) {
+        const auto channel = luaL_checkinteger (L, -1);
+        midixform_checkchannel (L, channel, "channel");
+        std::memset (impl->channelmap, static_cast<int> (channel - 1), sizeof (impl->channelmap));
+    } else if (type == LUA_TTABLE) {
+        for (int c = 1; c <= 16; ++c) {
+            if (lua_rawgeti (L, -1, c) != LUA_TNIL) {
+                const auto channel = luaL_checkinteger (L, -1);
+                midixform_checkchannel (L, channel, "channel");
+                impl->channelmap[c - 1] = static_cast<juce::uint8> (channel - 1);
+            }
+            lua_pop (L, 1);
+        }
+    } else if (type != LUA_TNIL) {
+        luaL_error (L, "channel: expected number or table");
+    }
+    lua_pop (L, 1);
+
+    if (lua_getfield (L, 1, "transpose") != LUA_TNIL) {
+        impl->transpose = static_cast<int> (luaL_checkinteger (L, -1));
+        if (impl->transpose < -127 || impl->transpose > 127)
+            luaL_error (L, "transpose: must be from -127 to 127");
+    }
+    lua_pop (L, 1);
+
+    // every velocity from 1 to 127 is looked up once here
+    const int curve = lua_getfield (L, 1, "velocity");
+    const int fn = lua_gettop (L);
+    if (curve != LUA_TNIL) {
+        if (curve != LUA_TNUMBER && curve != LUA_TTABLE && curve != LUA_TFUNCTION)
+            luaL_error (L, "velocity: expected number, table or function");
+        for (int v = 1; v < 128; ++v) {
+            if (curve == LUA_TNUMBER) {
+                lua_pushvalue (L, fn);
+            } else if (curve == LUA_TTABLE) {
+                if (lua_rawgeti (L, fn, v) == LUA_TNIL) {
+                    lua_pop (L, 1);
+                    continue;
+                }
+            } else {
+                lua_pushvalue (L, fn);
+                lua_pushinteger (L, v);
+                lua_call (L, 1, 1);
+            }
+            const auto value = static_cast<int> (luaL_checknumber (L, -1));
+            impl->velocity[v] = static_cast<juce::uint8> (juce::jlimit (1, 127, value));
+            lua_pop (L, 1);
+        }
+    }
+    lua_pop (L, 1);
+
+    if (lua_getfield (L, 1, "controllers") != LUA_TNIL) {
+        luaL_checktype (L, -1, LUA_TTABLE);
+        for (int cc = 0; cc < 128; ++cc) {
+            const int kind = lua_rawgeti (L, -1, cc);
+            if (kind == LUA_TBOOLEAN && ! lua_toboolean (L, -1)) {
+                impl->controllers[cc] = -1;
+            } else if (kind != LUA_TNIL) {
+                const auto to = luaL_checkinteger (L, -1);
+                if (to < 0 || to > 127)
+                    luaL_error (L, "controllers: controller %d must map to 0 to 127 or false", cc);
+                impl->controllers[cc] = static_cast<juce::int16> (to);
+            }
+            lua_pop (L, 1);
+        }
+    }
+    lua_pop (L, 1);
+}
+
+//==============================================================================
+/// Compile a transform.
+// Every field is optional, an empty table passes everything through.
+//
+// - `types`: list of message types to keep, any of `noteon`, `noteoff`,
+//   `aftertouch`, `controller`, `program`, `pressure`, `pitchbend` and
+//   `system`. A note on with zero velocity counts as a note off.
+// - `channels`: list of input channels to keep, 1 to 16.
+// - `notes`: `{ low, high }` range of note numbers to keep, before
+//   transposing. Applies to notes and polyphonic aftertouch.
+// - `channel`: output channel for everything, or a table of input to
+//   output channels. Channels missing from the table are left alone.
+// - `transpose`: semitones added to notes and polyphonic aftertouch.
+// - `velocity`: note on velocity curve. A fixed number, a table indexed by
+//   the velocities 1 to 127, or a function called once per velocity now.
+//   Results are clamped to 1 to 127.
+// - `controllers`: table of controller numbers to new numbers, or false to
+//   drop that controller.
+// @tab rules Table of rules
+// @function MidiTransform.new
+// @return A new transform
+// @within Constructors
+static int midixform_new (lua_State* L) {
+    luaL_checktype (L, 1, LUA_TTABLE);
+    lua_settop (L, 1);
+    // collected normally if a rule raises an error
+    auto* impl = new (lua_newuserdata (L, sizeof (Impl))) Impl();
+    luaL_setmetatable (L, LKV_MT_MIDI_TRANSFORM);
+    midixform_compile (L, impl);
+    return 1;
+}
+
+static int midixform_gc (lua_State* L) {
+    auto* impl = (Impl*) lua_touserdata (L, 1);
+    impl->~Impl();
+    return 0;
+}
+
+/// Apply to a buffer in place.
+// One pass over the events, compacting the buffer in place. Doesn't
+// allocate once the buffer has reached its usual size.
+// @tparam kv.MidiBuffer buffer Buffer to transform
+// @function MidiTransform:apply
+// @treturn int Number of events kept
+static int midixform_apply (lua_State* L) {
+    auto* impl = (Impl*) lua_touserdata (L, 1);
+    auto** mb = (kv::lua::MidiBufferImpl**) luaL_checkudata (L, 2, LKV_MT_MIDI_BUFFER);
+    luaL_argcheck (L, *mb != nullptr, 2, "MIDI buffer was freed");
+    lua_pushinteger (L, impl->apply (**mb));
+    return 1;
+}
+
+/// Transform one packed message.
+// @int msg Packed MIDI message
+// @function MidiTransform:message
+// @treturn int The new packed message, or nil if dropped
+static int midixform_message (lua_State* L) {
+    auto* impl = (Impl*) lua_touserdata (L, 1);
+    kv_packed_t pack;
+    pack.packed = luaL_checkinteger (L, 2);
+    const auto size = pack.data[0] >= 0xf0 ? 4 : juce::MidiMessage::getMessageLengthFromFirstByte (pack.data[0]);
+    if (! impl->process (pack.data, size))
+        return 0;
+    lua_pushinteger (L, pack.packed);
+    return 1;
+}
+
+//==============================================================================
+static const luaL_Reg midixform_methods[] = {
+    { "__gc",           midixform_gc },
+    { "apply",          midixform_apply },
+    { "message",        midixform_message },
+    { NULL, NULL }
+};
+
+//==============================================================================
+LKV_EXPORT
+int luaopen_kv_MidiTransform (lua_State* L) {
+    if (luaL_newmetatable (L, LKV_MT_MIDI_TRANSFORM)) {
+        lua_pushvalue (L, -1);               /* duplicate the metatable */
+        lua_setfield (L, -2, "__index");     /* mt.__index = mt */
+        luaL_setfuncs (L, midixform_methods, 0);
+        lua_pop (L, 1);
+    }
+
+    if (luaL_newmetatable (L, LKV_MT_MIDI_TRANSFORM_TYPE)) {
+        lua_pop (L, 1);
+    }
+
+    lua_newtable (L);
+    luaL_setmetatable (L, LKV_MT_MIDI_TRANSFORM_TYPE);
+    lua_pushcfunction (L, midixform_new);
+    lua_setfield (L, -2, "new");
+    return 1;
+}
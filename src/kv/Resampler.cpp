@@ -0,0 +1,396 @@
+/// A streaming sample rate converter.
+// Converts audio between arbitrary rates block by block, keeping filter
+// state between calls. Quality is selectable between linear interpolation
+// and polyphase windowed-sinc filters.
+// @classmod kv.Resampler
+// @pragma nostrip
+// @usage
+// local rs  = Resampler.new (2, 44100, 48000)
+// local out = AudioBuffer.new (2, rs:outputsize (512))
+// function process (audio)
+//     local consumed, produced = rs:process (audio, out)
+//     -- `produced` frames of `out` are valid
+// end
+
+#include "kv/lua/audio_buffer.hpp"
+#include <cmath>
+#include <vector>
+
+#define LKV_MT_RESAMPLER        "kv.Resampler"
+#define LKV_MT_RESAMPLER_TYPE   "kv.ResamplerClass"
+
+namespace {
+
+/** Polyphase resampler. All allocation happens in the constructor and
+    setrates, process() never allocates */
+class ResamplerImpl final {
+public:
+    enum Quality { Linear = 0, Sinc, Best };
+
+    /** Number of filter phases, coefficients are interpolated between them */
+    static constexpr int numPhases = 256;
+
+    ResamplerImpl (int channels, double inrate, double outrate, Quality q, int maxblock)
+        : nchannels (channels), quality (q), capacity (maxblock)
+    {
+        setrates (inrate, outrate);
+    }
+
+    /** Change rates and rebuild the filter. Allocates, and resets the stream */
+    void setrates (double inrate, double outrate) {
+        step = inrate / outrate;
+
+        const double cutoff = juce::jmin (1.0, 1.0 / step);
+        int width = quality == Linear ? 2 : quality == Sinc ? 32 : 64;
+        if (quality != Linear)
+            width = juce::jmin (256, width * static_cast<int> (std::ceil (1.0 / cutoff)));
+        ntaps = width;
+        taps  = (width + 3) & ~3;
+
+        // one extra phase so phase p + 1 always exists
+        std::vector<double> table (static_cast<size_t> ((numPhases + 1) * taps), 0.0);
+        for (int p = 0; p <= numPhases; ++p) {
+            const double frac = static_cast<double> (p) / numPhases;
+            double* row = table.data() + p * taps;
+            double sum = 0.0;
+            for (int k = 0; k < ntaps; ++k) {
+                const double d = k - (ntaps / 2 - 1) - frac;
+                row[k] = quality == Linear ? juce::jmax (0.0, 1.0 - std::abs (d))
+                                           : windowed_sinc (d, cutoff * (quality == Best ? 0.95 : 0.9), ntaps / 2);
+                sum += row[k];
+            }
+            for (int k = 0; k < ntaps; ++k)
+                row[k] /= sum;
+        }
+
+        coeffs.assign (static_cast<size_t> (numPhases * taps), 0.f);
+        deltas.assign (static_cast<size_t> (numPhases * taps), 0.f);
+        for (int p = 0; p < numPhases; ++p) {
+            for (int k = 0; k < taps; ++k) {
+                coeffs[p * taps + k] = static_cast<float> (table[p * taps + k]);
+                deltas[p * taps + k] = static_cast<float> (table[(p + 1) * taps + k] - table[p * taps + k]);
+            }
+        }
+
+        // must hold at least the input needed for one output
+        histsize = taps + juce::jmax (capacity, static_cast<int> (std::ceil (step)) + 1);
+        history.assign (static_cast<size_t> (nchannels * histsize), 0.f);
+        reset();
+    }
+
+    /** Clear filter state */
+    void reset() {
+        std::fill (history.begin(), history.end(), 0.f);
+        // prime with silence so output starts right away
+        histlen = taps - 1;
+        pos = 0.0;
+    }
+
+    /** Delay in input frames */
+    int latency() const noexcept { return taps - 1 - (ntaps / 2 - 1); }
+
+    /** Input frames per output frame */
+    double ratio() const noexcept { return step; }
+
+    /** Max output frames produced for nframes of input */
+    int outputsize (int nframes) const noexcept {
+        return static_cast<int> (std::ceil ((nframes + taps) / step)) + 1;
+    }
+
+    int channels() const noexcept { return nchannels; }
+
+    /** Resample from src to dst, returns frames consumed and produced */
+    template<typename S, typename D>
+    std::pair<int, int> process (const juce::AudioBuffer<S>& src, int srcstart, int srccount,
+                                 juce::AudioBuffer<D>& dst, int dststart, int dstcount) noexcept
+    {
+        int consumed = 0, produced = 0;
+
+        for (;;) {
+            // produce what the current history allows
+            int n = 0;
+            while (produced + n < dstcount &&
+                   static_cast<int> (pos + n * step) + taps <= histlen)
+                ++n;
+
+            if (n > 0) {
+                for (int c = 0; c < nchannels; ++c) {
+                    float out [blockSize];
+                    const float* hist = history.data() + c * histsize;
+                    auto* d = dst.getWritePointer (c, dststart + produced);
+                    for (int done = 0; done < n; done += blockSize) {
+                        const int count = juce::jmin (blockSize, n - done);
+                        for (int i = 0; i < count; ++i)
+                            out[i] = filter (hist, pos + (done + i) * step);
+                        kv::lua::convert_samples (d + done, out, count);
+                    }
+                }
+                pos += n * step;
+                produced += n;
+            }
+
+            // drop history no longer needed
+            const int drop = juce::jmin (histlen, static_cast<int> (pos));
+            if (drop > 0) {
+                for (int c = 0; c < nchannels; ++c) {
+                    float* hist = history.data() + c * histsize;
+                    memmove (hist, hist + drop, sizeof (float) * static_cast<size_t> (histlen - drop));
+                }
+                histlen -= drop;
+                pos -= drop;
+            }
+
+            if (produced >= dstcount || consumed >= srccount)
+                break;
+
+            // append more input
+            const int count = juce::jmin (srccount - consumed, histsize - histlen);
+            if (count <= 0)
+                break;
+            for (int c = 0; c < nchannels; ++c)
+                kv::lua::convert_samples (history.data() + c * histsize + histlen,
+                                          src.getReadPointer (c, srcstart + consumed), count);
+            histlen  += count;
+            consumed += count;
+        }
+
+        return { consumed, produced };
+    }
+
+private:
+    static constexpr int blockSize = 64;
+
+    int nchannels   { 0 };
+    Quality quality { Sinc };
+    int capacity    { 0 };
+    int ntaps       { 0 };
+    int taps        { 0 };
+    double step     { 1.0 };
+    double pos      { 0.0 };
+    int histsize    { 0 };
+    int histlen     { 0 };
+    std::vector<float> coeffs, deltas, history;
+
+    static double windowed_sinc (double d, double cutoff, int halfwidth) {
+        const double x = d / halfwidth;
+        if (std::abs (x) >= 1.0)
+            return 0.0;
+        const double pi = juce::MathConstants<double>::pi;
+        const double window = 0.42 + 0.5 * std::cos (pi * x) + 0.08 * std::cos (2.0 * pi * x);
+        const double arg = pi * cutoff * d;
+        return window * cutoff * (d == 0.0 ? 1.0 : std::sin (arg) / arg);
+    }
+
+    /** One output sample at fractional position p in the history */
+    float filter (const float* hist, double p) const noexcept {
+        const int index   = static_cast<int> (p);
+        const double frac = (p - index) * numPhases;
+        const int phase   = static_cast<int> (frac);
+        const float mix   = static_cast<float> (frac - phase);
+        const float* x    = hist + index;
+        const float* c0   = coeffs.data() + phase * taps;
+        const float* c1   = deltas.data() + phase * taps;
+
+       #if JUCE_USE_SSE_INTRINSICS
+        __m128 a0 = _mm_setzero_ps(), a1 = _mm_setzero_ps();
+        for (int k = 0; k < taps; k += 4) {
+            const __m128 s = _mm_loadu_ps (x + k);
+            a0 = _mm_add_ps (a0, _mm_mul_ps (s, _mm_loadu_ps (c0 + k)));
+            a1 = _mm_add_ps (a1, _mm_mul_ps (s, _mm_loadu_ps (c1 + k)));
+        }
+        __m128 a = _mm_add_ps (a0, _mm_mul_ps (a1, _mm_set1_ps (mix)));
+        a = _mm_add_ps (a, _mm_movehl_ps (a, a));
+        a = _mm_add_ss (a, _mm_shuffle_ps (a, a, 1));
+        return _mm_cvtss_f32 (a);
+       #elif JUCE_USE_ARM_NEON && defined (__aarch64__)
+        float32x4_t a0 = vdupq_n_f32 (0.f), a1 = vdupq_n_f32 (0.f);
+        for (int k = 0; k < taps; k += 4) {
+            const float32x4_t s = vld1q_f32 (x + k);
+            a0 = vmlaq_f32 (a0, s, vld1q_f32 (c0 + k));
+            a1 = vmlaq_f32 (a1, s, vld1q_f32 (c1 + k));
+        }
+        return vaddvq_f32 (vmlaq_n_f32 (a0, a1, mix));
+       #else
+        float a0 = 0.f, a1 = 0.f;
+        for (int k = 0; k < taps; ++k) {
+            a0 += x[k] * c0[k];
+            a1 += x[k] * c1[k];
+        }
+        return a0 + a1 * mix;
+       #endif
+    }
+};
+
+}
+
+using Impl = ResamplerImpl;
+
+//==============================================================================
+static const char* const resampler_qualities[] = { "linear", "sinc", "best", nullptr };
+
+/// Create a new resampler.
+// @int nchannels Number of channels
+// @number inrate Input sample rate
+// @number outrate Output sample rate
+// @string[opt] quality "linear", "sinc" or "best" (default "sinc")
+// @int[opt] maxblock Input frames taken per pass (default 4096)
+// @function Resampler.new
+// @return A new resampler
+// @within Constructors
+static int resampler_new (lua_State* L) {
+    const auto nchannels = (int) luaL_checkinteger (L, 1);
+    const auto inrate    = luaL_checknumber (L, 2);
+    const auto outrate   = luaL_checknumber (L, 3);
+    const auto quality   = luaL_checkoption (L, 4, "sinc", resampler_qualities);
+    const auto maxblock  = (int) luaL_optinteger (L, 5, 4096);
+    luaL_argcheck (L, nchannels > 0, 1, "channels must be more than zero");
+    luaL_argcheck (L, inrate > 0, 2, "rate must be more than zero");
+    luaL_argcheck (L, outrate > 0, 3, "rate must be more than zero");
+    luaL_argcheck (L, maxblock > 0, 5, "block size must be more than zero");
+
+    auto* block = lua_newuserdata (L, sizeof (Impl));
+    new (block) Impl (nchannels, inrate, outrate, static_cast<Impl::Quality> (quality), maxblock);
+    luaL_setmetatable (L, LKV_MT_RESAMPLER);
+    return 1;
+}
+
+static int resampler_gc (lua_State* L) {
+    ((Impl*) lua_touserdata (L, 1))->~Impl();
+    return 0;
+}
+
+/// Resample a whole buffer.
+// Consumes input and produces output until `src` is used up or `dst` is
+// full. Input that was consumed but not yet needed for output is kept and
+// used on the next call.
+// @tparam kv.AudioBuffer src Input audio
+// @tparam kv.AudioBuffer dst Output audio
+// @treturn int Input frames consumed
+// @treturn int Output frames produced, starting at the first frame of `dst`
+// @function Resampler:process
+
+/// Resample a range of frames.
+// @tparam kv.AudioBuffer src Input audio
+// @int srcstart First input frame
+// @int srccount Number of input frames
+// @tparam kv.AudioBuffer dst Output audio
+// @int dststart First output frame
+// @int dstcount Output frames available
+// @treturn int Input frames consumed
+// @treturn int Output frames produced
+// @function Resampler:process
+static int resampler_process (lua_State* L) {
+    auto* impl = (Impl*) lua_touserdata (L, 1);
+    const bool ranged = lua_isinteger (L, 3);
+    const int srcarg  = 2;
+    const int dstarg  = ranged ? 5 : 3;
+    std::pair<int, int> result;
+
+    kv::lua::with_audio_buffer (L, srcarg, [&](auto& src) {
+        kv::lua::with_audio_buffer (L, dstarg, [&](auto& dst) {
+            int srcstart = 0, srccount = src.getNumSamples();
+            int dststart = 0, dstcount = dst.getNumSamples();
+            if (ranged) {
+                srcstart = static_cast<int> (luaL_checkinteger (L, 3)) - 1;
+                srccount = static_cast<int> (luaL_checkinteger (L, 4));
+                dststart = static_cast<int> (luaL_checkinteger (L, 6)) - 1;
+                dstcount = static_cast<int> (luaL_checkinteger (L, 7));
+            }
+
+            luaL_argcheck (L, src.getNumChannels() >= impl->channels(), srcarg, "not enough channels");
+            luaL_argcheck (L, dst.getNumChannels() >= impl->channels(), dstarg, "not enough channels");
+            luaL_argcheck (L, srcstart >= 0 && srccount >= 0 && srcstart + srccount <= src.getNumSamples(),
+                           srcarg, "sample range out of bounds");
+            luaL_argcheck (L, dststart >= 0 && dstcount >= 0 && dststart + dstcount <= dst.getNumSamples(),
+                           dstarg, "sample range out of bounds");
+
+            result = impl->process (src, srcstart, srccount, dst, dststart, dstcount);
+        });
+    });
+
+    lua_pushinteger (L, result.first);
+    lua_pushinteger (L, result.second);
+    return 2;
+}
+
+/// Clear filter state.
+// @function Resampler:reset
+static int resampler_reset (lua_State* L) {
+    ((Impl*) lua_touserdata (L, 1))->reset();
+    return 0;
+}
+
+/// Change sample rates.
+// Rebuilds the filter and resets state. Allocates, so avoid calling while
+// processing audio.
+// @number inrate Input sample rate
+// @number outrate Output sample rate
+// @function Resampler:setrates
+static int resampler_setrates (lua_State* L) {
+    auto* impl = (Impl*) lua_touserdata (L, 1);
+    const auto inrate  = luaL_checknumber (L, 2);
+    const auto outrate = luaL_checknumber (L, 3);
+    luaL_argcheck (L, inrate > 0, 2, "rate must be more than zero");
+    luaL_argcheck (L, outrate > 0, 3, "rate must be more than zero");
+    impl->setrates (inrate, outrate);
+    return 0;
+}
+
+/// Filter delay in input frames.
+// @function Resampler:latency
+// @treturn int
+static int resampler_latency (lua_State* L) {
+    lua_pushinteger (L, ((Impl*) lua_touserdata (L, 1))->latency());
+    return 1;
+}
+
+/// Input frames per output frame.
+// @function Resampler:ratio
+// @treturn number
+static int resampler_ratio (lua_State* L) {
+    lua_pushnumber (L, ((Impl*) lua_touserdata (L, 1))->ratio());
+    return 1;
+}
+
+/// Output buffer size needed to take a block of input in one call.
+// @int nframes Input block size
+// @function Resampler:outputsize
+// @treturn int
+static int resampler_outputsize (lua_State* L) {
+    auto* impl = (Impl*) lua_touserdata (L, 1);
+    lua_pushinteger (L, impl->outputsize ((int) luaL_checkinteger (L, 2)));
+    return 1;
+}
+
+//==============================================================================
+static const luaL_Reg resampler_methods[] = {
+    { "__gc",           resampler_gc },
+    { "process",        resampler_process },
+    { "reset",          resampler_reset },
+    { "setrates",       resampler_setrates },
+    { "latency",        resampler_latency },
+    { "ratio",          resampler_ratio },
+    { "outputsize",     resampler_outputsize },
+    { NULL, NULL }
+};
+
+//==============================================================================
+LKV_EXPORT
+int luaopen_kv_Resampler (lua_State* L) {
+    if (luaL_newmetatable (L, LKV_MT_RESAMPLER)) {
+        lua_pushvalue (L, -1);               /* duplicate the metatable */
+        lua_setfield (L, -2, "__index");     /* mt.__index = mt */
+        luaL_setfuncs (L, resampler_methods, 0);
+        lua_pop (L, 1);
+    }
+
+    if (luaL_newmetatable (L, LKV_MT_RESAMPLER_TYPE)) {
+        lua_pop (L, 1);
+    }
+
+    lua_newtable (L);
+    luaL_setmetatable (L, LKV_MT_RESAMPLER_TYPE);
+    lua_pushcfunction (L, resampler_new);
+    lua_setfield (L, -2, "new");
+    return 1;
+}
@@ -0,0 +1,221 @@
+
+#pragma once
+
+#include "kv/lua/audio_buffer.hpp"
+
+namespace kv {
+namespace lua {
+
+/** Interleaved PCM sample formats */
+enum class PCMFormat { s16 = 0, s24, s32, f32 };
+
+/** Describes an interleaved PCM layout */
+struct PCMLayout {
+    PCMFormat   format      { PCMFormat::s16 };
+    bool        bigendian   { false };
+
+    /** Bytes in one sample */
+    int bytes() const noexcept {
+        return format == PCMFormat::s16 ? 2 : format == PCMFormat::s24 ? 3 : 4;
+    }
+
+    /** Largest integer value, as used by juce::AudioData */
+    int32_t maxvalue() const noexcept {
+        return format == PCMFormat::s16 ? 0x7fff : format == PCMFormat::s24 ? 0x7fffff : 0x7fffffff;
+    }
+};
+
+/** Number of frames converted per pass */
+static constexpr int pcmBlockSize = 128;
+
+/** xorshift32 noise source for TPDF dither. Keep one alive across blocks,
+    a fresh one restarts the same sequence */
+struct PCMDither {
+    uint32_t state { 0x9e3779b9u };
+
+    /** Returns uniform noise in [0, 1) */
+    float next() noexcept {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return static_cast<float> (state >> 8) * (1.0f / 16777216.0f);
+    }
+
+    /** Add triangular noise of +/- lsb */
+    template<typename T>
+    void apply (T* samples, int count, T lsb) noexcept {
+        for (int i = 0; i < count; ++i)
+            samples[i] += static_cast<T> (next() - next()) * lsb;
+    }
+};
+
+//==============================================================================
+/** Scale samples in -1..1 to rounded integers in -maxval-1..maxval */
+inline void pcm_quantize (int32_t* dst, const float* src, int count, float maxval) noexcept {
+    int i = 0;
+   #if JUCE_USE_SSE_INTRINSICS
+    const __m128 scale = _mm_set1_ps (maxval);
+    const __m128 lo    = _mm_set1_ps (-maxval - 1.0f);
+    for (; i + 4 <= count; i += 4) {
+        __m128 s = _mm_mul_ps (_mm_loadu_ps (src + i), scale);
+        s = _mm_min_ps (_mm_max_ps (s, lo), scale);
+        _mm_storeu_si128 ((__m128i*) (dst + i), _mm_cvtps_epi32 (s));
+    }
+   #elif JUCE_USE_ARM_NEON && defined (__aarch64__)
+    const float32x4_t scale = vdupq_n_f32 (maxval);
+    const float32x4_t lo    = vdupq_n_f32 (-maxval - 1.0f);
+    for (; i + 4 <= count; i += 4) {
+        float32x4_t s = vmulq_f32 (vld1q_f32 (src + i), scale);
+        s = vminq_f32 (vmaxq_f32 (s, lo), scale);
+        vst1q_s32 (dst + i, vcvtnq_s32_f32 (s));
+    }
+   #endif
+    for (; i < count; ++i)
+        dst[i] = juce::roundToInt (juce::jlimit (-maxval - 1.0f, maxval, src[i] * maxval));
+}
+
+/** Double precision version, used for 32bit integers which float can't hold */
+inline void pcm_quantize (int32_t* dst, const double* src, int count, double maxval) noexcept {
+    for (int i = 0; i < count; ++i)
+        dst[i] = juce::roundToInt (juce::jlimit (-maxval - 1.0, maxval, src[i] * maxval));
+}
+
+/** Scale integers back to floating point */
+inline void pcm_dequantize (float* dst, const int32_t* src, int count, float scale) noexcept {
+    int i = 0;
+   #if JUCE_USE_SSE_INTRINSICS
+    const __m128 s = _mm_set1_ps (scale);
+    for (; i + 4 <= count; i += 4)
+        _mm_storeu_ps (dst + i, _mm_mul_ps (_mm_cvtepi32_ps (_mm_loadu_si128 ((const __m128i*) (src + i))), s));
+   #elif JUCE_USE_ARM_NEON && defined (__aarch64__)
+    const float32x4_t s = vdupq_n_f32 (scale);
+    for (; i + 4 <= count; i += 4)
+        vst1q_f32 (dst + i, vmulq_f32 (vcvtq_f32_s32 (vld1q_s32 (src + i)), s));
+   #endif
+    for (; i < count; ++i)
+        dst[i] = static_cast<float> (src[i]) * scale;
+}
+
+inline void pcm_dequantize (double* dst, const int32_t* src, int count, double scale) noexcept {
+    for (int i = 0; i < count; ++i)
+        dst[i] = static_cast<double> (src[i]) * scale;
+}
+
+//==============================================================================
+/** Convert one channel of samples to integer or float bits ready to store */
+template<typename T>
+inline void pcm_encode (int32_t* dst, const T* src, int count, PCMLayout layout, PCMDither* dither) noexcept {
+    if (layout.format == PCMFormat::s32) {
+        double tmp [pcmBlockSize];
+        convert_samples (tmp, src, count);
+        if (dither != nullptr)
+            dither->apply (tmp, count, 1.0 / layout.maxvalue());
+        pcm_quantize (dst, tmp, count, static_cast<double> (layout.maxvalue()));
+        return;
+    }
+
+    float tmp [pcmBlockSize];
+    convert_samples (tmp, src, count);
+    if (layout.format == PCMFormat::f32) {
+        memcpy (dst, tmp, sizeof (float) * static_cast<size_t> (count));
+        return;
+    }
+
+    if (dither != nullptr)
+        dither->apply (tmp, count, 1.0f / static_cast<float> (layout.maxvalue()));
+    pcm_quantize (dst, tmp, count, static_cast<float> (layout.maxvalue()));
+}
+
+/** Convert integer or float bits loaded from PCM to samples */
+template<typename T>
+inline void pcm_decode (T* dst, const int32_t* src, int count, PCMLayout layout) noexcept {
+    if (layout.format == PCMFormat::s32) {
+        double tmp [pcmBlockSize];
+        pcm_dequantize (tmp, src, count, 1.0 / (1.0 + layout.maxvalue()));
+        convert_samples (dst, tmp, count);
+        return;
+    }
+
+    float tmp [pcmBlockSize];
+    if (layout.format == PCMFormat::f32)
+        memcpy (tmp, src, sizeof (float) * static_cast<size_t> (count));
+    else
+        pcm_dequantize (tmp, src, count, 1.0f / (1.0f + static_cast<float> (layout.maxvalue())));
+    convert_samples (dst, tmp, count);
+}
+
+//==============================================================================
+template<int NBytes, bool BigEndian>
+inline void pcm_store (uint8_t* dst, const int32_t* src, int count, int stride) noexcept {
+    for (int i = 0; i < count; ++i, dst += stride) {
+        const auto v = static_cast<uint32_t> (src[i]);
+        for (int b = 0; b < NBytes; ++b)
+            dst[BigEndian ? NBytes - 1 - b : b] = static_cast<uint8_t> (v >> (8 * b));
+    }
+}
+
+template<int NBytes, bool BigEndian>
+inline void pcm_load (int32_t* dst, const uint8_t* src, int count, int stride) noexcept {
+    for (int i = 0; i < count; ++i, src += stride) {
+        uint32_t v = 0;
+        for (int b = 0; b < NBytes; ++b)
+            v |= static_cast<uint32_t> (src[BigEndian ? NBytes - 1 - b : b]) << (8 * b + 32 - 8 * NBytes);
+        // arithmetic shift sign extends 16 and 24 bit values
+        dst[i] = static_cast<int32_t> (v) >> (32 - 8 * NBytes);
+    }
+}
+
+/** Store one channel of encoded values every `stride` bytes */
+inline void pcm_interleave (uint8_t* dst, const int32_t* src, int count, int stride, PCMLayout layout) noexcept {
+    switch (layout.bytes() * (layout.bigendian ? -1 : 1)) {
+        case  2: pcm_store<2, false> (dst, src, count, stride); break;
+        case -2: pcm_store<2, true>  (dst, src, count, stride); break;
+        case  3: pcm_store<3, false> (dst, src, count, stride); break;
+        case -3: pcm_store<3, true>  (dst, src, count, stride); break;
+        case  4: pcm_store<4, false> (dst, src, count, stride); break;
+        case -4: pcm_store<4, true>  (dst, src, count, stride); break;
+    }
+}
+
+/** Load one channel of encoded values from every `stride` bytes */
+inline void pcm_deinterleave (int32_t* dst, const uint8_t* src, int count, int stride, PCMLayout layout) noexcept {
+    switch (layout.bytes() * (layout.bigendian ? -1 : 1)) {
+        case  2: pcm_load<2, false> (dst, src, count, stride); break;
+        case -2: pcm_load<2, true>  (dst, src, count, stride); break;
+        case  3: pcm_load<3, false> (dst, src, count, stride); break;
+        case -3: pcm_load<3, true>  (dst, src, count, stride); break;
+        case  4: pcm_load<4, false> (dst, src, count, stride); break;
+        case -4: pcm_load<4, true>  (dst, src, count, stride); break;
+    }
+}
+
+/** Stereo 16bit little endian interleave, the most common stream format */
+inline void pcm_interleave_s16 (uint8_t* dst, const int32_t* left, const int32_t* right, int count) noexcept {
+    int i = 0;
+   #if JUCE_USE_SSE_INTRINSICS && JUCE_LITTLE_ENDIAN
+    const __m128i mask = _mm_set1_epi32 (0xffff);
+    for (; i + 4 <= count; i += 4) {
+        const __m128i l = _mm_and_si128 (_mm_loadu_si128 ((const __m128i*) (left + i)), mask);
+        const __m128i r = _mm_slli_epi32 (_mm_loadu_si128 ((const __m128i*) (right + i)), 16);
+        _mm_storeu_si128 ((__m128i*) (dst + 4 * i), _mm_or_si128 (l, r));
+    }
+   #endif
+    pcm_store<2, false> (dst + 4 * i,     left + i,  count - i, 4);
+    pcm_store<2, false> (dst + 4 * i + 2, right + i, count - i, 4);
+}
+
+/** Stereo 16bit little endian deinterleave */
+inline void pcm_deinterleave_s16 (int32_t* left, int32_t* right, const uint8_t* src, int count) noexcept {
+    int i = 0;
+   #if JUCE_USE_SSE_INTRINSICS && JUCE_LITTLE_ENDIAN
+    for (; i + 4 <= count; i += 4) {
+        const __m128i v = _mm_loadu_si128 ((const __m128i*) (src + 4 * i));
+        _mm_storeu_si128 ((__m128i*) (left + i),  _mm_srai_epi32 (_mm_slli_epi32 (v, 16), 16));
+        _mm_storeu_si128 ((__m128i*) (right + i), _mm_srai_epi32 (v, 16));
+    }
+   #endif
+    pcm_load<2, false> (left + i,  src + 4 * i,     count - i, 4);
+    pcm_load<2, false> (right + i, src + 4 * i + 2, count - i, 4);
+}
+
+}}
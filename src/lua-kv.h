@@ -56,10 +56,14 @@ extern "C" {
 
 #define LKV_MT_AUDIO_BUFFER_64              "kv.AudioBuffer64"
 #define LKV_MT_AUDIO_BUFFER_32              "kv.AudioBuffer32"
+#define LKV_MT_CHANNEL_VIEW_64              "kv.ChannelView64"
+#define LKV_MT_CHANNEL_VIEW_32              "kv.ChannelView32"
+#define LKV_MT_AUDIO_BUFFER_POOL            "kv.AudioBufferPool"
 #define LKV_MT_BYTE_ARRAY                   "kv.ByteArray"
 #define LKV_MT_MIDI_MESSAGE                 "kv.MidiMessage"
 #define LKV_MT_MIDI_BUFFER                  "kv.MidiBuffer"
 #define LKV_MT_MIDI_PIPE                    "kv.MidiPipe"
+#define LKV_MT_MIDI_VIEW                    "kv.MidiView"
 #define LKV_MT_VECTOR                       "kv.Vector"
 
 #if LKV_FORCE_FLOAT32
@@ -115,6 +119,8 @@ kv_audio_buffer_t* kv_audio_buffer_new (lua_State* L,
                                         int        num_frames);
 
 /** Refer the given buffer to a set of external audio channels
+    Does not copy or allocate if nchannels is less than 32, so a host can
+    point one long lived buffer at its own audio every block.
     @param buffer       The audio buffer
     @param data         External data to refer to
     @param nchannels    Number of channels is external data
@@ -144,6 +150,9 @@ kv_sample_t* kv_audio_buffer_channel (kv_audio_buffer_t*, int channel);
     @param preserve     Keep existing content if possible
     @param clear        Clear extra space
     @param norealloc    Avoid re-allocating if possible
+
+    When not preserving, a size that fits the memory the buffer was created
+    with never allocates.
 */
 void kv_audio_buffer_resize (kv_audio_buffer_t* buffer,
                              int                nchannels, 
@@ -152,11 +161,23 @@ void kv_audio_buffer_resize (kv_audio_buffer_t* buffer,
                              bool               clear,
                              bool               norealloc);
 
+/** Copy external audio into this buffer.
+    The buffer is resized to fit without re-allocating if possible. Copies
+    into the buffer's own memory, even if it currently refers to external
+    data.
+    @param buffer       The audio buffer
+    @param source       Channels to copy from
+    @param nchannels    Number of channels in source
+    @param nframes      Number of samples in each source channel
+*/
 void kv_audio_buffer_duplicate (kv_audio_buffer_t*        buffer,
                                  const kv_sample_t* const* source,
                                  int                        nchannels,
                                  int                        nframes);
 
+/** Copy external 32bit audio into this buffer.
+    Same as `kv_audio_buffer_duplicate` but converts from float
+*/
 void kv_audio_buffer_duplicate_32 (kv_audio_buffer_t* buffer,
                                     const float* const* source,
                                     int                 nchannels,
@@ -179,7 +200,11 @@ kv_midi_buffer_t* kv_midi_buffer_new (lua_State* L, size_t size);
 void kv_midi_buffer_free (kv_midi_buffer_t* buf);
 
 size_t kv_midi_buffer_capacity (kv_midi_buffer_t* buf);
-void kv_midi_buffer_swap (kv_midi_buffer_t* a, kv_midi_buffer_t* b);
+
+/** Swap the contents of two buffers. Does nothing and returns 0 if either
+    is fixed size and the other's storage is smaller than its capacity,
+    otherwise swaps and returns 1 */
+int kv_midi_buffer_swap (kv_midi_buffer_t* a, kv_midi_buffer_t* b);
 
 /** Clears the buffer */
 void kv_midi_buffer_clear (kv_midi_buffer_t*);
@@ -1,5 +1,6 @@
 local AudioBuffer       = require ('kv.AudioBuffer')
 local round             = require ('kv.round')
+local bytes             = require ('kv.bytes')
 
 TestAudioBuffer = {
     testNew = function()
@@ -30,6 +31,280 @@ TestAudioBuffer = {
         end
     end,
 
+    testReadWrite = function()
+        local buf = AudioBuffer.new (2, 64)
+        local values = {}
+        for i = 1, 32 do values[i] = round.float (i / 32) end
+
+        luaunit.assertEquals (buf:write (2, 9, values), 32)
+        local out = buf:read (2, 9, 32)
+        luaunit.assertEquals (#out, 32)
+        for i = 1, 32 do
+            luaunit.assertAlmostEquals (out[i], values[i])
+            luaunit.assertAlmostEquals (buf:get (2, 8 + i), values[i])
+        end
+
+        local packed = string.pack ('fff', 0.25, 0.5, 0.75)
+        luaunit.assertEquals (buf:write (1, 1, packed), 3)
+        luaunit.assertAlmostEquals (buf:get (1, 3), 0.75)
+
+        local reused = buf:read (1, 1, 2, out)
+        luaunit.assertIs (reused, out)
+        luaunit.assertAlmostEquals (out[2], 0.5)
+
+        luaunit.assertError (function() buf:read (3, 1, 1) end)
+        luaunit.assertError (function() buf:read (1, 60, 10) end)
+    end,
+
+    testReadWriteBlock = function()
+        local buf = AudioBuffer.new64 (2, 16)
+        luaunit.assertEquals (buf:writeblock (1, { { 1, 2, 3 }, { 4, 5, 6 } }), 3)
+        local block = buf:readblock (1, 3)
+        luaunit.assertEquals (block, { { 1, 2, 3 }, { 4, 5, 6 } })
+
+        luaunit.assertEquals (buf:writeblock (5, string.pack ('dddd', 7, 8, 9, 10)), 2)
+        luaunit.assertEquals (buf:get (1, 6), 8)
+        luaunit.assertEquals (buf:get (2, 5), 9)
+    end,
+
+    testChannelView = function()
+        local buf = AudioBuffer.new64 (2, 16)
+        local view = buf:channel (2, 5, 4)
+        luaunit.assertEquals (#view, 4)
+        luaunit.assertTrue (view:valid())
+
+        view[1] = 0.5
+        view[4] = 0.25
+        luaunit.assertEquals (buf:get (2, 5), 0.5)
+        luaunit.assertEquals (buf:get (2, 8), 0.25)
+
+        buf:set (2, 6, 0.75)
+        luaunit.assertEquals (view[2], 0.75)
+        luaunit.assertNil (view[5])
+
+        buf:free()
+        luaunit.assertFalse (view:valid())
+        luaunit.assertEquals (#view, 0)
+        luaunit.assertError (function() return view[1] end)
+    end,
+
+    testSlice = function()
+        local buf = AudioBuffer.new32 (4, 32)
+        local slice = buf:slice (2, 2, 9, 8)
+        luaunit.assertTrue (slice:isfloat())
+        luaunit.assertEquals (slice:channels(), 2)
+        luaunit.assertEquals (slice:length(), 8)
+
+        slice:set (1, 1, 0.5)
+        luaunit.assertEquals (buf:get (2, 9), 0.5)
+        buf:set (3, 16, 0.25)
+        luaunit.assertEquals (slice:get (2, 8), 0.25)
+
+        local sub = slice:slice (2, 1, 8)
+        luaunit.assertEquals (sub:length(), 1)
+        luaunit.assertEquals (sub:get (1, 1), 0.25)
+        luaunit.assertEquals (buf:slice():channels(), 4)
+
+        slice = nil
+        buf = nil
+        collectgarbage()
+        luaunit.assertEquals (sub:get (1, 1), 0.25)
+
+        luaunit.assertError (function() sub:slice (1, 2) end)
+        luaunit.assertError (function() sub:slice (1, 1, 1, 2) end)
+    end,
+
+    testSliceParentReleased = function()
+        local buf = AudioBuffer.new32 (2, 16)
+        local slice = buf:slice (1, 2, 5, 8)
+        local sub = slice:slice (2, 1, 3, 2)
+        buf:free()
+        luaunit.assertEquals (slice:channels(), 0)
+        luaunit.assertEquals (slice:length(), 0)
+        luaunit.assertEquals (sub:length(), 0)
+        luaunit.assertError (function() sub:slice (1, 1, 1, 1) end)
+
+        buf = AudioBuffer.new64 (2, 16)
+        slice = buf:slice (1, 1, 1, 4)
+        buf:convertfrom (AudioBuffer.new32 (4, 4096))
+        luaunit.assertEquals (buf:channels(), 4)
+        luaunit.assertEquals (slice:length(), 0)
+        slice:applygain (0.5)
+
+        slice = buf:slice()
+        luaunit.assertError (function() buf:convertfrom (slice) end)
+        luaunit.assertEquals (slice:length(), 4096)
+
+        local src = AudioBuffer.new32 (1, 8)
+        slice = src:slice (1, 1, 2, 4)
+        slice:convertfrom (AudioBuffer.new32 (1, 2))
+        src:free()
+        luaunit.assertEquals (slice:length(), 2)
+    end,
+
+    testMixing = function()
+        local a = AudioBuffer.new32 (2, 8)
+        local b = AudioBuffer.new64 (2, 8)
+        for c = 1, 2 do
+            for f = 1, 8 do b:set (c, f, 1.0) end
+        end
+
+        a:copyfrom (b, 0.5)
+        luaunit.assertEquals (a:get (2, 8), 0.5)
+        a:addfrom (b)
+        luaunit.assertEquals (a:get (1, 1), 1.5)
+
+        a:addfrom (1, 5, b, 2, 1, 4, 2.0)
+        luaunit.assertEquals (a:get (1, 4), 1.5)
+        luaunit.assertEquals (a:get (1, 5), 3.5)
+
+        a:copyfromwithramp (1, 1, b, 1, 1, 4, 0.0, 1.0)
+        luaunit.assertEquals (a:get (1, 1), 0.0)
+        luaunit.assertEquals (a:get (1, 2), 0.25)
+        luaunit.assertEquals (a:get (1, 4), 0.75)
+
+        b:addfromwithramp (a, 1.0, 1.0)
+        luaunit.assertEquals (b:get (1, 2), 1.25)
+
+        luaunit.assertError (function() a:addfrom (1, 1, b, 3, 1, 4) end)
+        luaunit.assertError (function() a:addfrom (1, 6, b, 1, 1, 4) end)
+    end,
+
+    testMixingOverlap = function()
+        local buf = AudioBuffer.new64 (1, 600)
+        local function fill()
+            for f = 1, 600 do buf:set (1, f, f) end
+        end
+
+        fill()
+        buf:copyfrom (1, 10, buf, 1, 1, 500)
+        for f = 1, 500 do luaunit.assertEquals (buf:get (1, f + 9), f) end
+
+        fill()
+        buf:copyfrom (1, 1, buf, 1, 10, 500)
+        for f = 1, 500 do luaunit.assertEquals (buf:get (1, f), f + 9) end
+
+        fill()
+        buf:slice (1, 1, 3, 500):addfrom (buf)
+        for f = 1, 500 do luaunit.assertEquals (buf:get (1, f + 2), f + 2 + f) end
+
+        fill()
+        buf:copyfromwithramp (1, 101, buf, 1, 1, 300, 0.0, 1.0)
+        for f = 1, 300 do
+            luaunit.assertAlmostEquals (buf:get (1, f + 100), f * (f - 1) / 300, 1e-9)
+        end
+    end,
+
+    testConvert = function()
+        local a = AudioBuffer.new32 (2, 10)
+        for c = 1, 2 do
+            for f = 1, 10 do a:set (c, f, round.float (c * f / 20)) end
+        end
+
+        local d = a:todouble()
+        luaunit.assertTrue (d:isdouble())
+        luaunit.assertEquals (d:channels(), 2)
+        luaunit.assertEquals (d:length(), 10)
+        luaunit.assertEquals (d:get (2, 7), a:get (2, 7))
+
+        local f = d:tofloat()
+        luaunit.assertTrue (f:isfloat())
+        luaunit.assertEquals (f:get (1, 10), a:get (1, 10))
+
+        local b = AudioBuffer.new64 (1, 4)
+        b:convertfrom (a)
+        luaunit.assertEquals (b:channels(), 2)
+        luaunit.assertEquals (b:length(), 10)
+        luaunit.assertEquals (b:get (2, 9), a:get (2, 9))
+
+        a:set (1, 1, 1.0)
+        a:convertfrom (a)
+        luaunit.assertEquals (a:get (1, 1), 1.0)
+    end,
+
+    testPCM = function()
+        local buf = AudioBuffer.new32 (2, 5)
+        buf:writeblock (1, { { 0.5, -0.5, 1.0, -1.0, 2.0 }, { 0.25, 0, 0, 0, -2.0 } })
+
+        local data = bytes.new (2 * 5 * 2)
+        luaunit.assertEquals (buf:topcm (data, 's16'), 20)
+        local str = ''
+        for i = 1, bytes.size (data) do str = str .. string.char (bytes.get (data, i)) end
+        local l1, r1, l2, r2 = string.unpack ('<i2i2i2i2', str)
+        luaunit.assertEquals ({ l1, r1, l2, r2 }, { 16384, 8192, -16384, 0 })
+        luaunit.assertEquals (string.unpack ('<i2', str, 17), 32767)
+        luaunit.assertEquals (string.unpack ('<i2', str, 19), -32768)
+
+        local out = AudioBuffer.new64 (2, 5)
+        luaunit.assertEquals (out:frompcm (str, 's16'), 5)
+        luaunit.assertEquals (out:get (1, 1), 0.5)
+        luaunit.assertEquals (out:get (2, 1), 0.25)
+        luaunit.assertEquals (out:get (1, 5), 32767 / 32768)
+
+        local be = string.pack ('>i3>i3', -4194304, 2097152)
+        luaunit.assertEquals (out:frompcm (be, 's24be'), 1)
+        luaunit.assertEquals (out:get (1, 1), -0.5)
+        luaunit.assertEquals (out:get (2, 1), 0.25)
+
+        local f32 = bytes.new (2 * 5 * 4)
+        buf:topcm (f32, 'f32', true)
+        out:frompcm (f32, 'f32')
+        luaunit.assertEquals (out:get (2, 5), -2.0)
+
+        luaunit.assertError (function() buf:topcm (bytes.new (4), 's16') end)
+        luaunit.assertError (function() buf:topcm (data, 'u8') end)
+    end,
+
+    testPCMDitherContinues = function()
+        local silent = AudioBuffer.new32 (1, 64)
+        local function encode()
+            local data = bytes.new (64 * 2)
+            silent:topcm (data, 's16', true)
+            local values = {}
+            for i = 1, bytes.size (data) do values[i] = bytes.get (data, i) end
+            return values
+        end
+
+        -- each block gets new noise, not a repeat of the last one
+        luaunit.assertNotEquals (encode(), encode())
+    end,
+
+    testAnalyze = function()
+        local buf = AudioBuffer.new64 (2, 5)
+        buf:writeblock (1, { { 1, -3, 2, 0, 0 }, { 0.5, 0.5, 0.5, 0.5, 0.5 } })
+
+        local peak, rms, min, max, mean = buf:analyze (1)
+        luaunit.assertEquals (peak, 3)
+        luaunit.assertAlmostEquals (rms, math.sqrt (14 / 5), 1e-12)
+        luaunit.assertEquals (min, -3)
+        luaunit.assertEquals (max, 2)
+        luaunit.assertAlmostEquals (mean, 0.0, 1e-12)
+
+        peak, rms = buf:analyze (1, 3, 1)
+        luaunit.assertEquals (peak, 2)
+        luaunit.assertEquals (rms, 2)
+
+        local results = {}
+        luaunit.assertIs (buf:analyze (results), results)
+        local second = results[2]
+        luaunit.assertEquals (second.mean, 0.5)
+        luaunit.assertEquals (results[1].peak, 3)
+
+        buf:analyze (results)
+        luaunit.assertIs (results[2], second)
+    end,
+
+    testInlineStorage = function()
+        local buf = AudioBuffer.new32 (3, 256)
+        luaunit.assertEquals (buf:analyze (3), 0.0)
+        buf:set (3, 256, 1.0)
+        luaunit.assertEquals (buf:get (3, 256), 1.0)
+
+        buf:free()
+        luaunit.assertEquals (buf:channels(), 0)
+        luaunit.assertEquals (buf:length(), 0)
+    end,
+
     testCleared = function()
         local buf = AudioBuffer.new (2, 128)
         buf:set (1, 1, 0.0)
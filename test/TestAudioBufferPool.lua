@@ -0,0 +1,49 @@
+local AudioBufferPool   = require ('kv.AudioBufferPool')
+local AudioBuffer       = require ('kv.AudioBuffer')
+
+TestAudioBufferPool = {
+    testAcquireRelease = function()
+        local pool = AudioBufferPool.new (2, 2, 64)
+        luaunit.assertEquals (pool:size(), 2)
+        luaunit.assertEquals (pool:available(), 2)
+
+        local a = pool:acquire (true)
+        local b = pool:acquire()
+        luaunit.assertNotNil (a)
+        luaunit.assertNotNil (b)
+        luaunit.assertNil (pool:acquire())
+        luaunit.assertTrue (a:isfloat())
+        luaunit.assertEquals (a:channels(), 2)
+        luaunit.assertEquals (a:length(), 64)
+        luaunit.assertEquals (a:analyze (1), 0.0)
+
+        luaunit.assertTrue (pool:release (a))
+        luaunit.assertFalse (pool:release (a))
+        luaunit.assertFalse (pool:release (AudioBuffer.new (2, 64)))
+        luaunit.assertEquals (pool:available(), 1)
+
+        b:free()
+        pool:release (b)
+        luaunit.assertIs (pool:acquire(), b)
+        luaunit.assertEquals (b:length(), 64)
+    end,
+
+    testScratch = function()
+        local pool = AudioBufferPool.new64 (0, 1, 16, 64, 2)
+        local s1 = pool:scratch (1, 32, true)
+        luaunit.assertTrue (s1:isdouble())
+        luaunit.assertEquals (s1:length(), 32)
+        s1:set (1, 32, 1.0)
+
+        local s2 = pool:scratch (2, 16, true)
+        luaunit.assertEquals (s2:get (1, 1), 0.0)
+        luaunit.assertEquals (s1:get (1, 32), 1.0)
+        luaunit.assertNil (pool:scratch (1, 1))
+
+        pool:reset()
+        luaunit.assertEquals (s1:channels(), 0)
+        luaunit.assertEquals (pool:scratchfree(), 64)
+        luaunit.assertNil (pool:scratch (2, 64))
+        luaunit.assertIs (pool:scratch (1, 64), s1)
+    end
+}
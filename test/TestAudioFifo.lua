@@ -0,0 +1,68 @@
+local AudioFifo         = require ('kv.AudioFifo')
+local AudioBuffer       = require ('kv.AudioBuffer')
+
+TestAudioFifo = {
+    testNew = function()
+        local fifo = AudioFifo.new (2, 100)
+        luaunit.assertEquals (fifo:channels(), 2)
+        luaunit.assertEquals (fifo:capacity(), 100)
+        luaunit.assertEquals (fifo:space(), 100)
+        luaunit.assertEquals (fifo:ready(), 0)
+        luaunit.assertNil (fifo:name())
+        luaunit.assertError (function() AudioFifo.new (0, 100) end)
+        luaunit.assertError (function() AudioFifo.new (1, 0) end)
+    end,
+
+    testPushPop = function()
+        local fifo = AudioFifo.new (2, 10)
+        local src  = AudioBuffer.new64 (2, 8)
+        for f = 1, 8 do
+            src:set (1, f, f)
+            src:set (2, f, -f)
+        end
+        luaunit.assertEquals (fifo:push (src), 8)
+        luaunit.assertEquals (fifo:push (src, 1, 4), 2)
+        luaunit.assertEquals (fifo:ready(), 10)
+        luaunit.assertEquals (fifo:space(), 0)
+
+        local dst = AudioBuffer.new32 (2, 6)
+        luaunit.assertEquals (fifo:pop (dst, 2, 5), 5)
+        luaunit.assertEquals (dst:get (1, 1), 0.0)
+        luaunit.assertEquals (dst:get (1, 2), 1.0)
+        luaunit.assertEquals (dst:get (2, 6), -5.0)
+
+        -- wraps around the end of the ring
+        luaunit.assertEquals (fifo:push (src, 6, 3), 3)
+        luaunit.assertEquals (fifo:pop (dst), 6)
+        luaunit.assertEquals (dst:get (1, 1), 6.0)
+        luaunit.assertEquals (dst:get (1, 5), 2.0)
+        luaunit.assertEquals (dst:get (1, 6), 6.0)
+        luaunit.assertEquals (fifo:ready(), 2)
+
+        fifo:reset()
+        luaunit.assertEquals (fifo:ready(), 0)
+        luaunit.assertError (function() fifo:push (AudioBuffer.new (1, 8)) end)
+        luaunit.assertError (function() fifo:pop (dst, 4, 4) end)
+    end,
+
+    testNamed = function()
+        local fifo = AudioFifo.new (1, 16, 'TestAudioFifo')
+        luaunit.assertEquals (fifo:name(), 'TestAudioFifo')
+        luaunit.assertError (function() AudioFifo.new (1, 16, 'TestAudioFifo') end)
+
+        local other = AudioFifo.open ('TestAudioFifo')
+        luaunit.assertEquals (other:capacity(), 16)
+        local buf = AudioBuffer.new (1, 4)
+        buf:set (1, 1, 0.5)
+        fifo:push (buf)
+        luaunit.assertEquals (other:ready(), 4)
+
+        fifo:release()
+        luaunit.assertError (function() fifo:ready() end)
+        luaunit.assertEquals (other:pop (buf), 4)
+        luaunit.assertEquals (buf:get (1, 1), 0.5)
+        other:release()
+        luaunit.assertNil (AudioFifo.open ('TestAudioFifo'))
+        luaunit.assertNil (AudioFifo.open ('nothing'))
+    end
+}
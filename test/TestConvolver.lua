@@ -0,0 +1,81 @@
+local Convolver         = require ('kv.Convolver')
+local AudioBuffer       = require ('kv.AudioBuffer')
+
+local function noise (buf)
+    for c = 1, buf:channels() do
+        for f = 1, buf:length() do
+            buf:set (c, f, math.random() * 2 - 1)
+        end
+    end
+end
+
+local function direct (ir, input, channel, frame)
+    local sum = 0
+    for k = 1, math.min (ir:length(), frame) do
+        sum = sum + ir:get (channel, k) * input:get (channel, frame - k + 1)
+    end
+    return sum
+end
+
+local function check (conv, ir, length)
+    local input = AudioBuffer.new64 (ir:channels(), length)
+    noise (input)
+    local output = AudioBuffer.new64 (ir:channels(), length)
+    output:copyfrom (input)
+
+    local frame = 1
+    while frame <= length do
+        local count = math.min (length - frame + 1, math.random (1, 100))
+        conv:process (output, frame, count)
+        frame = frame + count
+    end
+
+    for c = 1, ir:channels() do
+        for f = 1, length, 7 do
+            luaunit.assertAlmostEquals (output:get (c, f), direct (ir, input, c, f), 1e-3)
+        end
+    end
+end
+
+TestConvolver = {
+    testNew = function()
+        local ir = AudioBuffer.new32 (2, 300)
+        local conv = Convolver.new (ir, 64)
+        luaunit.assertEquals (conv:channels(), 2)
+        luaunit.assertEquals (conv:length(), 300)
+        luaunit.assertEquals (conv:blocksize(), 64)
+        luaunit.assertEquals (conv:tailsize(), 0)
+        luaunit.assertEquals (Convolver.new (ir, 32, 128):tailsize(), 128)
+        luaunit.assertEquals (Convolver.new (ir, 32, 256):tailsize(), 0)
+        luaunit.assertError (function() Convolver.new (ir, 100) end)
+        luaunit.assertError (function() Convolver.new (ir, 64, 32) end)
+        luaunit.assertError (function() Convolver.new (AudioBuffer.new (0, 0), 64) end)
+        luaunit.assertError (function() conv:process (AudioBuffer.new (1, 64)) end)
+    end,
+
+    testUniform = function()
+        local ir = AudioBuffer.new32 (2, 200)
+        noise (ir)
+        check (Convolver.new (ir, 32), ir, 1000)
+    end,
+
+    testTail = function()
+        local ir = AudioBuffer.new32 (1, 700)
+        noise (ir)
+        check (Convolver.new (ir, 16, 64, false), ir, 2000)
+        check (Convolver.new (ir, 16, 64), ir, 2000)
+    end,
+
+    testReset = function()
+        local ir = AudioBuffer.new64 (1, 4)
+        ir:set (1, 4, 1.0)
+        local conv = Convolver.new (ir, 2)
+        local buf = AudioBuffer.new64 (1, 2)
+        buf:set (1, 1, 1.0)
+        conv:process (buf)
+        conv:reset()
+        buf:clear()
+        conv:process (buf)
+        luaunit.assertEquals (buf:get (1, 2), 0)
+    end
+}
@@ -0,0 +1,95 @@
+local FFT               = require ('kv.FFT')
+local AudioBuffer       = require ('kv.AudioBuffer')
+
+local function sine (buf, channel, cycles)
+    local n = buf:length()
+    for f = 1, n do
+        buf:set (channel, f, math.sin (2 * math.pi * cycles * (f - 1) / n))
+    end
+end
+
+TestFFT = {
+    testNew = function()
+        local fft = FFT.new (256)
+        luaunit.assertEquals (fft:size(), 256)
+        luaunit.assertEquals (fft:bins(), 129)
+        luaunit.assertEquals (fft:window(), 'rectangular')
+        luaunit.assertEquals (fft:format(), 'complex')
+        fft:window ('hann')
+        luaunit.assertEquals (fft:window(), 'hann')
+        luaunit.assertError (function() FFT.new (100) end)
+        luaunit.assertError (function() FFT.new (1) end)
+        luaunit.assertError (function() fft:window ('kaiser') end)
+    end,
+
+    testForward = function()
+        local fft = FFT.new (64)
+        local buf = AudioBuffer.new32 (1, 64)
+        local spectrum = AudioBuffer.new64 (2, fft:bins())
+        sine (buf, 1, 4)
+
+        fft:forward (buf, 1, 1, spectrum)
+        luaunit.assertAlmostEquals (spectrum:get (1, 5), 0, 1e-4)
+        luaunit.assertAlmostEquals (spectrum:get (2, 5), -32, 1e-4)
+        luaunit.assertAlmostEquals (spectrum:get (2, 6), 0, 1e-4)
+
+        fft:format ('polar')
+        fft:forward (buf, 1, 1, spectrum)
+        luaunit.assertAlmostEquals (spectrum:get (1, 5), 32, 1e-4)
+        luaunit.assertAlmostEquals (spectrum:get (2, 5), -math.pi / 2, 1e-4)
+
+        local mags = AudioBuffer.new32 (2, fft:bins())
+        fft:magnitudes (buf, 1, 1, mags, 2)
+        luaunit.assertAlmostEquals (mags:get (2, 5), 32, 1e-4)
+        luaunit.assertEquals (mags:get (1, 5), 0)
+
+        luaunit.assertError (function() fft:forward (buf, 1, 1, AudioBuffer.new (1, 33)) end)
+        luaunit.assertError (function() fft:forward (buf, 1, 1, AudioBuffer.new (2, 32)) end)
+        luaunit.assertError (function() fft:forward (buf, 2, 1, spectrum) end)
+    end,
+
+    testInverse = function()
+        local fft = FFT.new (128)
+        local buf = AudioBuffer.new64 (1, 128)
+        local out = AudioBuffer.new64 (1, 128)
+        local spectrum = AudioBuffer.new32 (2, fft:bins())
+        for f = 1, 128 do buf:set (1, f, math.cos (f * 0.3) + (f % 5) * 0.1) end
+
+        fft:forward (buf, 1, 1, spectrum)
+        fft:inverse (spectrum, out, 1)
+        for f = 1, 128 do
+            luaunit.assertAlmostEquals (out:get (1, f), buf:get (1, f), 1e-4)
+        end
+    end,
+
+    testTransform = function()
+        local fft = FFT.new (16)
+        local data = AudioBuffer.new64 (2, 16)
+        data:set (1, 2, 1.0)
+        fft:transform (data)
+        luaunit.assertAlmostEquals (data:get (1, 5), 0, 1e-6)
+        luaunit.assertAlmostEquals (data:get (2, 5), -1, 1e-6)
+        fft:transform (data, true)
+        luaunit.assertAlmostEquals (data:get (1, 2), 1, 1e-6)
+        luaunit.assertAlmostEquals (data:get (1, 3), 0, 1e-6)
+    end,
+
+    testOverlapAdd = function()
+        local size, hop = 256, 64
+        local fft = FFT.new (size)
+        fft:window ('hann')
+        local input = AudioBuffer.new32 (1, 2048)
+        local output = AudioBuffer.new32 (1, 2048)
+        local spectrum = AudioBuffer.new32 (2, fft:bins())
+        sine (input, 1, 37)
+
+        for start = 1, input:length(), hop do
+            fft:forward (input, 1, start, spectrum)
+            fft:overlapadd (spectrum, output, 1, start, hop)
+        end
+
+        for f = size, input:length() - size do
+            luaunit.assertAlmostEquals (output:get (1, f), input:get (1, f), 1e-4)
+        end
+    end
+}
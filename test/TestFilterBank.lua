@@ -0,0 +1,72 @@
+local FilterBank        = require ('kv.FilterBank')
+local AudioBuffer       = require ('kv.AudioBuffer')
+
+local function peak (buf, channel, start)
+    local result = 0
+    for f = start, buf:length() do
+        result = math.max (result, math.abs (buf:get (channel, f)))
+    end
+    return result
+end
+
+TestFilterBank = {
+    testNew = function()
+        local fb = FilterBank.new (2, 3, 48000)
+        luaunit.assertEquals (fb:size(), 3)
+        luaunit.assertEquals (fb:channels(), 2)
+        luaunit.assertEquals (fb:coeffs (1), 1.0)
+        luaunit.assertAlmostEquals (fb:magnitude (1000), 1.0, 1e-12)
+        luaunit.assertError (function() fb:design (4, 'lowpass', 1000) end)
+        luaunit.assertError (function() fb:design (1, 'comb', 1000) end)
+        luaunit.assertError (function() fb:design (1, 'lowpass', 30000) end)
+    end,
+
+    testDesign = function()
+        local fb = FilterBank.new (1, 1, 48000)
+        fb:design (1, 'peak', 1000, 1.0, 6.0)
+        luaunit.assertAlmostEquals (fb:magnitude (1000), 10 ^ (6 / 20), 1e-9)
+        fb:design (1, 'lowshelf', 200, 0.7071, -12)
+        luaunit.assertAlmostEquals (fb:magnitude (10), 10 ^ (-12 / 20), 1e-3)
+        fb:design (1, 'highpass', 1000)
+        luaunit.assertAlmostEquals (fb:magnitude (1000), math.sqrt (0.5), 1e-9)
+        fb:setcoeffs (1, 0.5, 0, 0, 0, 0)
+        luaunit.assertEquals (fb:magnitude (1234), 0.5)
+    end,
+
+    testProcess = function()
+        local fb = FilterBank.new (3, 2, 48000)
+        fb:design (1, 'lowpass', 2000)
+        fb:design (2, 'lowpass', 2000)
+
+        local buf = AudioBuffer.new32 (3, 4800)
+        for c = 1, 3 do
+            for f = 1, buf:length() do
+                buf:set (c, f, math.sin (2 * math.pi * 8000 * (f - 1) / 48000))
+            end
+        end
+
+        fb:process (buf, 1, 100)
+        fb:process (buf, 101)
+        local expected = fb:magnitude (8000)
+        for c = 1, 3 do
+            luaunit.assertAlmostEquals (peak (buf, c, 2400), expected, 0.01)
+        end
+
+        luaunit.assertError (function() fb:process (AudioBuffer.new (2, 16)) end)
+    end,
+
+    testSmoothing = function()
+        local fb = FilterBank.new (1, 1)
+        fb:setcoeffs (1, 0.5, 0, 0, 0, 0)
+        fb:smoothing (100)
+        luaunit.assertEquals (fb:smoothing(), 100)
+        fb:setcoeffs (1, 1.0, 0, 0, 0, 0)
+
+        local buf = AudioBuffer.new64 (1, 200)
+        for f = 1, 200 do buf:set (1, f, 1.0) end
+        fb:process (buf)
+        luaunit.assertAlmostEquals (buf:get (1, 1), 0.505, 1e-9)
+        luaunit.assertAlmostEquals (buf:get (1, 50), 0.75, 1e-9)
+        luaunit.assertAlmostEquals (buf:get (1, 150), 1.0, 1e-9)
+    end
+}
@@ -0,0 +1,196 @@
+local Graph             = require ('kv.Graph')
+local AudioBuffer       = require ('kv.AudioBuffer')
+local MidiBuffer        = require ('kv.MidiBuffer')
+local midi              = require ('kv.midi')
+
+local function fill (buf, value)
+    for c = 1, buf:channels() do
+        for f = 1, buf:length() do
+            buf:set (c, f, value)
+        end
+    end
+end
+
+TestGraph = {
+    testTopology = function()
+        local graph = Graph.new (2, 64)
+        local a = graph:add ('gain', 2)
+        local b = graph:add ('gain', 2)
+        luaunit.assertEquals (graph:input(), 1)
+        luaunit.assertEquals (graph:output(), 2)
+        luaunit.assertTrue (graph:connect (b, graph:output()))
+        luaunit.assertTrue (graph:connect (a, b))
+        luaunit.assertFalse (graph:connect (a, b))
+        luaunit.assertTrue (graph:connect (graph:input(), a))
+        luaunit.assertEquals (graph:order(), { 1, a, b, 2 })
+        luaunit.assertError (function() graph:connect (b, a) end)
+        luaunit.assertError (function() graph:connect (a, a) end)
+        luaunit.assertError (function() graph:connect (a, graph:input()) end)
+        luaunit.assertError (function() graph:add ('reverb', 2) end)
+
+        graph:remove (a)
+        luaunit.assertEquals (graph:order(), { 1, b, 2 })
+        luaunit.assertError (function() graph:connect (a, b) end)
+    end,
+
+    testBufferReuse = function()
+        local graph = Graph.new (1, 64)
+        local prev = graph:input()
+        for _ = 1, 16 do
+            local node = graph:add ('gain', 1)
+            graph:connect (prev, node)
+            prev = node
+        end
+        graph:connect (prev, graph:output())
+        luaunit.assertEquals (graph:buffers(), 2)
+    end,
+
+    testProcess = function()
+        local graph = Graph.new (2, 32)
+        local amp   = graph:add ('gain', 2, 0.5)
+        local delay = graph:add ('delay', 2, 16, 4)
+        local mix   = graph:add ('mixer', 2, 2)
+        graph:connect (graph:input(), amp)
+        graph:connect (graph:input(), delay)
+        graph:connect (amp, mix, 1)
+        graph:connect (delay, mix, 2)
+        graph:connect (mix, graph:output())
+        luaunit.assertEquals (graph:get (delay, 'delay'), 4)
+        luaunit.assertError (function() graph:set (amp, 'freq', 100) end)
+        luaunit.assertError (function() graph:connect (amp, mix, 3) end)
+
+        local audio = AudioBuffer.new64 (2, 32)
+        audio:set (1, 1, 1.0)
+        audio:set (2, 1, 2.0)
+        graph:process (audio)
+        luaunit.assertEquals (audio:get (1, 1), 0.5)
+        luaunit.assertEquals (audio:get (2, 1), 1.0)
+        luaunit.assertEquals (audio:get (1, 5), 1.0)
+        luaunit.assertEquals (audio:get (2, 5), 2.0)
+        luaunit.assertEquals (audio:get (1, 2), 0.0)
+
+        luaunit.assertError (function() graph:process (AudioBuffer.new (1, 32)) end)
+        luaunit.assertError (function() graph:process (AudioBuffer.new (2, 33)) end)
+    end,
+
+    testParameters = function()
+        local graph = Graph.new (1, 64, 48000)
+        local eq  = graph:add ('biquad', 1, 'lowpass', 1000)
+        local mix = graph:add ('mixer', 1, 1)
+        graph:connect (graph:input(), eq)
+        graph:connect (eq, mix)
+        graph:connect (mix, graph:output())
+        graph:set (eq, 'freq', 2000)
+        luaunit.assertEquals (graph:get (eq, 'freq'), 2000)
+        graph:set (mix, 'gain1', 0.0)
+        luaunit.assertEquals (graph:get (mix, 'gain1'), 0.0)
+        luaunit.assertError (function() graph:set (mix, 'gain2', 0.0) end)
+
+        local audio = AudioBuffer.new32 (1, 64)
+        for _ = 1, 2 do
+            fill (audio, 1.0)
+            graph:process (audio)
+        end
+        luaunit.assertEquals (audio:get (1, 64), 0.0)
+    end,
+
+    testLuaNode = function()
+        local graph = Graph.new (1, 16)
+        local seen = 0
+        local node = graph:add ('lua', 1, function (audio, midi)
+            seen = seen + midi:size()
+            for f = 1, audio:length() do
+                audio:set (1, f, audio:get (1, f) * 3)
+            end
+        end)
+        graph:connect (graph:input(), node)
+        graph:connect (node, graph:output())
+        graph:connectmidi (graph:input(), node)
+        graph:connectmidi (node, graph:output())
+        luaunit.assertError (function() graph:connectmidi (graph:input(), graph:add ('gain', 1)) end)
+
+        local audio = AudioBuffer.new32 (1, 16)
+        fill (audio, 1.0)
+        local events = MidiBuffer.new()
+        events:insert (midi.noteon (1, 60, 100), 4)
+        graph:process (audio, events)
+        luaunit.assertEquals (audio:get (1, 16), 3.0)
+        luaunit.assertEquals (seen, 1)
+        luaunit.assertEquals (events:size(), 1)
+
+        graph:add ('lua', 1, function() error ('boom') end)
+        luaunit.assertErrorMsgContains ('boom', function() graph:process (audio) end)
+    end,
+
+    testLuaNodeRemovesItself = function()
+        local graph = Graph.new (1, 16)
+        local node, gain
+        node = graph:add ('lua', 1, function (audio)
+            audio:applygain (2.0)
+            graph:remove (gain)
+            graph:remove (node)
+        end)
+        gain = graph:add ('gain', 1)
+        graph:connect (graph:input(), node)
+        graph:connect (node, gain)
+        graph:connect (gain, graph:output())
+
+        local audio = AudioBuffer.new32 (1, 16)
+        fill (audio, 1.0)
+        graph:process (audio)
+        luaunit.assertEquals (graph:order(), { 1, 2 })
+        luaunit.assertError (function() graph:remove (node) end)
+
+        fill (audio, 1.0)
+        graph:process (audio)
+        luaunit.assertEquals (audio:get (1, 1), 0.0)
+    end,
+
+    testThreads = function()
+        local function render (threads)
+            local graph = Graph.new (2, 64, 48000)
+            graph:threads (threads)
+            local mix = graph:add ('mixer', 2, 4)
+            for i = 1, 4 do
+                local eq    = graph:add ('biquad', 2, 'lowpass', 500 * i)
+                local delay = graph:add ('delay', 2, 32, i * 3, 0.5)
+                graph:connect (graph:input(), eq)
+                graph:connect (eq, delay)
+                graph:connect (delay, mix, i)
+            end
+            local calls = 0
+            local scale = graph:add ('lua', 2, function (audio)
+                calls = calls + 1
+                if calls == 1 then
+                    -- applied after the block
+                    graph:set (mix, 'gain1', 0.5)
+                    luaunit.assertEquals (graph:get (mix, 'gain1'), 1.0)
+                end
+                if threads > 0 then
+                    luaunit.assertError (function() graph:add ('gain', 1) end)
+                end
+                audio:applygain (0.25)
+            end)
+            graph:connect (mix, scale)
+            graph:connect (scale, graph:output())
+            luaunit.assertEquals (graph:threads(), threads)
+
+            local audio, out = AudioBuffer.new32 (2, 64), {}
+            for block = 1, 4 do
+                for c = 1, 2 do
+                    for f = 1, 64 do audio:set (c, f, math.sin (block * f * c)) end
+                end
+                graph:process (audio)
+                for f = 1, 64 do out[#out + 1] = audio:get (2, f) end
+            end
+            luaunit.assertTrue (graph:rendertime() >= 0)
+            graph:threads (0)
+            return out
+        end
+
+        local serial = render (0)
+        luaunit.assertEquals (render (1), serial)
+        luaunit.assertEquals (render (3), serial)
+        luaunit.assertError (function() Graph.new (1, 16):threads (-1) end)
+    end
+}
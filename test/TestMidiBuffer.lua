@@ -1,6 +1,7 @@
 local MidiBuffer    = require ('kv.MidiBuffer');
 local MidiMessage   = require ('kv.MidiMessage');
 local midi          = require ('kv.midi')
+local bytes         = require ('kv.bytes')
 
 test_MidiBuffer = {
     testNew = function()
@@ -34,6 +35,194 @@ test_MidiBuffer = {
             "Invalid message counts: "..non..noff)
     end,
 
+    testIteratorsReused = function()
+        local buf = MidiBuffer.new()
+        luaunit.assertTrue (rawequal (buf:events(), buf:events()))
+        luaunit.assertTrue (rawequal (buf:messages(), buf:messages()))
+        luaunit.assertTrue (rawequal (buf:views(), buf:views()))
+    end,
+
+    testViews = function()
+        local buf = MidiBuffer.new()
+        buf:insert (midi.noteon (2, 60, 100), 1)
+        buf:insert (midi.controller (3, 7, 64), 10)
+        buf:insert (midi.noteon (2, 60, 0), 20)
+
+        local seen = {}
+        for v, f in buf:views() do
+            seen[#seen + 1] = { v:channel(), v:data1(), v:data2(), f, v:frame(),
+                                v:isnoteon(), v:isnoteoff(), v:iscontroller() }
+        end
+        luaunit.assertEquals (seen, {
+            { 2, 60, 100, 1,  1,  true,  false, false },
+            { 3, 7,  64,  10, 10, false, false, true },
+            { 2, 60, 0,   20, 20, false, true,  false }
+        })
+    end,
+
+    testForeach = function()
+        local buf = MidiBuffer.new()
+        for f = 1, 10 do buf:insert (midi.noteon (1, 40 + f, 100), f) end
+
+        local notes = 0
+        buf:foreach (function (v, f)
+            luaunit.assertEquals (v:note(), 40 + f)
+            luaunit.assertEquals (v:packed(), midi.noteon (1, 40 + f, 100))
+            notes = notes + 1
+            return f < 5
+        end)
+        luaunit.assertEquals (notes, 5)
+    end,
+
+    testViewOutsideLoop = function()
+        local buf = MidiBuffer.new()
+        buf:insert (midi.noteon (1, 60, 100), 1)
+        local kept
+        buf:foreach (function (v) kept = v end)
+        luaunit.assertError (function() return kept:note() end)
+
+        for v in buf:views() do
+            kept = v
+            break
+        end
+        luaunit.assertEquals (kept:note(), 60)
+        buf:clear()
+        luaunit.assertError (function() return kept:note() end)
+
+        buf:insert (midi.noteon (1, 62, 100), 1)
+        luaunit.assertFalse (pcall (buf.foreach, buf, function (v)
+            kept = v
+            error ('stop')
+        end))
+        luaunit.assertError (function() return kept:note() end)
+
+        for v in buf:views() do
+            kept = v
+            break
+        end
+        buf = nil
+        collectgarbage()
+        collectgarbage()
+        luaunit.assertError (function() return kept:note() end)
+    end,
+
+    testDecode = function()
+        local buf = MidiBuffer.new()
+        buf:insert (midi.noteon (2, 60, 100), 1)
+        buf:insert (midi.controller (3, 7, 64), 10)
+        buf:insert (midi.noteoff (2, 60, 0), 20)
+
+        local frames, status, data1, data2 = {}, {}, {}, {}
+        luaunit.assertEquals (buf:decode (frames, status, data1, data2), 3)
+        luaunit.assertEquals (frames, { 1, 10, 20 })
+        luaunit.assertEquals (status, { 0x91, 0xb2, 0x81 })
+        luaunit.assertEquals (data1,  { 60, 7, 60 })
+        luaunit.assertEquals (data2,  { 100, 64, 0 })
+
+        local st = {}
+        luaunit.assertEquals (buf:decode (nil, st), 3)
+        luaunit.assertEquals (st, status)
+
+        local small = bytes.new (2)
+        luaunit.assertEquals (buf:decode (nil, small), 2)
+        luaunit.assertEquals (bytes.get (small, 2), 0xb2)
+        luaunit.assertError (function() buf:decode (small) end)
+    end,
+
+    testFixed = function()
+        -- a three byte message takes 9 bytes
+        local buf = MidiBuffer.fixed (45)
+        luaunit.assertEquals (buf:capacity(), 45)
+        for f = 1, 8 do buf:insert (midi.noteon (1, f, 100), f) end
+        luaunit.assertEquals (buf:size(), 5)
+        luaunit.assertEquals (buf:overflows(), 3)
+        luaunit.assertEquals (buf:overflows (0), 0)
+
+        local oldest = MidiBuffer.fixed (45, 'oldest')
+        for f = 1, 8 do oldest:insert (midi.noteon (1, f, 100), f) end
+        local frames = {}
+        luaunit.assertEquals (oldest:decode (frames), 5)
+        luaunit.assertEquals (frames, { 4, 5, 6, 7, 8 })
+        luaunit.assertEquals (oldest:overflows(), 3)
+
+        local grow = MidiBuffer.fixed (45, 'grow')
+        for f = 1, 8 do grow:insert (midi.noteon (1, f, 100), f) end
+        luaunit.assertEquals (grow:size(), 8)
+        luaunit.assertEquals (grow:overflows(), 3)
+
+        luaunit.assertEquals (MidiBuffer.new():capacity(), 0)
+        luaunit.assertError (function() MidiBuffer.fixed (0) end)
+        luaunit.assertError (function() MidiBuffer.fixed (64, 'nope') end)
+        luaunit.assertError (function() buf:swap (MidiBuffer.new()) end)
+        buf:swap (MidiBuffer.fixed (45))
+        luaunit.assertEquals (buf:size(), 0)
+    end,
+
+    testFixedClear = function()
+        local buf = MidiBuffer.fixed (90)
+        for f = 1, 6 do buf:insert (midi.noteon (1, f, 100), f) end
+        buf:clear (2, 3)
+        local frames = {}
+        luaunit.assertEquals (buf:decode (frames), 3)
+        luaunit.assertEquals (frames, { 1, 5, 6 })
+    end,
+
+    testInsertOrder = function()
+        local buf = MidiBuffer.new()
+        for _, f in ipairs ({ 5, 5, 9, 2, 9, 1, 12 }) do
+            buf:insert (midi.noteon (1, f, 100), f)
+        end
+        local frames = {}
+        luaunit.assertEquals (buf:decode (frames), 7)
+        luaunit.assertEquals (frames, { 1, 2, 5, 5, 9, 9, 12 })
+    end,
+
+    testInsertMany = function()
+        local buf = MidiBuffer.new()
+        local data, frames = {}, {}
+        for i = 1, 16 do
+            data[i]   = midi.noteon (1, 40 + i, 100)
+            frames[i] = (i * 7) % 32 + 1
+        end
+        luaunit.assertEquals (buf:insertmany (data, frames), 16)
+        luaunit.assertEquals (buf:insertmany (data, frames, 4), 4)
+        luaunit.assertEquals (buf:size(), 20)
+        luaunit.assertError (function() buf:insertmany (data, frames, 17) end)
+        luaunit.assertError (function() buf:insertmany (data, frames, -1) end)
+        luaunit.assertError (function() buf:insertmany (data, { 1, 2 }) end)
+        luaunit.assertEquals (buf:size(), 20)
+        local out = {}
+        buf:decode (out)
+        for i = 2, #out do luaunit.assertTrue (out[i - 1] <= out[i]) end
+
+        local fixed = MidiBuffer.fixed (36)
+        luaunit.assertEquals (fixed:insertmany (data, frames), 4)
+    end,
+
+    testMerge = function()
+        local dest = MidiBuffer.new()
+        dest:insert (midi.noteon (1, 1, 100), 3)
+        local a, b = MidiBuffer.new(), MidiBuffer.new()
+        for f = 1, 9, 2 do a:insert (midi.noteon (2, f, 100), f) end
+        for f = 2, 10, 2 do b:insert (midi.noteon (3, f, 100), f) end
+
+        luaunit.assertEquals (MidiBuffer.merge (dest, { a, b, dest }), 11)
+        local frames, status = {}, {}
+        dest:decode (frames, status)
+        luaunit.assertEquals (frames, { 1, 2, 3, 3, 4, 5, 6, 7, 8, 9, 10 })
+        luaunit.assertEquals (status[3], 0x90)
+        luaunit.assertEquals (status[4], 0x91)
+        luaunit.assertEquals (a:size(), 5)
+
+        local out = MidiBuffer.new()
+        luaunit.assertEquals (out:merge ({ a, b }, { 0, 100 }), 10)
+        out:decode (frames)
+        luaunit.assertEquals (frames[6], 102)
+
+        luaunit.assertError (function() out:merge ({ a, 42 }) end)
+        luaunit.assertEquals (out:size(), 10)
+    end,
+
     testReserve = function()
         local buf = MidiBuffer.new()
         buf:reserve (1024)
@@ -0,0 +1,68 @@
+local MidiPipe          = require ('kv.MidiPipe')
+local MidiBuffer        = require ('kv.MidiBuffer')
+local midi              = require ('kv.midi')
+
+TestMidiPipe = {
+    testNew = function()
+        local pipe = MidiPipe.new (4, 8, 1024)
+        luaunit.assertEquals (pipe:size(), 4)
+        luaunit.assertEquals (pipe:reserved(), 8)
+        luaunit.assertEquals (pipe:get (1), pipe:get (1))
+        luaunit.assertNotEquals (pipe:get (1), pipe:get (2))
+        luaunit.assertError (function() pipe:get (5) end)
+        luaunit.assertError (function() MidiPipe.new (-1) end)
+    end,
+
+    testResize = function()
+        local pipe = MidiPipe.new (2, 4)
+        pipe:resize (4)
+        luaunit.assertEquals (pipe:reserved(), 4)
+        local third = pipe:get (3)
+        third:insert (midi.noteon (1, 60, 100), 1)
+        pipe:resize (2)
+        luaunit.assertError (function() pipe:get (3) end)
+        pipe:resize (3)
+        luaunit.assertEquals (pipe:get (3), third)
+        luaunit.assertEquals (third:size(), 0)
+        pipe:resize (6)
+        luaunit.assertEquals (pipe:reserved(), 6)
+        luaunit.assertEquals (pipe:size(), 6)
+    end,
+
+    testMergeSplit = function()
+        local pipe = MidiPipe.new (18)
+        local input = MidiBuffer.new()
+        input:insert (midi.noteon (1, 60, 100), 1)
+        input:insert (midi.noteon (2, 62, 100), 2)
+        input:insert (midi.noteon (16, 64, 100), 3)
+        input:insert (0xf8, 4)  -- clock
+
+        pipe:split (input)
+        luaunit.assertEquals (pipe:get (1):size(), 2)
+        luaunit.assertEquals (pipe:get (2):size(), 2)
+        luaunit.assertEquals (pipe:get (3):size(), 1)
+        luaunit.assertEquals (pipe:get (16):size(), 2)
+        luaunit.assertEquals (pipe:get (17):size(), 0)
+        luaunit.assertError (function() pipe:split (input, 4) end)
+        luaunit.assertError (function() pipe:split (2, 1) end)
+        luaunit.assertError (function() pipe:split (pipe:get (3), 1) end)
+
+        pipe:merge (17, 1, 2)
+        luaunit.assertEquals (pipe:get (17):size(), 4)
+        local output = MidiBuffer.new()
+        pipe:merge (output)
+        -- 16 clocks, 3 notes, and the 4 merged into buffer 17
+        luaunit.assertEquals (output:size(), 23)
+        local last = 0
+        for _, _, frame in output:events() do
+            luaunit.assertTrue (frame >= last)
+            last = frame
+        end
+
+        pipe:clear (17)
+        luaunit.assertEquals (pipe:get (17):size(), 0)
+        luaunit.assertEquals (pipe:get (1):size(), 2)
+        pipe:clear()
+        luaunit.assertEquals (pipe:get (1):size(), 0)
+    end
+}
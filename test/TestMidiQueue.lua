@@ -0,0 +1,56 @@
+local MidiQueue         = require ('kv.MidiQueue')
+local MidiBuffer        = require ('kv.MidiBuffer')
+local midi              = require ('kv.midi')
+
+TestMidiQueue = {
+    testNew = function()
+        local queue = MidiQueue.new (100, 48000)
+        luaunit.assertEquals (queue:capacity(), 128)
+        luaunit.assertEquals (queue:samplerate(), 48000)
+        luaunit.assertEquals (queue:size(), 0)
+        luaunit.assertNil (queue:name())
+        luaunit.assertError (function() MidiQueue.new (0) end)
+        luaunit.assertError (function() MidiQueue.new (16, 0) end)
+    end,
+
+    testDrain = function()
+        -- one frame per millisecond
+        local queue = MidiQueue.new (4, 1000)
+        luaunit.assertTrue (queue:push (midi.noteon (1, 60, 100), 95))
+        luaunit.assertTrue (queue:push (midi.noteoff (1, 60), 50))
+        luaunit.assertTrue (queue:push (midi.noteon (1, 64, 100), 120))
+        luaunit.assertTrue (queue:push (midi.noteon (1, 67, 100)))
+        luaunit.assertFalse (queue:push (midi.noteon (1, 72, 100)))
+        luaunit.assertEquals (queue:size(), 4)
+        queue:clear()
+        luaunit.assertEquals (queue:size(), 0)
+
+        queue:push (midi.noteon (1, 60, 100), 95)
+        queue:push (midi.noteoff (1, 60), 50)
+        queue:push (midi.noteon (1, 64, 100), 120)
+        local buffer = MidiBuffer.new()
+        luaunit.assertEquals (queue:drain (buffer, 10, 100), 3)
+        luaunit.assertEquals (buffer:size(), 3)
+        luaunit.assertEquals (queue:size(), 0)
+
+        local frames = {}
+        for _, _, frame in buffer:events() do
+            frames[#frames + 1] = frame
+        end
+        luaunit.assertEquals (frames, { 1, 6, 10 })
+        luaunit.assertError (function() queue:drain (buffer, 0) end)
+    end,
+
+    testNamed = function()
+        local queue = MidiQueue.new (16, 44100, 'TestMidiQueue')
+        luaunit.assertEquals (queue:name(), 'TestMidiQueue')
+        luaunit.assertError (function() MidiQueue.new (16, 44100, 'TestMidiQueue') end)
+        local other = MidiQueue.open ('TestMidiQueue')
+        other:push (midi.noteon (1, 60, 100), MidiQueue.now())
+        luaunit.assertEquals (queue:size(), 1)
+        queue:release()
+        luaunit.assertError (function() queue:size() end)
+        other:release()
+        luaunit.assertNil (MidiQueue.open ('TestMidiQueue'))
+    end
+}
@@ -0,0 +1,76 @@
+local MidiTransform     = require ('kv.MidiTransform')
+local MidiBuffer        = require ('kv.MidiBuffer')
+local midi              = require ('kv.midi')
+
+local function packed (buffer)
+    local out = {}
+    buffer:foreach (function (v, f)
+        out[#out + 1] = { f, v:packed() }
+    end)
+    return out
+end
+
+TestMidiTransform = {
+    testPassThrough = function()
+        local t = MidiTransform.new {}
+        local buf = MidiBuffer.new()
+        buf:insert (midi.noteon (1, 60, 100), 1)
+        buf:insert (midi.controller (5, 7, 64), 2)
+        local before = packed (buf)
+        luaunit.assertEquals (t:apply (buf), 2)
+        luaunit.assertEquals (packed (buf), before)
+    end,
+
+    testFilters = function()
+        local t = MidiTransform.new {
+            types    = { 'noteon', 'noteoff' },
+            channels = { 1, 2 },
+            notes    = { 36, 72 }
+        }
+        luaunit.assertEquals (t:message (midi.noteon (1, 60, 100)), midi.noteon (1, 60, 100))
+        luaunit.assertEquals (t:message (midi.noteon (2, 60, 0)), midi.noteon (2, 60, 0))
+        luaunit.assertNil (t:message (midi.noteon (3, 60, 100)))
+        luaunit.assertNil (t:message (midi.noteon (1, 80, 100)))
+        luaunit.assertNil (t:message (midi.controller (1, 7, 64)))
+    end,
+
+    testRewrite = function()
+        local t = MidiTransform.new {
+            channel     = { [1] = 10 },
+            transpose   = 12,
+            velocity    = function (v) return v * 2 end,
+            controllers = { [7] = 11, [1] = false }
+        }
+        luaunit.assertEquals (t:message (midi.noteon (1, 60, 40)), midi.noteon (10, 72, 80))
+        luaunit.assertEquals (t:message (midi.noteon (1, 60, 100)), midi.noteon (10, 72, 127))
+        luaunit.assertEquals (t:message (midi.noteoff (2, 60, 0)), midi.noteoff (2, 72, 0))
+        luaunit.assertNil (t:message (midi.noteon (1, 120, 40)))
+        luaunit.assertEquals (t:message (midi.controller (3, 7, 1)), midi.controller (3, 11, 1))
+        luaunit.assertNil (t:message (midi.controller (3, 1, 1)))
+    end,
+
+    testApply = function()
+        local t = MidiTransform.new { channel = 3, transpose = -12, velocity = 90 }
+        local buf = MidiBuffer.new()
+        buf:insert (midi.noteon (1, 60, 100), 1)
+        buf:insert (midi.noteon (1, 5, 100), 5)
+        buf:insert (midi.noteoff (1, 60, 0), 9)
+        luaunit.assertEquals (t:apply (buf), 2)
+        luaunit.assertEquals (packed (buf), {
+            { 1, midi.noteon (3, 48, 90) },
+            { 9, midi.noteoff (3, 48, 0) }
+        })
+    end,
+
+    testBadRules = function()
+        luaunit.assertError (function() MidiTransform.new { types = { 'nope' } } end)
+        luaunit.assertError (function() MidiTransform.new { channels = { 17 } } end)
+        luaunit.assertError (function() MidiTransform.new { notes = { 60, 40 } } end)
+        luaunit.assertError (function() MidiTransform.new { channel = 0 } end)
+        luaunit.assertError (function() MidiTransform.new { controllers = { [1] = 200 } } end)
+    end,
+
+    tearDown = function()
+        collectgarbage()
+    end
+}
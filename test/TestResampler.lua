@@ -0,0 +1,56 @@
+local Resampler         = require ('kv.Resampler')
+local AudioBuffer       = require ('kv.AudioBuffer')
+
+local function sine (buf, rate, freq, offset)
+    for c = 1, buf:channels() do
+        for f = 1, buf:length() do
+            buf:set (c, f, math.sin (2 * math.pi * freq * (offset + f - 1) / rate))
+        end
+    end
+end
+
+TestResampler = {
+    testNew = function()
+        local rs = Resampler.new (2, 44100, 48000)
+        luaunit.assertAlmostEquals (rs:ratio(), 44100 / 48000, 1e-12)
+        luaunit.assertTrue (rs:latency() > 0)
+        luaunit.assertTrue (rs:outputsize (512) >= math.ceil (512 * 48000 / 44100))
+        luaunit.assertError (function() Resampler.new (0, 44100, 48000) end)
+        luaunit.assertError (function() Resampler.new (1, 44100, 48000, 'cubic') end)
+    end,
+
+    testStream = function()
+        for _, quality in ipairs { 'linear', 'sinc', 'best' } do
+            local rs  = Resampler.new (1, 48000, 96000, quality)
+            local src = AudioBuffer.new32 (1, 256)
+            local dst = AudioBuffer.new64 (1, rs:outputsize (256))
+            local total = 0
+            for block = 0, 7 do
+                sine (src, 48000, 1000, block * 256)
+                local consumed, produced = rs:process (src, dst)
+                luaunit.assertEquals (consumed, 256)
+                -- compare against the ideal signal, delayed by the filter
+                for f = 1, produced do
+                    local t = (total + f - 1) / 2 - rs:latency()
+                    if t > 64 then
+                        local expected = math.sin (2 * math.pi * 1000 * t / 48000)
+                        luaunit.assertAlmostEquals (dst:get (1, f), expected, 0.01)
+                    end
+                end
+                total = total + produced
+            end
+            luaunit.assertTrue (math.abs (total - 8 * 256 * 2) <= 8)
+        end
+    end,
+
+    testRanges = function()
+        local rs  = Resampler.new (2, 2, 1, 'linear')
+        local src = AudioBuffer.new (2, 64)
+        local dst = AudioBuffer.new (2, 4)
+        local consumed, produced = rs:process (src, 1, 64, dst, 2, 3)
+        luaunit.assertEquals (produced, 3)
+        luaunit.assertEquals (consumed, 64)
+        luaunit.assertError (function() rs:process (src, 60, 10, dst, 1, 1) end)
+        luaunit.assertError (function() rs:process (AudioBuffer.new (1, 8), dst) end)
+    end
+}
@@ -8,10 +8,20 @@ local tests = {
     'test_midi',
     'test_object',
     'TestAudioBuffer',
+    'TestAudioBufferPool',
+    'TestAudioFifo',
     'TestBounds',
+    'TestConvolver',
+    'TestFFT',
+    'TestFilterBank',
+    'TestGraph',
     'TestMidiBuffer',
     'TestMidiMessage',
-    'TestPoint'
+    'TestMidiPipe',
+    'TestMidiQueue',
+    'TestMidiTransform',
+    'TestPoint',
+    'TestResampler'
 }
 for _,t in ipairs (tests) do 
     require (t)
@@ -0,0 +1,137 @@
+/*
+Copyright 2019-2021 Michael Fisher <mfisher@kushview.net>
+
+Permission to use, copy, modify, and/or distribute this software for any 
+purpose with or without fee is hereby granted, provided that the above 
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, 
+INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM 
+LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR 
+OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR 
+PERFORMANCE OF THIS SOFTWARE.
+*/
+
+/* Drives the kv_audio_buffer_* API the way a host would: one long lived
+   buffer refers to the host's channels each block and a script processes
+   them in place. */
+
+#include <stdio.h>
+#include <lauxlib.h>
+#include <lualib.h>
+#include "lua-kv.h"
+
+#define NCHANNELS   2
+#define NFRAMES     256
+#define NBLOCKS     16
+
+static int failures = 0;
+
+#define check(expr) \
+    if (! (expr)) { \
+        fprintf (stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #expr); \
+        ++failures; \
+    }
+
+static const char* process_script =
+    "return function (buf)\n"
+    "    for c = 1, buf:channels() do buf:applygain (c, 0.5) end\n"
+    "end\n";
+
+static void test_host_loop (lua_State* L) {
+    static kv_sample_t host [NCHANNELS][NFRAMES];
+    kv_sample_t* channels [NCHANNELS] = { host[0], host[1] };
+
+    check (luaL_dostring (L, process_script) == LUA_OK);
+    int process = luaL_ref (L, LUA_REGISTRYINDEX);
+
+    kv_audio_buffer_t* buffer = kv_audio_buffer_new (L, 0, 0);
+    int bufref = luaL_ref (L, LUA_REGISTRYINDEX);
+
+    for (int block = 0; block < NBLOCKS; ++block) {
+        for (int c = 0; c < NCHANNELS; ++c)
+            for (int f = 0; f < NFRAMES; ++f)
+                host[c][f] = (kv_sample_t) (block + 1);
+
+        kv_audio_buffer_refer_to (buffer, channels, NCHANNELS, NFRAMES);
+        check (kv_audio_buffer_channels (buffer) == NCHANNELS);
+        check (kv_audio_buffer_length (buffer) == NFRAMES);
+        check (kv_audio_buffer_array (buffer)[1] == host[1]);
+        check (kv_audio_buffer_channel (buffer, 0) == host[0]);
+
+        lua_rawgeti (L, LUA_REGISTRYINDEX, process);
+        lua_rawgeti (L, LUA_REGISTRYINDEX, bufref);
+        check (lua_pcall (L, 1, 0, 0) == LUA_OK);
+
+        /* processed in place, no copy back */
+        check (host[0][0] == (kv_sample_t) (block + 1) * 0.5);
+        check (host[1][NFRAMES - 1] == (kv_sample_t) (block + 1) * 0.5);
+    }
+
+    luaL_unref (L, LUA_REGISTRYINDEX, bufref);
+    luaL_unref (L, LUA_REGISTRYINDEX, process);
+}
+
+static void test_duplicate (lua_State* L) {
+    kv_sample_t src0[4] = { 1, 2, 3, 4 }, src1[4] = { 5, 6, 7, 8 };
+    const kv_sample_t* source[2] = { src0, src1 };
+    float f0[4] = { 0.5f, 0.25f, 0.125f, 0.0f };
+    const float* source32[1] = { f0 };
+
+    kv_audio_buffer_t* buffer = kv_audio_buffer_new (L, 1, 1);
+    kv_audio_buffer_duplicate (buffer, source, 2, 4);
+    check (kv_audio_buffer_channels (buffer) == 2);
+    check (kv_audio_buffer_length (buffer) == 4);
+    check (kv_audio_buffer_channel (buffer, 1) != src1);
+    check (kv_audio_buffer_channel (buffer, 1)[2] == 7);
+
+    kv_audio_buffer_duplicate_32 (buffer, source32, 1, 4);
+    check (kv_audio_buffer_channels (buffer) == 1);
+    check (kv_audio_buffer_channel (buffer, 0)[1] == 0.25);
+
+    kv_audio_buffer_resize (buffer, 2, 8, true, true, true);
+    check (kv_audio_buffer_length (buffer) == 8);
+    check (kv_audio_buffer_channel (buffer, 0)[0] == 0.5);
+    check (kv_audio_buffer_channel (buffer, 1)[7] == 0.0);
+    lua_pop (L, 1);
+}
+
+static void test_duplicate_after_refer (lua_State* L) {
+    static kv_sample_t host [NCHANNELS][NFRAMES];
+    static kv_sample_t copy [NCHANNELS][NFRAMES];
+    kv_sample_t* channels [NCHANNELS] = { host[0], host[1] };
+    const kv_sample_t* source [NCHANNELS] = { copy[0], copy[1] };
+    for (int c = 0; c < NCHANNELS; ++c) {
+        for (int f = 0; f < NFRAMES; ++f) {
+            host[c][f] = (kv_sample_t) 1;
+            copy[c][f] = (kv_sample_t) 2;
+        }
+    }
+
+    kv_audio_buffer_t* buffer = kv_audio_buffer_new (L, 0, 0);
+    kv_audio_buffer_refer_to (buffer, channels, NCHANNELS, NFRAMES);
+    kv_audio_buffer_duplicate (buffer, source, NCHANNELS, NFRAMES);
+    check (kv_audio_buffer_length (buffer) == NFRAMES);
+    check (kv_audio_buffer_channel (buffer, 0) != host[0]);
+    check (kv_audio_buffer_channel (buffer, 1)[NFRAMES - 1] == 2);
+    check (host[0][0] == 1);
+    check (host[1][NFRAMES - 1] == 1);
+    lua_pop (L, 1);
+}
+
+int main (int argc, char** argv) {
+    (void) argc; (void) argv;
+    lua_State* L = luaL_newstate();
+    luaL_openlibs (L);
+
+    test_host_loop (L);
+    test_duplicate (L);
+    test_duplicate_after_refer (L);
+
+    lua_close (L);
+    if (failures > 0)
+        fprintf (stderr, "%d checks failed\n", failures);
+    return failures > 0 ? 1 : 0;
+}